@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "External.hpp"
+#include "stdafx.hpp"
+
+#if defined(_WIN32)
+#include <boost/winapi/handles.hpp>
+#else
+#include <csignal>
+#include <fcntl.h>
+#endif
+
+namespace rz4 {
+    namespace Engine {
+        namespace Codecs {
+            namespace External {
+                namespace {
+                    const size_t PipeBufferSize = 256 * 1024;
+
+                    // Creating pipes and starting packer must be atomic,
+                    // see RunPipe
+                    std::mutex SpawnMutex;
+
+                    fs::path FindPacker(const std::string &Name) {
+                        return bp::search_path("packers/" + Name);
+                    }
+
+                    fs::path WavpackPacker(const std::string &Name) {
+#if _WIN64
+                        return FindPacker(Name + "_x64.exe");
+#else
+                        return FindPacker(Name + "_x32.exe");
+#endif
+                    }
+                }
+
+                /*
+                 * Run packer with stdin fed by Feed (returns count of
+                 * written bytes) and collect its stdout to Out.
+                 */
+                bool RunPipe(
+                    const fs::path &Packer,
+                    const std::vector<std::string> &Args,
+                    const PipeFeeder &Feed,
+                    uintmax_t Size,
+                    std::vector<char> &Out) {
+                    Out.clear();
+
+                    if (Packer.empty()) {
+                        return false;
+                    }
+
+#if !defined(_WIN32)
+                    // Packer may exit before reading all input
+                    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+                    // Packer must not inherit pipes of packers started by
+                    // other workers, otherwise it holds their stdout open
+                    // and they never get end of input
+                    std::unique_lock<std::mutex> Lock(SpawnMutex);
+                    bp::opstream In;
+                    bp::ipstream Result;
+                    bp::child Child;
+
+#if !defined(_WIN32)
+                    // dup2() into stdin / stdout of child drops the flag
+                    fcntl(In.pipe().native_source(), F_SETFD, FD_CLOEXEC);
+                    fcntl(In.pipe().native_sink(), F_SETFD, FD_CLOEXEC);
+                    fcntl(Result.pipe().native_source(), F_SETFD, FD_CLOEXEC);
+                    fcntl(Result.pipe().native_sink(), F_SETFD, FD_CLOEXEC);
+#endif
+
+                    try {
+                        Child = bp::child(bp::exe = Packer, bp::args = Args,
+                            bp::std_in < In, bp::std_out > Result, bp::std_err > bp::null);
+                    } catch (const bp::process_error&) {
+                        return false;
+                    }
+
+#if defined(_WIN32)
+                    boost::winapi::SetHandleInformation(In.pipe().native_sink(), boost::winapi::HANDLE_FLAG_INHERIT_, 0);
+                    boost::winapi::SetHandleInformation(Result.pipe().native_source(), boost::winapi::HANDLE_FLAG_INHERIT_, 0);
+#endif
+
+                    Lock.unlock();
+
+                    uintmax_t WrittenBytes = 0;
+
+                    // Feed stdin from other thread, otherwise
+                    // both processes block on full pipes
+                    std::thread Feeder([&]() {
+                        WrittenBytes = Feed(In);
+                        In.flush();
+                        In.pipe().close();
+                    });
+
+                    std::vector<char> Buffer(PipeBufferSize);
+
+                    while (Result.read(Buffer.data(), Buffer.size()) || Result.gcount() > 0) {
+                        Out.insert(Out.end(), Buffer.data(), Buffer.data() + Result.gcount());
+                    }
+
+                    Feeder.join();
+                    Child.wait();
+
+                    return WrittenBytes == Size && Child.exit_code() == 0 && !Out.empty();
+                }
+
+                bool RunPipe(
+                    const fs::path &Packer,
+                    const std::vector<std::string> &Args,
+                    std::ifstream &Src,
+                    uintmax_t Offset,
+                    uintmax_t Size,
+                    std::vector<char> &Out) {
+                    bool Result = RunPipe(Packer, Args, [&](std::ostream &In) {
+                        std::vector<char> Buffer(PipeBufferSize);
+                        uintmax_t WrittenBytes = 0;
+                        Src.seekg(Offset, std::fstream::beg);
+
+                        while (WrittenBytes < Size) {
+                            const size_t Length = static_cast<size_t>(std::min<uintmax_t>(Buffer.size(), Size - WrittenBytes));
+                            Src.read(Buffer.data(), Length);
+
+                            if (static_cast<size_t>(Src.gcount()) != Length || !In.write(Buffer.data(), Length)) {
+                                break;
+                            }
+
+                            WrittenBytes += Length;
+                        }
+
+                        return WrittenBytes;
+                    }, Size, Out);
+
+                    Src.clear();
+                    return Result;
+                }
+
+                bool RunPipe(
+                    const fs::path &Packer,
+                    const std::vector<std::string> &Args,
+                    const char *Data,
+                    uintmax_t Size,
+                    std::vector<char> &Out) {
+                    return RunPipe(Packer, Args, [&](std::ostream &In) {
+                        uintmax_t WrittenBytes = 0;
+
+                        while (WrittenBytes < Size) {
+                            const size_t Length = static_cast<size_t>(std::min<uintmax_t>(PipeBufferSize, Size - WrittenBytes));
+
+                            if (!In.write(Data + WrittenBytes, Length)) {
+                                break;
+                            }
+
+                            WrittenBytes += Length;
+                        }
+
+                        return WrittenBytes;
+                    }, Size, Out);
+                }
+
+                bool TakEncode(const char *Data, uintmax_t Size, unsigned short Level, std::vector<char> &Out) {
+                    return RunPipe(FindPacker("tak.exe"),
+                        { "-e", "-ihs", "-wm0", "-tn4", "-p4m", "-", "-" }, Data, Size, Out);
+                }
+
+                bool TakDecode(std::ifstream &Src, uintmax_t Offset, uintmax_t Size, std::vector<char> &Out) {
+                    return RunPipe(FindPacker("tak.exe"), { "-d", "-", "-" }, Src, Offset, Size, Out);
+                }
+
+                bool WavpackEncode(const char *Data, uintmax_t Size, unsigned short Level, std::vector<char> &Out) {
+                    return RunPipe(WavpackPacker("wavpack"), { "-q", "-h", "-", "-" }, Data, Size, Out);
+                }
+
+                bool WavpackDecode(std::ifstream &Src, uintmax_t Offset, uintmax_t Size, std::vector<char> &Out) {
+                    return RunPipe(WavpackPacker("wvunpack"), { "-q", "-", "-" }, Src, Offset, Size, Out);
+                }
+            }
+        }
+    }
+}
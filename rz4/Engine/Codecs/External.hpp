@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RZ4_EXTERNAL_CODEC_HPP
+#define RZ4_EXTERNAL_CODEC_HPP
+
+#include <fstream>
+#include <string>
+#include <functional>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <boost/filesystem.hpp>
+#include <boost/process.hpp>
+#include <boost/process/windows.hpp>
+
+namespace rz4 {
+    namespace Engine {
+        namespace Codecs {
+            /*
+             * Drivers for external packers (packers/ folder).
+             * Stream bytes are fed to child's stdin from separate thread,
+             * result is read from child's stdout, no temp files are used.
+             */
+            namespace External {
+                namespace fs = boost::filesystem;
+                namespace bp = boost::process;
+
+                typedef std::function<uintmax_t(std::ostream&)> PipeFeeder;
+
+                bool RunPipe(const fs::path&, const std::vector<std::string>&, const PipeFeeder&, uintmax_t, std::vector<char>&);
+                bool RunPipe(const fs::path&, const std::vector<std::string>&, std::ifstream&, uintmax_t, uintmax_t, std::vector<char>&);
+                bool RunPipe(const fs::path&, const std::vector<std::string>&, const char*, uintmax_t, std::vector<char>&);
+
+                bool TakEncode(const char*, uintmax_t, unsigned short, std::vector<char>&);
+                bool TakDecode(std::ifstream&, uintmax_t, uintmax_t, std::vector<char>&);
+                bool WavpackEncode(const char*, uintmax_t, unsigned short, std::vector<char>&);
+                bool WavpackDecode(std::ifstream&, uintmax_t, uintmax_t, std::vector<char>&);
+            }
+        }
+    }
+}
+
+#endif //RZ4_EXTERNAL_CODEC_HPP
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Lz.hpp"
+#include "stdafx.hpp"
+
+#include <algorithm>
+
+namespace rz4 {
+    namespace Engine {
+        namespace Codecs {
+            namespace Lz {
+                namespace {
+                    const unsigned int HashBits = 14;
+                    const unsigned int MinMatch = 4;
+                    const uint64_t MaxOffset = 65535;
+
+                    // Last bytes of block are always literals,
+                    // matches don't start closer than MatchMargin to the end
+                    const uint64_t LastLiterals = 5;
+                    const uint64_t MatchMargin = 12;
+
+                    // Step of search grows while there are no matches,
+                    // so incompressible data is skipped fast
+                    const unsigned int SkipTrigger = 6;
+
+                    inline uint32_t ReadUInt32(const uint8_t *P) {
+                        uint32_t Value;
+                        std::memcpy(&Value, P, sizeof(Value));
+                        return Value;
+                    }
+
+                    inline uint32_t HashOf(const uint8_t *P) {
+                        return (ReadUInt32(P) * 2654435761u) >> (32 - HashBits);
+                    }
+
+                    /*
+                     * Length over 15 is continued by bytes of 255 and a final byte.
+                     */
+                    inline void WriteLength(uint8_t *&Out, uint64_t Length) {
+                        for (; Length >= 255; Length -= 255) {
+                            *Out++ = 255;
+                        }
+
+                        *Out++ = static_cast<uint8_t>(Length);
+                    }
+
+                    inline bool ReadLength(const uint8_t *&In, const uint8_t *End, uint64_t &Length) {
+                        uint8_t Byte;
+
+                        do {
+                            if (In >= End) {
+                                return false;
+                            }
+
+                            Byte = *In++;
+                            Length += Byte;
+                        } while (Byte == 255);
+
+                        return true;
+                    }
+
+                    /*
+                     * Write one sequence: token, literals and match (if MatchLength > 0).
+                     * Returns false if it doesn't fit before Limit.
+                     */
+                    bool WriteSequence(uint8_t *&Out, const uint8_t *Limit, const uint8_t *Literals,
+                        uint64_t LiteralLength, uint64_t Offset, uint64_t MatchLength) {
+                        const uint64_t Extra = MatchLength > 0 ? MatchLength - MinMatch : 0;
+
+                        if (static_cast<uint64_t>(Limit - Out) < 1 + LiteralLength + LiteralLength / 255 + 1 + 2 + Extra / 255 + 1) {
+                            return false;
+                        }
+
+                        uint8_t &Token = *Out++;
+                        Token = static_cast<uint8_t>(std::min<uint64_t>(LiteralLength, 15) << 4);
+
+                        if (LiteralLength >= 15) {
+                            WriteLength(Out, LiteralLength - 15);
+                        }
+
+                        std::memcpy(Out, Literals, static_cast<size_t>(LiteralLength));
+                        Out += LiteralLength;
+
+                        if (MatchLength == 0) {
+                            return true;
+                        }
+
+                        *Out++ = static_cast<uint8_t>(Offset);
+                        *Out++ = static_cast<uint8_t>(Offset >> 8);
+                        Token |= static_cast<uint8_t>(std::min<uint64_t>(Extra, 15));
+
+                        if (Extra >= 15) {
+                            WriteLength(Out, Extra - 15);
+                        }
+
+                        return true;
+                    }
+                }
+
+                /*
+                 * Encode block into Payload.
+                 * Returns false if block doesn't compress.
+                 */
+                bool Encode(const char *Data, uint64_t Size, std::vector<char> &Payload) {
+                    LzBlockHeader Header;
+                    std::memcpy(Header.Signature, Signature, sizeof(Signature));
+                    Header.OriginalSize = Size;
+
+                    // Output must be smaller than input, so it never grows
+                    Payload.resize(static_cast<size_t>(Size));
+
+                    // Positions in hash table are 32-bit
+                    if (Size <= sizeof(LzBlockHeader) || Size > UINT32_MAX) {
+                        return false;
+                    }
+
+                    std::memcpy(Payload.data(), &Header, sizeof(LzBlockHeader));
+
+                    const uint8_t *In = reinterpret_cast<const uint8_t*>(Data);
+                    uint8_t *Out = reinterpret_cast<uint8_t*>(Payload.data()) + sizeof(LzBlockHeader);
+                    const uint8_t *Limit = reinterpret_cast<const uint8_t*>(Payload.data()) + Payload.size();
+                    std::vector<uint32_t> Table(static_cast<size_t>(1) << HashBits, 0);
+                    uint64_t Anchor = 0;
+                    uint64_t Position = 1;
+
+                    while (Size > MatchMargin && Position < Size - MatchMargin) {
+                        unsigned int Searches = 1 << SkipTrigger;
+                        uint64_t Candidate;
+
+                        // Find 4 equal bytes in the window
+                        while (true) {
+                            const uint32_t Hash = HashOf(In + Position);
+                            Candidate = Table[Hash];
+                            Table[Hash] = static_cast<uint32_t>(Position);
+
+                            if (Candidate < Position && Position - Candidate <= MaxOffset
+                                && ReadUInt32(In + Candidate) == ReadUInt32(In + Position)) {
+                                break;
+                            }
+
+                            Position += Searches++ >> SkipTrigger;
+
+                            if (Position >= Size - MatchMargin) {
+                                break;
+                            }
+                        }
+
+                        if (Position >= Size - MatchMargin) {
+                            break;
+                        }
+
+                        while (Position > Anchor && Candidate > 0 && In[Position - 1] == In[Candidate - 1]) {
+                            Position--;
+                            Candidate--;
+                        }
+
+                        uint64_t Length = MinMatch;
+
+                        while (Position + Length < Size - LastLiterals && In[Position + Length] == In[Candidate + Length]) {
+                            Length++;
+                        }
+
+                        if (!WriteSequence(Out, Limit, In + Anchor, Position - Anchor, Position - Candidate, Length)) {
+                            return false;
+                        }
+
+                        Position += Length;
+                        Anchor = Position;
+
+                        if (Position < Size - MatchMargin) {
+                            Table[HashOf(In + Position - 2)] = static_cast<uint32_t>(Position - 2);
+                        }
+                    }
+
+                    if (!WriteSequence(Out, Limit, In + Anchor, Size - Anchor, 0, 0) || Out == Limit) {
+                        return false;
+                    }
+
+                    Payload.resize(Out - reinterpret_cast<uint8_t*>(Payload.data()));
+                    return true;
+                }
+
+                /*
+                 * Decode block, every length and offset is checked
+                 * against bounds, so broken payload can't write outside of Buffer.
+                 */
+                bool Decode(const char *Data, uint64_t Size, std::vector<char> &Buffer) {
+                    LzBlockHeader Header;
+
+                    if (Size < sizeof(LzBlockHeader)) {
+                        return false;
+                    }
+
+                    std::memcpy(&Header, Data, sizeof(LzBlockHeader));
+
+                    if (std::memcmp(Header.Signature, Signature, sizeof(Signature)) != 0
+                        || Header.OriginalSize > Size * 255) {
+                        return false;
+                    }
+
+                    Buffer.resize(static_cast<size_t>(Header.OriginalSize));
+
+                    const uint8_t *In = reinterpret_cast<const uint8_t*>(Data) + sizeof(LzBlockHeader);
+                    const uint8_t *End = reinterpret_cast<const uint8_t*>(Data) + Size;
+                    uint8_t *Out = reinterpret_cast<uint8_t*>(Buffer.data());
+                    uint8_t *const Begin = Out;
+                    uint8_t *const OutEnd = Out + Buffer.size();
+
+                    while (In < End) {
+                        const uint8_t Token = *In++;
+                        uint64_t Length = Token >> 4;
+
+                        if (Length == 15 && !ReadLength(In, End, Length)) {
+                            return false;
+                        }
+
+                        if (Length > static_cast<uint64_t>(End - In) || Length > static_cast<uint64_t>(OutEnd - Out)) {
+                            return false;
+                        }
+
+                        std::memcpy(Out, In, static_cast<size_t>(Length));
+                        In += Length;
+                        Out += Length;
+
+                        // Last sequence has literals only
+                        if (In == End) {
+                            break;
+                        }
+
+                        if (End - In < 2) {
+                            return false;
+                        }
+
+                        const uint64_t Offset = In[0] | (static_cast<uint64_t>(In[1]) << 8);
+                        In += 2;
+                        Length = Token & 15;
+
+                        if (Length == 15 && !ReadLength(In, End, Length)) {
+                            return false;
+                        }
+
+                        Length += MinMatch;
+
+                        if (Offset == 0 || Offset > static_cast<uint64_t>(Out - Begin)
+                            || Length > static_cast<uint64_t>(OutEnd - Out)) {
+                            return false;
+                        }
+
+                        // Overlapped match repeats last Offset bytes,
+                        // copied part doubles the distance of the next copy
+                        const uint8_t *Match = Out - Offset;
+
+                        for (uint64_t Done = 0; Done < Length;) {
+                            const uint64_t Chunk = std::min<uint64_t>(Length - Done, Out - Match);
+                            std::memcpy(Out, Match, static_cast<size_t>(Chunk));
+                            Out += Chunk;
+                            Done += Chunk;
+                        }
+                    }
+
+                    return Out == OutEnd;
+                }
+            }
+        }
+    }
+}
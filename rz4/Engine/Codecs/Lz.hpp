@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RZ4_LZ_CODEC_HPP
+#define RZ4_LZ_CODEC_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+namespace rz4 {
+    namespace Engine {
+        namespace Codecs {
+            /*
+             * Built-in generic codec for data between streams.
+             * Greedy LZ77 with 64 KB window and LZ4 block layout of sequences,
+             * fast enough to keep up with disk when blocks are encoded in parallel.
+             */
+            namespace Lz {
+                const char Signature[4] = { 'R', 'Z', 'L', 'Z' };
+
+#pragma pack(push, 1)
+                typedef struct LzBlockHeader {
+                    char Signature[4];
+                    uint64_t OriginalSize;
+                } LzBlockHeader;
+#pragma pack(pop)
+
+                bool Encode(const char *, uint64_t, std::vector<char>&);
+                bool Decode(const char *, uint64_t, std::vector<char>&);
+            }
+        }
+    }
+}
+
+#endif //RZ4_LZ_CODEC_HPP
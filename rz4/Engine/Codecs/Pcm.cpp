@@ -0,0 +1,1066 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Pcm.hpp"
+#include "stdafx.hpp"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace rz4 {
+    namespace Engine {
+        namespace Codecs {
+            namespace Pcm {
+                namespace {
+                    enum { SubframeConstant = 0, SubframeVerbatim, SubframeFixed, SubframeLpc };
+                    enum { StereoIndependent = 0, StereoLeftSide, StereoSideRight, StereoMidSide };
+
+                    const unsigned int MaxLpcOrder = 32;
+                    const unsigned int MaxFixedOrder = 4;
+                    const unsigned int MaxPartitionOrder = 8;
+                    const unsigned int MaxRiceParameter = 30;
+                    const unsigned int LpcPrecision = 15;
+                    const int MaxLpcShift = 20;
+
+                    // Max LPC order for every compression level, level 1 - fixed predictors only
+                    const unsigned int MaxLpcOrderByLevel[MaxLevel + 1] = { 0, 0, 4, 8, 12, 16, 20, 24, 32 };
+
+                    // Estimator looks at so many blocks spread over the stream
+                    const unsigned int EstimateBlocks = 16;
+                    const unsigned int EstimateBlockSamples = 1024;
+
+                    inline uint64_t Mask(unsigned int Count) {
+                        return (static_cast<uint64_t>(1) << Count) - 1;
+                    }
+
+                    inline uint32_t ZigZag(int32_t Value) {
+                        return (static_cast<uint32_t>(Value) << 1) ^ static_cast<uint32_t>(Value >> 31);
+                    }
+
+                    inline int32_t UnZigZag(uint32_t Value) {
+                        return static_cast<int32_t>(Value >> 1) ^ -static_cast<int32_t>(Value & 1);
+                    }
+
+                    inline bool FitsInt32(int64_t Value) {
+                        return Value >= std::numeric_limits<int32_t>::min() && Value <= std::numeric_limits<int32_t>::max();
+                    }
+
+                    inline int32_t ReadSample(const unsigned char *P, unsigned int BytesPerSample) {
+                        switch (BytesPerSample) {
+                        case 1:
+                            return static_cast<int32_t>(P[0]) - 128;
+                        case 2:
+                            return static_cast<int16_t>(P[0] | (P[1] << 8));
+                        default:
+                            return static_cast<int32_t>((static_cast<uint32_t>(P[0]) << 8)
+                                | (static_cast<uint32_t>(P[1]) << 16)
+                                | (static_cast<uint32_t>(P[2]) << 24)) >> 8;
+                        }
+                    }
+
+                    inline void WriteSample(unsigned char *P, int32_t Value, unsigned int BytesPerSample) {
+                        switch (BytesPerSample) {
+                        case 1:
+                            P[0] = static_cast<unsigned char>(Value + 128);
+                            break;
+                        case 2:
+                            P[0] = static_cast<unsigned char>(Value);
+                            P[1] = static_cast<unsigned char>(Value >> 8);
+                            break;
+                        default:
+                            P[0] = static_cast<unsigned char>(Value);
+                            P[1] = static_cast<unsigned char>(Value >> 8);
+                            P[2] = static_cast<unsigned char>(Value >> 16);
+                            break;
+                        }
+                    }
+
+                    class BitWriter {
+                    private:
+                        std::vector<char> &Out;
+                        uint64_t Accumulator;
+                        unsigned int Bits;
+
+                    public:
+                        explicit BitWriter(std::vector<char> &Out) : Out(Out), Accumulator(0), Bits(0) {}
+
+                        // Count <= 32
+                        void Put(uint32_t Value, unsigned int Count) {
+                            if (Count == 0) {
+                                return;
+                            }
+
+                            Accumulator = (Accumulator << Count) | (Value & Mask(Count));
+                            Bits += Count;
+
+                            while (Bits >= 8) {
+                                Bits -= 8;
+                                Out.push_back(static_cast<char>(Accumulator >> Bits));
+                            }
+                        }
+
+                        void PutSigned(int32_t Value, unsigned int Count) {
+                            Put(static_cast<uint32_t>(Value), Count);
+                        }
+
+                        void PutUnary(uint32_t Value) {
+                            while (Value >= 32) {
+                                Put(0, 32);
+                                Value -= 32;
+                            }
+
+                            Put(1, Value + 1);
+                        }
+
+                        void PutRice(uint32_t Value, unsigned int Parameter) {
+                            PutUnary(Value >> Parameter);
+                            Put(Value, Parameter);
+                        }
+
+                        void Flush() {
+                            if (Bits > 0) {
+                                Put(0, 8 - Bits);
+                            }
+                        }
+                    };
+
+                    class BitReader {
+                    private:
+                        const unsigned char *Data;
+                        uint64_t Size;
+                        uint64_t Position;
+                        uint64_t Accumulator;
+                        unsigned int Bits;
+                        bool Overrun;
+
+                        void Refill() {
+                            Accumulator <<= 8;
+
+                            if (Position < Size) {
+                                Accumulator |= Data[Position];
+                            } else {
+                                Overrun = true;
+                            }
+
+                            Position++;
+                            Bits += 8;
+                        }
+
+                    public:
+                        BitReader(const char *Data, uint64_t Size)
+                            : Data(reinterpret_cast<const unsigned char*>(Data)), Size(Size),
+                            Position(0), Accumulator(0), Bits(0), Overrun(false) {}
+
+                        // Count <= 32
+                        uint32_t Get(unsigned int Count) {
+                            while (Bits < Count) {
+                                Refill();
+                            }
+
+                            Bits -= Count;
+                            return static_cast<uint32_t>((Accumulator >> Bits) & Mask(Count));
+                        }
+
+                        int32_t GetSigned(unsigned int Count) {
+                            if (Count == 0) {
+                                return 0;
+                            }
+
+                            uint32_t Value = Get(Count);
+
+                            if (Count < 32 && ((Value >> (Count - 1)) & 1)) {
+                                Value |= ~static_cast<uint32_t>(Mask(Count));
+                            }
+
+                            return static_cast<int32_t>(Value);
+                        }
+
+                        uint32_t GetUnary() {
+                            uint32_t Value = 0;
+
+                            while (true) {
+                                if (Bits == 0) {
+                                    Refill();
+
+                                    if (Overrun) {
+                                        return Value;
+                                    }
+                                }
+
+                                while (Bits > 0) {
+                                    Bits--;
+
+                                    if ((Accumulator >> Bits) & 1) {
+                                        return Value;
+                                    }
+
+                                    Value++;
+                                }
+                            }
+                        }
+
+                        uint32_t GetRice(unsigned int Parameter) {
+                            uint32_t High = GetUnary();
+                            return (High << Parameter) | Get(Parameter);
+                        }
+
+                        void AlignToByte() {
+                            Bits -= Bits % 8;
+                        }
+
+                        bool IsOverrun() const {
+                            return Overrun;
+                        }
+                    };
+
+                    typedef struct SubframePlan {
+                        int Type;
+                        unsigned int Order;
+                        unsigned int Wasted;
+                        unsigned int Bps;
+                        int32_t Coefs[MaxLpcOrder];
+                        int Shift;
+                        unsigned int PartitionOrder;
+                        unsigned int Parameters[1 << MaxPartitionOrder];
+                        uint64_t HeaderBits;
+                        uint64_t Bits;
+                        std::vector<int32_t> Residual;
+                    } SubframePlan;
+
+                    /*
+                     * Fixed polynomial predictors of order 0..4.
+                     * Residual has (Count - Order) values.
+                     */
+                    bool FixedResidual(const int32_t *X, unsigned int Count, unsigned int Order, std::vector<int32_t> &Residual) {
+                        Residual.resize(Count - Order);
+
+                        for (unsigned int i = Order; i < Count; i++) {
+                            int64_t Value;
+
+                            switch (Order) {
+                            case 0:
+                                Value = X[i];
+                                break;
+                            case 1:
+                                Value = static_cast<int64_t>(X[i]) - X[i - 1];
+                                break;
+                            case 2:
+                                Value = static_cast<int64_t>(X[i]) - 2 * static_cast<int64_t>(X[i - 1]) + X[i - 2];
+                                break;
+                            case 3:
+                                Value = static_cast<int64_t>(X[i]) - 3 * static_cast<int64_t>(X[i - 1])
+                                    + 3 * static_cast<int64_t>(X[i - 2]) - X[i - 3];
+                                break;
+                            default:
+                                Value = static_cast<int64_t>(X[i]) - 4 * static_cast<int64_t>(X[i - 1])
+                                    + 6 * static_cast<int64_t>(X[i - 2]) - 4 * static_cast<int64_t>(X[i - 3]) + X[i - 4];
+                                break;
+                            }
+
+                            if (!FitsInt32(Value)) {
+                                return false;
+                            }
+
+                            Residual[i - Order] = static_cast<int32_t>(Value);
+                        }
+
+                        return true;
+                    }
+
+                    int64_t FixedPredict(const int32_t *X, unsigned int i, unsigned int Order) {
+                        switch (Order) {
+                        case 0:
+                            return 0;
+                        case 1:
+                            return X[i - 1];
+                        case 2:
+                            return 2 * static_cast<int64_t>(X[i - 1]) - X[i - 2];
+                        case 3:
+                            return 3 * static_cast<int64_t>(X[i - 1]) - 3 * static_cast<int64_t>(X[i - 2]) + X[i - 3];
+                        default:
+                            return 4 * static_cast<int64_t>(X[i - 1]) - 6 * static_cast<int64_t>(X[i - 2])
+                                + 4 * static_cast<int64_t>(X[i - 3]) - X[i - 4];
+                        }
+                    }
+
+                    bool LpcResidual(const int32_t *X, unsigned int Count, const int32_t *Coefs, unsigned int Order,
+                        int Shift, std::vector<int32_t> &Residual) {
+                        Residual.resize(Count - Order);
+
+                        for (unsigned int i = Order; i < Count; i++) {
+                            int64_t Sum = 0;
+
+                            for (unsigned int j = 0; j < Order; j++) {
+                                Sum += static_cast<int64_t>(Coefs[j]) * X[i - 1 - j];
+                            }
+
+                            int64_t Value = X[i] - (Sum >> Shift);
+
+                            if (!FitsInt32(Value)) {
+                                return false;
+                            }
+
+                            Residual[i - Order] = static_cast<int32_t>(Value);
+                        }
+
+                        return true;
+                    }
+
+                    unsigned int RiceParameter(uint64_t Count, uint64_t Sum) {
+                        unsigned int Parameter = 0;
+
+                        while (Parameter < MaxRiceParameter && (Count << (Parameter + 1)) <= Sum) {
+                            Parameter++;
+                        }
+
+                        return Parameter;
+                    }
+
+                    /*
+                     * Choose partition order and Rice parameters for residual.
+                     * First partition is shorter by `Order` warm-up samples.
+                     * Return estimated size of coded residual in bits.
+                     */
+                    uint64_t PlanResidual(const std::vector<int32_t> &Residual, unsigned int Count, unsigned int Order,
+                        unsigned int &PartitionOrder, unsigned int *Parameters) {
+                        std::vector<uint64_t> Prefix(Residual.size() + 1, 0);
+                        uint64_t BestBits = std::numeric_limits<uint64_t>::max();
+
+                        for (size_t i = 0; i < Residual.size(); i++) {
+                            Prefix[i + 1] = Prefix[i] + ZigZag(Residual[i]);
+                        }
+
+                        for (unsigned int Partition = 0; Partition <= MaxPartitionOrder; Partition++) {
+                            const unsigned int CountOfPartitions = 1u << Partition;
+                            const unsigned int PartitionSize = Count >> Partition;
+
+                            if (Count % CountOfPartitions != 0 || PartitionSize <= Order) {
+                                break;
+                            }
+
+                            unsigned int Current[1 << MaxPartitionOrder];
+                            uint64_t Bits = 4;
+
+                            for (unsigned int j = 0; j < CountOfPartitions; j++) {
+                                unsigned int Start = j == 0 ? Order : j * PartitionSize;
+                                unsigned int End = (j + 1) * PartitionSize;
+                                uint64_t Samples = End - Start;
+                                uint64_t Sum = Prefix[End - Order] - Prefix[Start - Order];
+
+                                Current[j] = RiceParameter(Samples, Sum);
+                                Bits += 5 + Samples * (Current[j] + 1) + (Sum >> Current[j]);
+                            }
+
+                            if (Bits < BestBits) {
+                                BestBits = Bits;
+                                PartitionOrder = Partition;
+                                std::memcpy(Parameters, Current, CountOfPartitions * sizeof(unsigned int));
+                            }
+                        }
+
+                        return BestBits;
+                    }
+
+                    uint64_t ExactResidualBits(const std::vector<int32_t> &Residual, unsigned int Count, unsigned int Order,
+                        unsigned int PartitionOrder, const unsigned int *Parameters) {
+                        const unsigned int PartitionSize = Count >> PartitionOrder;
+                        uint64_t Bits = 4;
+
+                        for (unsigned int j = 0; j < (1u << PartitionOrder); j++) {
+                            unsigned int Start = j == 0 ? Order : j * PartitionSize;
+                            unsigned int End = (j + 1) * PartitionSize;
+                            Bits += 5;
+
+                            for (unsigned int i = Start; i < End; i++) {
+                                Bits += (ZigZag(Residual[i - Order]) >> Parameters[j]) + 1 + Parameters[j];
+                            }
+                        }
+
+                        return Bits;
+                    }
+
+                    /*
+                     * Levinson-Durbin recursion over autocorrelation.
+                     * Lpc[i] - coefficients for order i + 1.
+                     * Return max order which has valid coefficients.
+                     */
+                    unsigned int ComputeLpc(const double *Autocorrelation, unsigned int MaxOrder, double (*Lpc)[MaxLpcOrder]) {
+                        double Error = Autocorrelation[0];
+                        double Temp[MaxLpcOrder] = { 0 };
+
+                        for (unsigned int i = 0; i < MaxOrder; i++) {
+                            double Reflection = -Autocorrelation[i + 1];
+                            unsigned int j;
+
+                            for (j = 0; j < i; j++) {
+                                Reflection -= Temp[j] * Autocorrelation[i - j];
+                            }
+
+                            Reflection /= Error;
+                            Temp[i] = Reflection;
+
+                            for (j = 0; j < i / 2; j++) {
+                                double Value = Temp[j];
+                                Temp[j] += Reflection * Temp[i - 1 - j];
+                                Temp[i - 1 - j] += Reflection * Value;
+                            }
+
+                            if (i % 2) {
+                                Temp[j] += Temp[j] * Reflection;
+                            }
+
+                            Error *= 1.0 - Reflection * Reflection;
+
+                            for (j = 0; j <= i; j++) {
+                                Lpc[i][j] = -Temp[j];
+                            }
+
+                            if (!(Error > 0) || !std::isfinite(Error)) {
+                                return i + 1;
+                            }
+                        }
+
+                        return MaxOrder;
+                    }
+
+                    bool QuantizeLpc(const double *Lpc, unsigned int Order, int32_t *Coefs, int &Shift) {
+                        const int32_t MaxCoef = (1 << (LpcPrecision - 1)) - 1;
+                        double MaxValue = 0;
+                        int Exponent;
+
+                        for (unsigned int i = 0; i < Order; i++) {
+                            if (!std::isfinite(Lpc[i])) {
+                                return false;
+                            }
+
+                            MaxValue = std::max(MaxValue, std::fabs(Lpc[i]));
+                        }
+
+                        if (MaxValue <= 0) {
+                            return false;
+                        }
+
+                        std::frexp(MaxValue, &Exponent);
+                        Shift = std::min(static_cast<int>(LpcPrecision) - 1 - Exponent, MaxLpcShift);
+
+                        if (Shift < 0) {
+                            return false;
+                        }
+
+                        // Carry rounding error to the next coefficient
+                        double Error = 0;
+                        for (unsigned int i = 0; i < Order; i++) {
+                            Error += Lpc[i] * (1 << Shift);
+                            long Value = std::lround(Error);
+                            Value = std::max<long>(-MaxCoef - 1, std::min<long>(MaxCoef, Value));
+                            Coefs[i] = static_cast<int32_t>(Value);
+                            Error -= Value;
+                        }
+
+                        return true;
+                    }
+
+                    void TryCandidate(SubframePlan &Best, SubframePlan &Candidate, unsigned int Count, uint64_t HeaderBits) {
+                        Candidate.HeaderBits = HeaderBits;
+                        Candidate.Bits = HeaderBits + PlanResidual(Candidate.Residual, Count, Candidate.Order,
+                            Candidate.PartitionOrder, Candidate.Parameters);
+
+                        if (Candidate.Bits < Best.Bits) {
+                            std::swap(Best, Candidate);
+                        }
+                    }
+
+                    /*
+                     * Choose coding of one channel of the frame.
+                     * `X` may be modified (wasted bits are shifted out).
+                     */
+                    void PlanSubframe(std::vector<int32_t> &X, unsigned int Count, unsigned int Bps, unsigned int MaxOrder,
+                        SubframePlan &Best, SubframePlan &Candidate) {
+                        Best.Order = 0;
+                        Best.Wasted = 0;
+                        Best.Bps = Bps;
+                        Best.Shift = 0;
+                        Best.PartitionOrder = 0;
+
+                        bool Constant = true;
+                        uint32_t Bits = 0;
+                        for (unsigned int i = 0; i < Count; i++) {
+                            Constant = Constant && X[i] == X[0];
+                            Bits |= static_cast<uint32_t>(X[i]);
+                        }
+
+                        if (Constant) {
+                            Best.Type = SubframeConstant;
+                            Best.Bits = 7 + Bps;
+                            return;
+                        }
+
+                        // Low bits which are zero in all samples
+                        while (!(Bits & 1) && Best.Wasted + 1 < Bps) {
+                            Bits >>= 1;
+                            Best.Wasted++;
+                        }
+
+                        if (Best.Wasted > 0) {
+                            for (unsigned int i = 0; i < Count; i++) {
+                                X[i] >>= Best.Wasted;
+                            }
+
+                            Best.Bps -= Best.Wasted;
+                        }
+
+                        Bps = Best.Bps;
+                        const uint64_t VerbatimBits = 7 + static_cast<uint64_t>(Count) * Bps;
+                        Best.Type = SubframeVerbatim;
+                        Best.Bits = VerbatimBits;
+
+                        for (unsigned int Order = 0; Order <= MaxFixedOrder && Order < Count; Order++) {
+                            Candidate.Type = SubframeFixed;
+                            Candidate.Order = Order;
+                            Candidate.Wasted = Best.Wasted;
+                            Candidate.Bps = Bps;
+
+                            if (FixedResidual(X.data(), Count, Order, Candidate.Residual)) {
+                                TryCandidate(Best, Candidate, Count, 7 + 3 + Order * Bps);
+                            }
+                        }
+
+                        MaxOrder = std::min(MaxOrder, Count > 1 ? Count - 1 : 0);
+
+                        if (MaxOrder > 0) {
+                            // Autocorrelation of Welch-windowed signal
+                            std::vector<double> Windowed(Count);
+                            double Autocorrelation[MaxLpcOrder + 1];
+                            double Lpc[MaxLpcOrder][MaxLpcOrder];
+                            const double Half = (Count - 1) / 2.0;
+                            const double Denominator = (Count + 1) / 2.0;
+
+                            for (unsigned int i = 0; i < Count; i++) {
+                                double Position = (i - Half) / Denominator;
+                                Windowed[i] = X[i] * (1.0 - Position * Position);
+                            }
+
+                            for (unsigned int Lag = 0; Lag <= MaxOrder; Lag++) {
+                                double Sum = 0;
+
+                                for (unsigned int i = Lag; i < Count; i++) {
+                                    Sum += Windowed[i] * Windowed[i - Lag];
+                                }
+
+                                Autocorrelation[Lag] = Sum;
+                            }
+
+                            if (Autocorrelation[0] > 0) {
+                                unsigned int ValidOrder = ComputeLpc(Autocorrelation, MaxOrder, Lpc);
+
+                                for (unsigned int Order = 1; Order <= ValidOrder; Order++) {
+                                    // All low orders, then every 4th
+                                    if (Order > 8 && Order % 4 != 0 && Order != ValidOrder) {
+                                        continue;
+                                    }
+
+                                    Candidate.Type = SubframeLpc;
+                                    Candidate.Order = Order;
+                                    Candidate.Wasted = Best.Wasted;
+                                    Candidate.Bps = Bps;
+
+                                    if (QuantizeLpc(Lpc[Order - 1], Order, Candidate.Coefs, Candidate.Shift)
+                                        && LpcResidual(X.data(), Count, Candidate.Coefs, Order, Candidate.Shift, Candidate.Residual)) {
+                                        TryCandidate(Best, Candidate, Count, 7 + 5 + 4 + 5 + Order * (LpcPrecision + Bps));
+                                    }
+                                }
+                            }
+                        }
+
+                        // Estimation can be optimistic, check real size
+                        if (Best.Type != SubframeVerbatim) {
+                            Best.Bits = Best.HeaderBits + ExactResidualBits(Best.Residual, Count, Best.Order,
+                                Best.PartitionOrder, Best.Parameters);
+
+                            if (Best.Bits >= VerbatimBits) {
+                                Best.Type = SubframeVerbatim;
+                                Best.Bits = VerbatimBits;
+                            }
+                        }
+                    }
+
+                    void WriteSubframe(BitWriter &Writer, const std::vector<int32_t> &X, unsigned int Count, const SubframePlan &Plan) {
+                        Writer.Put(static_cast<uint32_t>(Plan.Type), 2);
+                        Writer.Put(Plan.Wasted, 5);
+
+                        switch (Plan.Type) {
+                        case SubframeConstant:
+                            Writer.PutSigned(X[0], Plan.Bps);
+                            return;
+                        case SubframeVerbatim:
+                            for (unsigned int i = 0; i < Count; i++) {
+                                Writer.PutSigned(X[i], Plan.Bps);
+                            }
+                            return;
+                        case SubframeFixed:
+                            Writer.Put(Plan.Order, 3);
+                            break;
+                        default:
+                            Writer.Put(Plan.Order - 1, 5);
+                            Writer.Put(LpcPrecision - 1, 4);
+                            Writer.Put(static_cast<uint32_t>(Plan.Shift), 5);
+
+                            for (unsigned int i = 0; i < Plan.Order; i++) {
+                                Writer.PutSigned(Plan.Coefs[i], LpcPrecision);
+                            }
+                            break;
+                        }
+
+                        for (unsigned int i = 0; i < Plan.Order; i++) {
+                            Writer.PutSigned(X[i], Plan.Bps);
+                        }
+
+                        const unsigned int PartitionSize = Count >> Plan.PartitionOrder;
+                        Writer.Put(Plan.PartitionOrder, 4);
+
+                        for (unsigned int j = 0; j < (1u << Plan.PartitionOrder); j++) {
+                            unsigned int Start = j == 0 ? Plan.Order : j * PartitionSize;
+                            unsigned int End = (j + 1) * PartitionSize;
+                            Writer.Put(Plan.Parameters[j], 5);
+
+                            for (unsigned int i = Start; i < End; i++) {
+                                Writer.PutRice(ZigZag(Plan.Residual[i - Plan.Order]), Plan.Parameters[j]);
+                            }
+                        }
+                    }
+
+                    bool ReadSubframe(BitReader &Reader, std::vector<int32_t> &X, unsigned int Count, unsigned int Bps) {
+                        int Type = static_cast<int>(Reader.Get(2));
+                        unsigned int Wasted = Reader.Get(5);
+
+                        if (Wasted >= Bps) {
+                            return false;
+                        }
+
+                        Bps -= Wasted;
+
+                        switch (Type) {
+                        case SubframeConstant:
+                            std::fill(X.begin(), X.begin() + Count, Reader.GetSigned(Bps));
+                            return !Reader.IsOverrun();
+                        case SubframeVerbatim:
+                            for (unsigned int i = 0; i < Count; i++) {
+                                X[i] = Reader.GetSigned(Bps);
+                            }
+                            break;
+                        default:
+                            unsigned int Order;
+                            unsigned int Precision = 0;
+                            int Shift = 0;
+                            int32_t Coefs[MaxLpcOrder];
+
+                            if (Type == SubframeFixed) {
+                                Order = Reader.Get(3);
+
+                                if (Order > MaxFixedOrder) {
+                                    return false;
+                                }
+                            } else {
+                                Order = Reader.Get(5) + 1;
+                                Precision = Reader.Get(4) + 1;
+                                Shift = static_cast<int>(Reader.Get(5));
+
+                                for (unsigned int i = 0; i < Order; i++) {
+                                    Coefs[i] = Reader.GetSigned(Precision);
+                                }
+                            }
+
+                            if (Order >= Count) {
+                                return false;
+                            }
+
+                            for (unsigned int i = 0; i < Order; i++) {
+                                X[i] = Reader.GetSigned(Bps);
+                            }
+
+                            unsigned int PartitionOrder = Reader.Get(4);
+                            if (PartitionOrder > MaxPartitionOrder || (Count >> PartitionOrder) <= Order
+                                || Count % (1u << PartitionOrder) != 0) {
+                                return false;
+                            }
+
+                            const unsigned int PartitionSize = Count >> PartitionOrder;
+
+                            for (unsigned int j = 0; j < (1u << PartitionOrder); j++) {
+                                unsigned int Start = j == 0 ? Order : j * PartitionSize;
+                                unsigned int End = (j + 1) * PartitionSize;
+                                unsigned int Parameter = Reader.Get(5);
+
+                                for (unsigned int i = Start; i < End; i++) {
+                                    int64_t Value = UnZigZag(Reader.GetRice(Parameter));
+
+                                    if (Type == SubframeFixed) {
+                                        Value += FixedPredict(X.data(), i, Order);
+                                    } else {
+                                        int64_t Sum = 0;
+
+                                        for (unsigned int k = 0; k < Order; k++) {
+                                            Sum += static_cast<int64_t>(Coefs[k]) * X[i - 1 - k];
+                                        }
+
+                                        Value += Sum >> Shift;
+                                    }
+
+                                    if (!FitsInt32(Value)) {
+                                        return false;
+                                    }
+
+                                    X[i] = static_cast<int32_t>(Value);
+                                }
+
+                                if (Reader.IsOverrun()) {
+                                    return false;
+                                }
+                            }
+                            break;
+                        }
+
+                        if (Wasted > 0) {
+                            for (unsigned int i = 0; i < Count; i++) {
+                                X[i] = static_cast<int32_t>(static_cast<uint32_t>(X[i]) << Wasted);
+                            }
+                        }
+
+                        return !Reader.IsOverrun();
+                    }
+
+                    /*
+                     * Rough cost of channel for stereo mode choice:
+                     * sum of 2nd order fixed residuals.
+                     */
+                    uint64_t EstimateChannel(const std::vector<int32_t> &X, unsigned int Count) {
+                        uint64_t Sum = 0;
+
+                        for (unsigned int i = 2; i < Count; i++) {
+                            int64_t Value = static_cast<int64_t>(X[i]) - 2 * static_cast<int64_t>(X[i - 1]) + X[i - 2];
+                            Sum += static_cast<uint64_t>(Value < 0 ? -Value : Value);
+                        }
+
+                        return Sum;
+                    }
+
+                    /*
+                     * Bits of Rice coded residuals of the best fixed predictor
+                     * (order 0..2), with the best parameter for the whole block.
+                     */
+                    uint64_t EstimateRiceBits(const std::vector<int64_t> &X) {
+                        uint64_t Best = std::numeric_limits<uint64_t>::max();
+                        std::vector<uint64_t> Residuals(X.size());
+
+                        for (unsigned int Order = 0; Order <= 2; Order++) {
+                            uint64_t Sum = 0;
+
+                            for (size_t i = Order; i < X.size(); i++) {
+                                const int64_t Value = Order == 0 ? X[i]
+                                    : Order == 1 ? X[i] - X[i - 1]
+                                    : X[i] - 2 * X[i - 1] + X[i - 2];
+                                Residuals[i] = (static_cast<uint64_t>(Value) << 1) ^ static_cast<uint64_t>(Value >> 63);
+                                Sum += Residuals[i];
+                            }
+
+                            const size_t Count = X.size() - Order;
+                            unsigned int Parameter = 0;
+
+                            while (Parameter < MaxRiceParameter && (static_cast<uint64_t>(Count) << (Parameter + 1)) < Sum) {
+                                Parameter++;
+                            }
+
+                            // Parameter by mean is off by one at most
+                            for (unsigned int k = Parameter > 0 ? Parameter - 1 : 0; k <= std::min(Parameter + 1, MaxRiceParameter); k++) {
+                                uint64_t Bits = static_cast<uint64_t>(Count) * (k + 1);
+
+                                for (size_t i = Order; i < X.size(); i++) {
+                                    Bits += Residuals[i] >> k;
+                                }
+
+                                Best = std::min(Best, Bits);
+                            }
+                        }
+
+                        return Best;
+                    }
+                }
+
+                bool IsSupportedFormat(const PcmFormat &Format) {
+                    const unsigned int BytesPerSample = (Format.BitsPerSample + 7) / 8;
+
+                    return Format.Channels > 0
+                        && Format.Channels <= MaxChannels
+                        && Format.BitsPerSample > 0
+                        && BytesPerSample <= 3
+                        && Format.BlockAlign == Format.Channels * BytesPerSample;
+                }
+
+                /*
+                 * Predict coded bits per sample without encoding: residuals of sampled blocks
+                 * are Rice coded by fixed predictors only, so the codec (LPC, partitions)
+                 * usually does a bit better. Returns -1 if format is not supported.
+                 */
+                double EstimateBitsPerSample(const char *Data, uint64_t DataSize, const PcmFormat &Format) {
+                    if (!IsSupportedFormat(Format) || DataSize < Format.BlockAlign) {
+                        return -1;
+                    }
+
+                    const unsigned int Channels = Format.Channels;
+                    const unsigned int BytesPerSample = Format.BlockAlign / Channels;
+                    const uint64_t CountOfSamples = DataSize / Format.BlockAlign;
+                    const uint64_t BlockSamples = std::min<uint64_t>(EstimateBlockSamples, CountOfSamples);
+                    const uint64_t CountOfBlocks = std::min<uint64_t>(EstimateBlocks, CountOfSamples / BlockSamples);
+                    const unsigned char *Samples = reinterpret_cast<const unsigned char*>(Data);
+                    std::vector<std::vector<int64_t>> X(Channels + 1, std::vector<int64_t>(static_cast<size_t>(BlockSamples)));
+                    uint64_t Bits = 0;
+
+                    for (uint64_t Block = 0; Block < CountOfBlocks; Block++) {
+                        const uint64_t First = CountOfBlocks > 1
+                            ? (CountOfSamples - BlockSamples) * Block / (CountOfBlocks - 1) : 0;
+
+                        for (uint64_t i = 0; i < BlockSamples; i++) {
+                            const unsigned char *Frame = Samples + (First + i) * Format.BlockAlign;
+
+                            for (unsigned int Channel = 0; Channel < Channels; Channel++) {
+                                X[Channel][i] = ReadSample(Frame + Channel * BytesPerSample, BytesPerSample);
+                            }
+                        }
+
+                        if (Channels == 2) {
+                            // Best of independent, left / side and side / right
+                            for (uint64_t i = 0; i < BlockSamples; i++) {
+                                X[2][i] = X[0][i] - X[1][i];
+                            }
+
+                            const uint64_t Left = EstimateRiceBits(X[0]);
+                            const uint64_t Right = EstimateRiceBits(X[1]);
+                            const uint64_t Side = EstimateRiceBits(X[2]);
+                            Bits += std::min(Left + Right, std::min(Left, Right) + Side);
+                        } else {
+                            for (unsigned int Channel = 0; Channel < Channels; Channel++) {
+                                Bits += EstimateRiceBits(X[Channel]);
+                            }
+                        }
+                    }
+
+                    return static_cast<double>(Bits) / (CountOfBlocks * BlockSamples * Channels);
+                }
+
+                /*
+                 * Encode stream with PCM data at [DataOffset, DataOffset + DataSize).
+                 * Return false if format is not supported or stream doesn't compress.
+                 */
+                bool Encode(
+                    const char *Stream,
+                    uint64_t StreamSize,
+                    uint64_t DataOffset,
+                    uint64_t DataSize,
+                    const PcmFormat &Format,
+                    unsigned short Level,
+                    std::vector<char> &Out) {
+                    if (Level == 0 || !IsSupportedFormat(Format) || DataOffset + DataSize > StreamSize) {
+                        return false;
+                    }
+
+                    const unsigned int Channels = Format.Channels;
+                    const unsigned int BytesPerSample = Format.BlockAlign / Channels;
+                    const unsigned int MaxOrder = MaxLpcOrderByLevel[std::min(Level, MaxLevel)];
+                    const uint64_t CodedSize = DataSize - DataSize % Format.BlockAlign;
+                    const uint64_t CountOfSamples = CodedSize / Format.BlockAlign;
+
+                    if (CountOfSamples == 0) {
+                        return false;
+                    }
+
+                    PcmStreamHeader Header;
+                    std::memcpy(Header.Signature, Signature, sizeof(Signature));
+                    Header.OriginalSize = StreamSize;
+                    Header.PrefixSize = DataOffset;
+                    Header.DataSize = CodedSize;
+                    Header.Channels = static_cast<uint16_t>(Channels);
+                    Header.BytesPerSample = static_cast<uint16_t>(BytesPerSample);
+                    Header.FrameSamples = FrameSamples;
+
+                    Out.clear();
+                    Out.reserve(static_cast<size_t>(StreamSize / 2));
+                    Out.insert(Out.end(), reinterpret_cast<const char*>(&Header), reinterpret_cast<const char*>(&Header) + sizeof(Header));
+                    Out.insert(Out.end(), Stream, Stream + DataOffset);
+                    Out.insert(Out.end(), Stream + DataOffset + CodedSize, Stream + StreamSize);
+
+                    BitWriter Writer(Out);
+                    std::vector<std::vector<int32_t>> Samples(Channels + 2, std::vector<int32_t>(FrameSamples));
+                    SubframePlan Plans[2], Candidate;
+                    const unsigned char *Data = reinterpret_cast<const unsigned char*>(Stream + DataOffset);
+                    const unsigned int Bps = BytesPerSample * 8;
+
+                    for (uint64_t First = 0; First < CountOfSamples; First += FrameSamples) {
+                        const unsigned int Count = static_cast<unsigned int>(std::min<uint64_t>(FrameSamples, CountOfSamples - First));
+
+                        for (unsigned int i = 0; i < Count; i++) {
+                            const unsigned char *Frame = Data + (First + i) * Format.BlockAlign;
+
+                            for (unsigned int Channel = 0; Channel < Channels; Channel++) {
+                                Samples[Channel][i] = ReadSample(Frame + Channel * BytesPerSample, BytesPerSample);
+                            }
+                        }
+
+                        if (Channels != 2) {
+                            for (unsigned int Channel = 0; Channel < Channels; Channel++) {
+                                PlanSubframe(Samples[Channel], Count, Bps, MaxOrder, Plans[0], Candidate);
+                                WriteSubframe(Writer, Samples[Channel], Count, Plans[0]);
+                            }
+                        } else {
+                            // Mid and side into spare channels
+                            std::vector<int32_t> &Mid = Samples[2], &Side = Samples[3];
+
+                            for (unsigned int i = 0; i < Count; i++) {
+                                Mid[i] = static_cast<int32_t>((static_cast<int64_t>(Samples[0][i]) + Samples[1][i]) >> 1);
+                                Side[i] = Samples[0][i] - Samples[1][i];
+                            }
+
+                            const uint64_t Left = EstimateChannel(Samples[0], Count);
+                            const uint64_t Right = EstimateChannel(Samples[1], Count);
+                            const uint64_t MidCost = EstimateChannel(Mid, Count);
+                            const uint64_t SideCost = EstimateChannel(Side, Count);
+                            const uint64_t Costs[4] = { Left + Right, Left + SideCost, SideCost + Right, MidCost + SideCost };
+                            const unsigned int Mode = static_cast<unsigned int>(std::min_element(Costs, Costs + 4) - Costs);
+                            const unsigned int Pair[4][2] = { { 0, 1 }, { 0, 3 }, { 3, 1 }, { 2, 3 } };
+
+                            Writer.Put(Mode, 2);
+
+                            for (unsigned int k = 0; k < 2; k++) {
+                                unsigned int Channel = Pair[Mode][k];
+                                PlanSubframe(Samples[Channel], Count, Channel == 3 ? Bps + 1 : Bps, MaxOrder, Plans[k], Candidate);
+                                WriteSubframe(Writer, Samples[Channel], Count, Plans[k]);
+                            }
+                        }
+
+                        Writer.Flush();
+
+                        if (Out.size() >= StreamSize) {
+                            return false;
+                        }
+                    }
+
+                    return true;
+                }
+
+                /*
+                 * Restore original stream from encoded one.
+                 */
+                bool Decode(const char *Payload, uint64_t PayloadSize, std::vector<char> &Out) {
+                    PcmStreamHeader Header;
+
+                    if (PayloadSize < sizeof(Header)) {
+                        return false;
+                    }
+
+                    std::memcpy(&Header, Payload, sizeof(Header));
+
+                    if (std::memcmp(Header.Signature, Signature, sizeof(Signature)) != 0
+                        || Header.Channels == 0 || Header.Channels > MaxChannels
+                        || Header.BytesPerSample == 0 || Header.BytesPerSample > 3
+                        || Header.FrameSamples == 0 || Header.FrameSamples > (1u << 20)
+                        || Header.PrefixSize > Header.OriginalSize
+                        || Header.DataSize > Header.OriginalSize - Header.PrefixSize
+                        || Header.DataSize % (Header.Channels * Header.BytesPerSample) != 0) {
+                        return false;
+                    }
+
+                    const uint64_t SuffixSize = Header.OriginalSize - Header.PrefixSize - Header.DataSize;
+                    const uint64_t FramesOffset = sizeof(Header) + Header.PrefixSize + SuffixSize;
+
+                    if (FramesOffset > PayloadSize) {
+                        return false;
+                    }
+
+                    Out.resize(static_cast<size_t>(Header.OriginalSize));
+                    const char *Raw = Payload + sizeof(Header);
+                    std::memcpy(Out.data(), Raw, static_cast<size_t>(Header.PrefixSize));
+                    std::memcpy(Out.data() + Header.PrefixSize + Header.DataSize, Raw + Header.PrefixSize, static_cast<size_t>(SuffixSize));
+
+                    const unsigned int Channels = Header.Channels;
+                    const unsigned int BytesPerSample = Header.BytesPerSample;
+                    const unsigned int BlockAlign = Channels * BytesPerSample;
+                    const unsigned int Bps = BytesPerSample * 8;
+                    const uint64_t CountOfSamples = Header.DataSize / BlockAlign;
+
+                    BitReader Reader(Payload + FramesOffset, PayloadSize - FramesOffset);
+                    std::vector<std::vector<int32_t>> Samples(Channels, std::vector<int32_t>(Header.FrameSamples));
+                    unsigned char *Data = reinterpret_cast<unsigned char*>(Out.data() + Header.PrefixSize);
+
+                    for (uint64_t First = 0; First < CountOfSamples; First += Header.FrameSamples) {
+                        const unsigned int Count = static_cast<unsigned int>(std::min<uint64_t>(Header.FrameSamples, CountOfSamples - First));
+
+                        if (Channels != 2) {
+                            for (unsigned int Channel = 0; Channel < Channels; Channel++) {
+                                if (!ReadSubframe(Reader, Samples[Channel], Count, Bps)) {
+                                    return false;
+                                }
+                            }
+                        } else {
+                            unsigned int Mode = Reader.Get(2);
+                            std::vector<int32_t> &A = Samples[0], &B = Samples[1];
+
+                            // Side channel needs one more bit
+                            if (!ReadSubframe(Reader, A, Count, Mode == StereoSideRight ? Bps + 1 : Bps)
+                                || !ReadSubframe(Reader, B, Count, Mode == StereoLeftSide || Mode == StereoMidSide ? Bps + 1 : Bps)) {
+                                return false;
+                            }
+
+                            for (unsigned int i = 0; i < Count; i++) {
+                                switch (Mode) {
+                                case StereoLeftSide:
+                                    B[i] = static_cast<int32_t>(static_cast<int64_t>(A[i]) - B[i]);
+                                    break;
+                                case StereoSideRight:
+                                    A[i] = static_cast<int32_t>(static_cast<int64_t>(A[i]) + B[i]);
+                                    break;
+                                case StereoMidSide: {
+                                    int64_t Mid = static_cast<int64_t>(A[i]) * 2 | (B[i] & 1);
+                                    int64_t Side = B[i];
+                                    A[i] = static_cast<int32_t>((Mid + Side) >> 1);
+                                    B[i] = static_cast<int32_t>((Mid - Side) >> 1);
+                                    break;
+                                }
+                                default:
+                                    break;
+                                }
+                            }
+                        }
+
+                        Reader.AlignToByte();
+
+                        for (unsigned int i = 0; i < Count; i++) {
+                            unsigned char *Frame = Data + (First + i) * BlockAlign;
+
+                            for (unsigned int Channel = 0; Channel < Channels; Channel++) {
+                                WriteSample(Frame + Channel * BytesPerSample, Samples[Channel][i], BytesPerSample);
+                            }
+                        }
+                    }
+
+                    return !Reader.IsOverrun();
+                }
+            }
+        }
+    }
+}
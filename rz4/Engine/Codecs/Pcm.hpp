@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RZ4_PCM_CODEC_HPP
+#define RZ4_PCM_CODEC_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+namespace rz4 {
+    namespace Engine {
+        namespace Codecs {
+            /*
+             * Built-in lossless codec for integer PCM (8/16/24 bit, up to 8 channels).
+             * Every frame of samples is coded with stereo decorrelation,
+             * fixed or LPC prediction and partitioned Rice coding of residuals.
+             * Bytes of stream around PCM data (headers, other chunks) are kept as is.
+             */
+            namespace Pcm {
+                const char Signature[4] = { 'R', 'Z', 'P', 'C' };
+                const uint32_t FrameSamples = 4096;
+                const unsigned short MaxLevel = 8;
+                const unsigned short MaxChannels = 8;
+
+                typedef struct PcmFormat {
+                    unsigned short Channels;
+                    unsigned short BitsPerSample;
+                    unsigned short BlockAlign;
+                } PcmFormat;
+
+#pragma pack(push, 1)
+                // Encoded stream: header, prefix bytes, suffix bytes, frames
+                typedef struct PcmStreamHeader {
+                    char Signature[4];
+                    uint64_t OriginalSize;
+                    uint64_t PrefixSize;
+                    uint64_t DataSize;
+                    uint16_t Channels;
+                    uint16_t BytesPerSample;
+                    uint32_t FrameSamples;
+                } PcmStreamHeader;
+#pragma pack(pop)
+
+                bool IsSupportedFormat(const PcmFormat&);
+                double EstimateBitsPerSample(const char *, uint64_t, const PcmFormat&);
+                bool Encode(const char *, uint64_t, uint64_t, uint64_t, const PcmFormat&, unsigned short, std::vector<char>&);
+                bool Decode(const char *, uint64_t, std::vector<char>&);
+            }
+        }
+    }
+}
+
+#endif //RZ4_PCM_CODEC_HPP
@@ -22,216 +22,1042 @@
 
 namespace rz4 {
     namespace Engine {
-        Compressor::Compressor(Types::CompressorOptions Options) : Options(Options) {
-            FileSize = fs::file_size(Options.FileName);
-            File.open(Options.FileName.string(), std::fstream::binary);
-            OutFile.open(Options.OutFile.string(), std::fstream::trunc | std::fstream::binary);
+        namespace {
+            // Part of stdin stream which doesn't fit into window
+            // is read by pieces of this size
+            const size_t InputChunkSize = 16 * 1024 * 1024;
+
+            // Predicted bits per sample of (almost) silence
+            const double NearSilentBits = 2.0;
+
+            // Data between streams is encoded by independent blocks,
+            // smaller gaps aren't worth an index entry
+            const uintmax_t GapBlockSize = 1024 * 1024;
+            const uintmax_t MinGapSize = 4096;
+
+            // Streams which end closer to the end of previous input
+            // could be cut by it, they are found and encoded again
+            const uintmax_t BoundaryOverlap = 64 * 1024;
+        }
+
+        Compressor::Compressor(Types::CompressorOptions Options) : Options(Options), Out(nullptr) {
+            Streaming = Utils::IsStdStream(Options.FileName);
+            FileSize = 0;
+
+            if (!Streaming) {
+                FileSize = fs::file_size(Options.FileName);
+                File.open(Options.FileName.string(), std::fstream::binary);
+            } else if (Options.EnableRiffWave) {
+                // Input can be read only once, so streams are found by compressor
+                Engine::Formats::RiffWave::RegisterSignatures(Signatures);
+            }
+
+            // Output may be a pipe (stdout), so it's never seeked
+            if (Options.OutBuffer != nullptr) {
+                Out.rdbuf(Options.OutBuffer);
+            } else {
+                OutFile.open(Options.OutFile.string(), std::fstream::trunc | std::fstream::binary);
+                Out.rdbuf(OutFile.rdbuf());
+            }
 
             BufferSize = Options.BufferSize;
+            Jobs = Options.Jobs;
+            NextJob = WrittenJobs = 0;
+            InputDone = false;
+            Position = 0;
+            Failed = false;
+            OriginalCRC32 = 0;
+            CountOfStreams = 0;
+            SizeOfStreams = 0;
+            EncodeTime = WriteTime = WaitTime = std::chrono::duration<double>::zero();
 
-            if (FileSize < BufferSize) {
+            if (!Streaming && FileSize < BufferSize) {
                 BufferSize = static_cast<unsigned int>(FileSize);
             }
+
+            if (Options.Pool != nullptr) {
+                Jobs = Options.Pool->GetSize();
+            } else if (Jobs == 0) {
+                Jobs = std::max(1u, std::thread::hardware_concurrency());
+            }
         }
 
         Compressor::~Compressor() {
             Close();
         }
 
-        void Compressor::Start() {
-            if (!File.is_open() || !OutFile.is_open()) {
-                // TODO: Handle errors
-                return;
+        bool Compressor::Start(Types::ScannerCallbackHandle &Callback) {
+            if (!Streaming && !File.is_open()) {
+                SetError("Can't open input file!");
+                return false;
             }
 
-            // For calculating CRC32
-            uint32_t TableCRC32[256];
-            Utils::GenerateTableCRC32(TableCRC32);
+            if (Options.OutBuffer == nullptr && !OutFile.is_open()) {
+                SetError("Can't create output file!");
+                return false;
+            }
 
+            // Archive is written forward only: CRC32 and list of streams
+            // (and size of original for stdin) aren't known yet,
+            // they go to index and footer at the end
             Types::RzfHeader Header;
             std::memcpy(Header.Signature, Types::RzfHeaderSignature, sizeof(Types::RzfHeaderSignature));
             std::memcpy(Header.Version, Types::RzfHeaderVersion, sizeof(Types::RzfHeaderVersion));
             Header.OriginalSize = FileSize;
-            Header.OriginalCRC32 = Utils::CalculateCRC32InStream(TableCRC32, File, 0, FileSize);
-            Header.NumberOfStreams = static_cast<unsigned long>(Options.ListOfStreams->size());
+            Header.NumberOfStreams = 0;
+            Header.OriginalCRC32 = 0;
             Header.FirstCompressedStreamOffset = -1;
+            Write(reinterpret_cast<const char*>(&Header), sizeof(Types::RzfHeader));
+
+            // Input is read only once: CRC32 of whole file is built
+            // from CRC32 of raw data and CRC32 of streams
+            OriginalCRC32 = 0;
+
+            if (Streaming) {
+                CompressInput(std::cin, Callback);
+            } else if (!CompressFile()) {
+                // Archive without part of input is useless
+                Close();
+
+                if (Options.OutBuffer == nullptr) {
+                    boost::system::error_code RemoveError;
+                    fs::remove(Options.OutFile, RemoveError);
+                }
 
-            // Keep bytes for header
-            OutFile.seekp(sizeof(Types::RzfHeader));
+                return false;
+            }
+
+            auto StageTime = std::chrono::high_resolution_clock::now();
+
+            WriteIndex();
+            Out.flush();
+
+            WriteTime += std::chrono::high_resolution_clock::now() - StageTime;
+
+            Utils::AddStatTime(Utils::StatEncodeWallTime, EncodeTime);
+            Utils::AddStatTime(Utils::StatWriteTime, WriteTime);
+            Utils::AddStatTime(Utils::StatWaitTime, WaitTime);
+            return true;
+        }
+
+        /*
+         * Input is a file with list of streams found by scanner.
+         * Returns false if input or previous archive was cut.
+         */
+        bool Compressor::CompressFile() {
+            PrepareJobs();
+
+            // Workers encode streams in any order, writer
+            // takes them strictly by offset in original file
+            StartWorkers(static_cast<unsigned int>(std::min<size_t>(Jobs, JobList.size())));
+
+            uintmax_t PrevOffset = 0;
 
-            Types::RzfCompressedStream CompressedStream;
-            uintmax_t PrevOffset = 0, i = 0, SavedBytes = 0;
-            std::list<Types::StreamInfo> DerListOfStreams = *Options.ListOfStreams;
-            Types::StreamInfo Stream;
-            std::ifstream CompressFileStream;
-            fs::path ComressFileName;
+            while (true) {
+                uintmax_t Offset;
 
-            for (auto StreamIterator = DerListOfStreams.begin();
-                StreamIterator != DerListOfStreams.end();
-                StreamIterator++, i++) {
+                {
+                    std::lock_guard<std::mutex> Lock(Mutex);
 
-                Stream = *StreamIterator;
+                    if (JobList.empty()) {
+                        break;
+                    }
+
+                    Offset = JobList.front().Stream.Offset;
+                }
 
                 // Write non-compressed data
-                if (Stream.Offset > PrevOffset) {
-                    Utils::InjectDataFromStreamToStream(
-                        File,
-                        OutFile,
-                        PrevOffset,
-                        Stream.Offset - PrevOffset
-                    );
-                }
-
-                CompressStream(Stream, CompressedStream, CompressFileStream, ComressFileName);
-
-                // If compressed size >= stream size
-                // Write raw data
-                if (CompressedStream.CompressedSize >= Stream.Size) {
-                    Utils::InjectDataFromStreamToStream(File, OutFile, Stream.Offset, Stream.Size);
-                    PrevOffset = Stream.Offset + Stream.Size;
+                auto StageTime = std::chrono::high_resolution_clock::now();
+                if (Offset > PrevOffset && !CopyRaw(PrevOffset, Offset - PrevOffset, OriginalCRC32)) {
+                    break;
+                }
+                WriteTime += std::chrono::high_resolution_clock::now() - StageTime;
+
+                PrevOffset = WriteFront();
+
+                if (Failed) {
+                    break;
+                }
+            }
+
+            // Workers drop jobs which aren't taken yet
+            if (Failed) {
+                std::lock_guard<std::mutex> Lock(Mutex);
+                NextJob = WrittenJobs + JobList.size();
+            }
+
+            Condition.notify_all();
+            JoinWorkers();
+
+            if (Failed) {
+                return false;
+            }
+
+            auto StageTime = std::chrono::high_resolution_clock::now();
+
+            // Write other non-compressed data
+            if (PrevOffset < FileSize && !CopyRaw(PrevOffset, FileSize - PrevOffset, OriginalCRC32)) {
+                return false;
+            }
+
+            WriteTime += std::chrono::high_resolution_clock::now() - StageTime;
+            return true;
+        }
+
+        /*
+         * Input can't be seeked (stdin), so streams are found here in a window
+         * of BufferSize bytes and cut out of input as soon as their size is known.
+         * Raw data and streams go to the same queue of jobs, so memory is bounded
+         * by window and streams in the queue, not by size of input.
+         */
+        void Compressor::CompressInput(std::istream &In, Types::ScannerCallbackHandle &Callback) {
+            const unsigned int Overlap = Signatures.GetLookAhead() - 1;
+            std::vector<char> Window(BufferSize + Overlap);
+            StreamCatalog Found;
+            unsigned int Available = 0;
+            bool Eof = false;
+            Utils::AllocBufferStat(Window.size());
+
+            StartWorkers(Jobs);
+
+            // FileSize is count of bytes taken from input, i.e. offset of window
+            while (!Eof || Available > 0) {
+                if (!Eof) {
+                    In.read(Window.data() + Available, Window.size() - Available);
+                    Available += static_cast<unsigned int>(In.gcount());
+                    Utils::AddStat(Utils::StatCompressBytesRead, static_cast<uintmax_t>(In.gcount()));
+                    Eof = Available < Window.size();
+                }
+
+                const unsigned int Length = Eof ? Available : BufferSize;
+                Found.Clear();
+                Signatures.Match(Window.data(), Length, Available, FileSize, Found, nullptr);
+
+                if (Found.Empty()) {
+                    PushRaw(Window.data(), Length);
+                    std::memmove(Window.data(), Window.data() + Length, Available - Length);
+                    Available -= Length;
                     continue;
                 }
 
-                // Calculating next stream offset
-                auto NextStreamIterator = std::next(StreamIterator, 1);
-                if (NextStreamIterator != DerListOfStreams.end()) {
-                    if (i > 0) {
-                        CompressedStream.NextCompressedStreamOffset =
-                            sizeof(Types::RzfHeader)
-                            + (*NextStreamIterator).Offset
-                            + sizeof(Types::RzfCompressedStream)
-                            - (Stream.Size - CompressedStream.CompressedSize)
-                            + (i * sizeof(Types::RzfCompressedStream))
-                            - SavedBytes;
-                    } else {
-                        CompressedStream.NextCompressedStreamOffset =
-                            sizeof(Types::RzfHeader)
-                            + (*NextStreamIterator).Offset
-                            + sizeof(Types::RzfCompressedStream)
-                            - (Stream.Size - CompressedStream.CompressedSize);
+                // Other candidates are inside of this stream
+                // or will be found again after it
+                Found.Sort();
+                Types::StreamInfo Stream = Found.Get(0);
+
+                const unsigned int Head = static_cast<unsigned int>(Stream.Offset - FileSize);
+                PushRaw(Window.data(), Head);
+
+                if (Callback != nullptr) {
+                    Callback(&Stream);
+                }
+
+                const unsigned int InWindow = static_cast<unsigned int>(std::min<uintmax_t>(Stream.Size, Available - Head));
+
+                CompressJob Job;
+                Job.EncodeTime = std::chrono::duration<double>::zero();
+                Job.CRC32 = 0;
+                Job.Hashed = Job.Duplicate = Job.Reused = false;
+                Job.Done = false;
+                Job.Raw.assign(Window.data() + Head, Window.data() + Head + InWindow);
+
+                std::memmove(Window.data(), Window.data() + Head + InWindow, Available - Head - InWindow);
+                Available -= Head + InWindow;
+
+                // Rest of stream is read straight from input
+                while (Job.Raw.size() < Stream.Size) {
+                    const size_t Done = Job.Raw.size();
+                    const size_t Length = static_cast<size_t>(std::min<uintmax_t>(Stream.Size - Done, InputChunkSize));
+                    Job.Raw.resize(Done + Length);
+                    In.read(Job.Raw.data() + Done, Length);
+                    Utils::AddStat(Utils::StatCompressBytesRead, static_cast<uintmax_t>(In.gcount()));
+
+                    // Stream is cut by the end of input
+                    if (static_cast<size_t>(In.gcount()) != Length) {
+                        Job.Raw.resize(Done + static_cast<size_t>(In.gcount()));
+                        Eof = true;
+                        break;
                     }
-                } else {
-                    CompressedStream.NextCompressedStreamOffset = -1;
-                }
-                CompressedStream.Type = Stream.Type;
-                CompressedStream.OriginalOffset = Stream.Offset;
-                CompressedStream.OriginalSize = Stream.Size;
-                CompressedStream.OriginalCRC32 =
-                    Utils::CalculateCRC32InStream(TableCRC32, File, Stream.Offset, Stream.Size);
-
-                OutFile.write(reinterpret_cast<const char*>(&CompressedStream), sizeof(Types::RzfCompressedStream));
-
-                Utils::InjectDataFromStreamToStream(
-                    CompressFileStream,
-                    OutFile,
-                    Stream.Offset,
-                    CompressedStream.CompressedSize
-                );
-
-                CompressFileStream.close();
-                fs::remove(ComressFileName);
-                
-                SavedBytes += Stream.Size - CompressedStream.CompressedSize;
+                }
+
+                Stream.Size = Job.Raw.size();
+                Job.Stream = Stream;
+                FileSize += Stream.Size;
+                CountOfStreams++;
+                SizeOfStreams += Stream.Size;
+                Utils::AllocBufferStat(Job.Raw.size());
+                PushJob(std::move(Job));
+            }
+
+            {
+                std::lock_guard<std::mutex> Lock(Mutex);
+                InputDone = true;
+            }
+            Condition.notify_all();
+
+            FlushJobs(0);
+            JoinWorkers();
+
+            Utils::FreeBufferStat(Window.size());
+        }
+
+        /*
+         * Raw data of stdin input goes through the queue too, so it's
+         * written between streams. Nothing to encode, job is done already.
+         */
+        void Compressor::PushRaw(const char *Data, size_t Size) {
+            if (Size == 0) {
+                return;
+            }
+
+            // Blocks of gap are encoded by workers like streams
+            if (Options.CompressGaps && Size >= MinGapSize) {
+                for (size_t Done = 0; Done < Size; Done += static_cast<size_t>(GapBlockSize)) {
+                    const size_t Length = static_cast<size_t>(std::min<uintmax_t>(GapBlockSize, Size - Done));
+
+                    CompressJob Job;
+                    Job.Stream.Offset = FileSize;
+                    Job.Stream.Size = Length;
+                    Job.Stream.Type = Types::GapData;
+                    Job.Raw.assign(Data + Done, Data + Done + Length);
+                    Job.CRC32 = 0;
+                    Job.EncodeTime = std::chrono::duration<double>::zero();
+                    Job.Hashed = Job.Duplicate = Job.Reused = false;
+                    Job.Done = false;
+
+                    FileSize += Length;
+                    Utils::AllocBufferStat(Length);
+                    PushJob(std::move(Job));
+                }
+
+                return;
+            }
+
+            CompressJob Job;
+            Job.Stream.Offset = FileSize;
+            Job.Stream.Size = Size;
+            Job.Raw.assign(Data, Data + Size);
+            Job.CRC32 = Utils::UpdateCRC32(0, Data, Size);
+            Job.Entry.CompressedSize = Size;
+            Job.EncodeTime = std::chrono::duration<double>::zero();
+            Job.Hashed = Job.Duplicate = Job.Reused = false;
+            Job.Done = true;
+
+            FileSize += Size;
+            Utils::AllocBufferStat(Size);
+            PushJob(std::move(Job));
+        }
+
+        void Compressor::PushJob(CompressJob &&Job) {
+            {
+                std::lock_guard<std::mutex> Lock(Mutex);
+                JobList.push_back(std::move(Job));
+            }
+            Condition.notify_all();
+
+            FlushJobs(static_cast<size_t>(Jobs) * 4);
+        }
+
+        /*
+         * Write jobs which are done, and wait for the first one
+         * while there are more than Limit jobs in the queue.
+         */
+        void Compressor::FlushJobs(size_t Limit) {
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> Lock(Mutex);
+
+                    if (JobList.empty() || (JobList.size() <= Limit && !JobList.front().Done)) {
+                        return;
+                    }
+                }
+
+                WriteFront();
+            }
+        }
+
+        /*
+         * Wait until the first job in the queue is done, write it and drop it.
+         * Returns end offset of the job in original file.
+         */
+        uintmax_t Compressor::WriteFront() {
+            auto StageTime = std::chrono::high_resolution_clock::now();
+            std::unique_lock<std::mutex> Lock(Mutex);
+            CompressJob &Job = JobList.front();
+            Condition.wait(Lock, [&]() { return Job.Done; });
+            Lock.unlock();
+            WaitTime += std::chrono::high_resolution_clock::now() - StageTime;
+
+            StageTime = std::chrono::high_resolution_clock::now();
+            WriteJob(Job);
+            WriteTime += std::chrono::high_resolution_clock::now() - StageTime;
+
+            EncodeTime += Job.EncodeTime;
+            OriginalCRC32 = Utils::CombineCRC32(OriginalCRC32, Job.CRC32, Job.Stream.Size);
+            const uintmax_t End = Job.Stream.Offset + Job.Stream.Size;
+
+            Lock.lock();
+            JobList.pop_front();
+            WrittenJobs++;
+
+            // Raw data of stdin input is never taken by workers
+            NextJob = std::max(NextJob, WrittenJobs);
+            Lock.unlock();
+            Condition.notify_all();
+
+            return End;
+        }
+
+        /*
+         * Output can't be seeked or asked for position,
+         * so offset in archive is counted here.
+         */
+        void Compressor::Write(const char *Data, size_t Size) {
+            Out.write(Data, Size);
+            Position += Size;
+            Utils::AddStat(Utils::StatCompressBytesWritten, Size);
+        }
+
+        /*
+         * Write index of compressed streams and footer. Footer has fixed
+         * size and is the last thing in archive, so reader finds index by it.
+         */
+        void Compressor::WriteIndex() {
+            Types::RzfFooter Footer;
+            Footer.IndexOffset = Position;
+            Footer.NumberOfStreams = Index.size();
+            Footer.OriginalSize = FileSize;
+            Footer.OriginalCRC32 = OriginalCRC32;
+            Footer.IndexCRC32 = Utils::UpdateCRC32(0, Index.data(), Index.size() * sizeof(Types::RzfIndexEntry));
+            std::memcpy(Footer.Signature, Types::RzfFooterSignature, sizeof(Types::RzfFooterSignature));
+
+            Write(reinterpret_cast<const char*>(Index.data()), Index.size() * sizeof(Types::RzfIndexEntry));
+            Write(reinterpret_cast<const char*>(&Footer), sizeof(Types::RzfFooter));
+        }
+
+        /*
+         * Copy raw data from input to output and update CRC32 by it.
+         * Bytes are needed for CRC32 of original anyway, so they aren't
+         * copied by kernel: it would read the same range twice.
+         * Returns false if input is shorter than expected (it was cut).
+         */
+        bool Compressor::CopyRaw(uintmax_t Offset, uintmax_t Size, uint32_t &CRC32) {
+            AddRawCopy(Offset, Size);
+            std::unique_ptr<Utils::RangeReader> Reader = Utils::OpenRangeReader(Options.FileName, Offset, Size, BufferSize);
+            std::vector<char> Buffer(static_cast<size_t>(std::min<uintmax_t>(BufferSize, Size)));
+            uintmax_t ReadBytes = 0;
+            Utils::AllocBufferStat(Buffer.size());
+
+            while (ReadBytes < Size) {
+                const size_t Length = static_cast<size_t>(std::min<uintmax_t>(Buffer.size(), Size - ReadBytes));
+                const size_t Read = Reader->Read(Buffer.data(), Length);
+                Write(Buffer.data(), Read);
+                CRC32 = Utils::UpdateCRC32(CRC32, Buffer.data(), Read);
+                ReadBytes += Read;
+
+                if (Read < Length) {
+                    break;
+                }
+            }
+
+            Utils::AddStat(Utils::StatCompressBytesRead, ReadBytes);
+            Utils::FreeBufferStat(Buffer.size());
+
+            if (ReadBytes < Size) {
+                SetError("Unexpected end of input file!");
+                return false;
+            }
+
+            return true;
+        }
+
+        /*
+         * Remember where raw data of input lands in archive, so kept
+         * references to raw data of previous archive can point to it.
+         */
+        void Compressor::AddRawCopy(uintmax_t Offset, uintmax_t Size) {
+            if (Options.Reuse != nullptr && Size > 0) {
+                RawCopies[Offset] = std::make_pair(Position, Size);
+            }
+        }
+
+        /*
+         * Build list of jobs from found streams.
+         * Overlapping streams are skipped.
+         */
+        void Compressor::PrepareJobs() {
+            uintmax_t PrevOffset = 0;
+
+            JobList.clear();
+
+            // Payloads of previous archive are written as is,
+            // new streams are found after them only
+            for (size_t i = 0; Options.Reuse != nullptr && i < Options.Reuse->size(); i++) {
+                const Types::RzfIndexEntry &Entry = (*Options.Reuse)[i];
+                AddGapJobs(PrevOffset, Entry.OriginalOffset);
+
+                CompressJob Job;
+                Job.Stream.Offset = Entry.OriginalOffset;
+                Job.Stream.Size = Entry.OriginalSize;
+                Job.Stream.Type = Entry.Type;
+                Job.Entry = Entry;
+                Job.CRC32 = Entry.OriginalCRC32;
+                Job.EncodeTime = std::chrono::duration<double>::zero();
+                Job.Hashed = Job.Duplicate = false;
+                Job.Reused = true;
+                Job.Done = true;
+                JobList.push_back(std::move(Job));
+
+                PrevOffset = Entry.OriginalOffset + Entry.OriginalSize;
+
+                if (Entry.Type != Types::GapData) {
+                    CountOfStreams++;
+                    SizeOfStreams += Entry.OriginalSize;
+                }
+            }
+
+            for (size_t i = 0; i < Options.Streams->Size(); i++) {
+                Types::StreamInfo Stream = Options.Streams->Get(i);
+
+                // Stream overlaps with previous one, it's already in archive
+                if (Stream.Offset < PrevOffset) {
+                    continue;
+                }
+
+                AddGapJobs(PrevOffset, Stream.Offset);
+
+                CompressJob Job;
+                Job.Stream = Stream;
+                Job.EncodeTime = std::chrono::duration<double>::zero();
+                Job.CRC32 = 0;
+                Job.Hashed = Job.Duplicate = Job.Reused = false;
+                Job.Done = false;
+                JobList.push_back(std::move(Job));
+
                 PrevOffset = Stream.Offset + Stream.Size;
+                CountOfStreams++;
+                SizeOfStreams += Stream.Size;
             }
 
-            // Write other non-compressed data
-            if (PrevOffset < FileSize) {                
-                Utils::InjectDataFromStreamToStream(
-                    File,
-                    OutFile,
-                    PrevOffset,
-                    FileSize - PrevOffset
-                );
-            }
-
-            // If we compress some data
-            // Then set pointer to first compressed stream
-            if (SavedBytes != 0) {
-                Header.FirstCompressedStreamOffset =
-                    sizeof(Types::RzfHeader) + Options.ListOfStreams->front().Offset;
-            }
-
-            // Write header
-            OutFile.seekp(std::fstream::beg);
-            OutFile.write(reinterpret_cast<const char*>(&Header), sizeof(Types::RzfHeader));
-        }
-
-        void Compressor::CompressStream(
-            Types::StreamInfo &Stream,
-            Types::RzfCompressedStream &CompressedStream,
-            std::ifstream &CompressFileStream,
-            fs::path &ComressFileName) {
-            fs::path TempFileName = Utils::GenerateTmpFileName(fs::current_path().string(), ".wav");
-            Utils::ExtactDataFromStreamToFile(File, Stream.Offset, Stream.Size, TempFileName.string());
-            fs::path OutFileName = TempFileName.filename();
+            AddGapJobs(PrevOffset, FileSize);
+            InputDone = true;
+        }
+
+        /*
+         * Split data between streams [Begin, End) into blocks for workers.
+         * Small gaps are left to the writer, it copies them as is.
+         */
+        void Compressor::AddGapJobs(uintmax_t Begin, uintmax_t End) {
+            if (!Options.CompressGaps || End < Begin + MinGapSize) {
+                return;
+            }
+
+            for (uintmax_t Offset = Begin; Offset < End; Offset += GapBlockSize) {
+                CompressJob Job;
+                Job.Stream.Offset = Offset;
+                Job.Stream.Size = std::min(GapBlockSize, End - Offset);
+                Job.Stream.Type = Types::GapData;
+                Job.EncodeTime = std::chrono::duration<double>::zero();
+                Job.CRC32 = 0;
+                Job.Hashed = Job.Duplicate = Job.Reused = false;
+                Job.Done = false;
+                JobList.push_back(std::move(Job));
+            }
+        }
+
+        /*
+         * Workers of pool may be busy with other inputs, then jobs
+         * of this one wait for them: writer never runs on the pool,
+         * so it can't be blocked by its own workers.
+         */
+        void Compressor::StartWorkers(unsigned int Count) {
+            for (unsigned int i = 0; i < Count; i++) {
+                if (Options.Pool != nullptr) {
+                    PoolWorkers.push_back(Options.Pool->Submit([this]() { EncodeWorker(); }));
+                } else {
+                    Workers.emplace_back(&Compressor::EncodeWorker, this);
+                }
+            }
+        }
+
+        void Compressor::JoinWorkers() {
+            for (auto &Worker : Workers) {
+                Worker.join();
+            }
+
+            for (auto &Worker : PoolWorkers) {
+                Worker.wait();
+            }
+
+            Workers.clear();
+            PoolWorkers.clear();
+        }
+
+        /*
+         * Take next job and encode it. Workers don't run further
+         * than few jobs per worker ahead of writer, so encoded
+         * payloads don't pile up in memory.
+         */
+        void Compressor::EncodeWorker() {
+            const size_t Window = static_cast<size_t>(Jobs) * 4;
+
+            std::unique_lock<std::mutex> Lock(Mutex);
+
+            // Jobs in queue have numbers [WrittenJobs, WrittenJobs + JobList.size())
+            while (true) {
+                Condition.wait(Lock, [&]() {
+                    return NextJob < WrittenJobs + JobList.size()
+                        ? NextJob < WrittenJobs + Window
+                        : InputDone;
+                });
+
+                if (NextJob >= WrittenJobs + JobList.size()) {
+                    break;
+                }
+
+                CompressJob &Job = JobList[NextJob - WrittenJobs];
+                Job.Number = NextJob++;
+
+                // Raw data of stdin input
+                if (Job.Done) {
+                    continue;
+                }
+
+                Lock.unlock();
+
+                const std::chrono::duration<double> CpuTime = Utils::ThreadCpuTime();
+
+                if (Streaming) {
+                    EncodeJob(Job);
+                } else if (!CompressStream(Job)) {
+                    // Nothing to write, writer stops on error
+                    Job.Stream.Size = 0;
+                    Job.Entry.CompressedSize = 0;
+                }
+
+                Utils::AddStatTime(Utils::StatEncodeCpuTime, Utils::ThreadCpuTime() - CpuTime);
+
+                Lock.lock();
+                Job.Done = true;
+                Condition.notify_all();
+            }
+        }
+
+        void Compressor::WriteJob(CompressJob &Job) {
+            Types::RzfIndexEntry &Entry = Job.Entry;
+
+            if (Job.Reused) {
+                WriteReused(Job);
+                return;
+            }
+
+            // The first copy in job order is stored, the same stream
+            // encoded by other worker before it becomes a reference
+            if (Job.Hashed && Stored.find(Job.Hash) != Stored.end()) {
+                WriteReference(Job);
+            } else if (Job.Duplicate || Entry.CompressedSize >= Job.Stream.Size) {
+                // If compressed size >= stream size (or first copy
+                // of duplicate wasn't stored) write raw data.
+                // Raw copy of stream is referenced as compressor 0
+                if (Job.Hashed) {
+                    Types::RzfIndexEntry &Copy = Stored[Job.Hash];
+                    Copy.Compressor = 0;
+                    Copy.CompressedOffset = Position;
+                    Copy.CompressedSize = Job.Raw.size();
+                }
+
+                AddRawCopy(Job.Stream.Offset, Job.Raw.size());
+                Write(Job.Raw.data(), Job.Raw.size());
+            } else {
+                Entry.CompressedOffset = Position;
+                Index.push_back(Entry);
+                Write(Job.Payload.data(), Job.Payload.size());
+
+                if (Job.Hashed) {
+                    Stored[Job.Hash] = Entry;
+                }
+            }
+
+            // Job is written, free memory
+            Utils::FreeBufferStat(Job.Raw.size() + Job.Payload.size());
+            std::vector<char>().swap(Job.Payload);
+            std::vector<char>().swap(Job.Raw);
+        }
+
+        /*
+         * Index entry of duplicate points to data of the first copy,
+         * which is always written before: it has smaller job number.
+         */
+        void Compressor::WriteReference(CompressJob &Job) {
+            const Types::RzfIndexEntry &Copy = Stored.at(Job.Hash);
+            Types::RzfIndexEntry &Entry = Job.Entry;
+
+            Entry.Type = Job.Stream.Type;
+            Entry.Compressor = Copy.Compressor | Types::RzfReference;
+            Entry.CompressedOffset = Copy.CompressedOffset;
+            Entry.CompressedSize = Copy.CompressedSize;
+            Entry.OriginalOffset = Job.Stream.Offset;
+            Entry.OriginalSize = Job.Stream.Size;
+            Entry.OriginalCRC32 = Job.CRC32;
+            Index.push_back(Entry);
+
+            Utils::AddStat(Utils::StatStreamsDeduplicated, 1);
+            Utils::AddStat(Utils::StatDeduplicatedBytes, Job.Stream.Size);
+        }
+
+        /*
+         * Copy payload of stream from previous archive. References are
+         * moved to new offsets of payloads, which are always copied before.
+         * Reference to raw data points to the same bytes copied from input,
+         * if they were copied as is (not encoded as gap), else it's raw too.
+         */
+        void Compressor::WriteReused(CompressJob &Job) {
+            Types::RzfIndexEntry &Entry = Job.Entry;
+
+            if (Entry.Compressor == Types::RzfReference) {
+                // Offset of reference to raw data is in original file here
+                auto Copy = RawCopies.upper_bound(Entry.CompressedOffset);
+
+                if (Copy == RawCopies.begin()
+                    || Entry.CompressedOffset + Entry.CompressedSize > (--Copy)->first + Copy->second.second) {
+                    uint32_t CRC32 = 0;
+                    CopyRaw(Entry.OriginalOffset, Entry.OriginalSize, CRC32);
+                    return;
+                }
+
+                Entry.CompressedOffset = Copy->second.first + (Entry.CompressedOffset - Copy->first);
+            } else if ((Entry.Compressor & Types::RzfReference) != 0) {
+                Entry.CompressedOffset = Moved.at(Entry.CompressedOffset);
+            } else {
+                const uint64_t Offset = Position;
+                CopyPayload(Entry.CompressedOffset, Entry.CompressedSize);
+                Moved[Entry.CompressedOffset] = Offset;
+                Entry.CompressedOffset = Offset;
+            }
+
+            Index.push_back(Entry);
+            Utils::AddStat(Utils::StatStreamsReused, 1);
+        }
+
+        /*
+         * Same as CopyRaw, but from previous archive and without CRC32:
+         * payload is checked by CRC32 of stream on restore.
+         */
+        bool Compressor::CopyPayload(uintmax_t Offset, uintmax_t Size) {
+            if (Options.OutBuffer == nullptr) {
+                Out.flush();
+                const uintmax_t Copied = Utils::KernelCopy(Options.ReuseFile, Offset, Options.OutFile, Position, Size);
+
+                if (Copied > 0) {
+                    Utils::AddStat(Utils::StatCompressBytesWritten, Copied);
+                    Position += Copied;
+                    Offset += Copied;
+                    Size -= Copied;
+                    OutFile.seekp(Position, std::fstream::beg);
+                }
+            }
+
+            std::unique_ptr<Utils::RangeReader> Reader = Utils::OpenRangeReader(Options.ReuseFile, Offset, Size, BufferSize);
+            std::vector<char> Buffer(static_cast<size_t>(std::min<uintmax_t>(BufferSize, Size)));
+
+            for (uintmax_t Done = 0; Done < Size;) {
+                const size_t Length = static_cast<size_t>(std::min<uintmax_t>(Buffer.size(), Size - Done));
+                const size_t Read = Reader->Read(Buffer.data(), Length);
+                Write(Buffer.data(), Read);
+                Done += Read;
+
+                if (Read < Length) {
+                    SetError("Unexpected end of previous archive!");
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        /*
+         * Pick entries of previous archive which can be kept for grown input:
+         * prefix of index which ends before the boundary overlap. Raw data
+         * is copied from input again, so offset of reference to raw data is
+         * changed to offset of the first copy in input: raw data lies between
+         * payloads in archive in the same order as in input.
+         * Returns offset in input where new streams are searched from.
+         */
+        uintmax_t Compressor::SelectReusable(const std::vector<Types::RzfIndexEntry> &Index, uintmax_t PrevSize,
+            std::vector<Types::RzfIndexEntry> &Reuse) {
+            std::map<uint64_t, std::pair<uint64_t, uint64_t>> RawData;
+            uint64_t ArchiveOffset = sizeof(Types::RzfHeader);
+            uint64_t OriginalOffset = 0;
+            uintmax_t Boundary = 0;
+
+            Reuse.clear();
+
+            for (const auto &Entry : Index) {
+                if (Entry.OriginalOffset + Entry.OriginalSize + BoundaryOverlap > PrevSize) {
+                    break;
+                }
+
+                // Raw data before stream
+                if (Entry.OriginalOffset > OriginalOffset) {
+                    RawData[ArchiveOffset] = std::make_pair(OriginalOffset, Entry.OriginalOffset - OriginalOffset);
+                    ArchiveOffset += Entry.OriginalOffset - OriginalOffset;
+                }
+
+                if ((Entry.Compressor & Types::RzfReference) == 0) {
+                    ArchiveOffset += Entry.CompressedSize;
+                }
+
+                OriginalOffset = Entry.OriginalOffset + Entry.OriginalSize;
+                Types::RzfIndexEntry Kept = Entry;
+
+                if (Entry.Compressor == Types::RzfReference) {
+                    auto Raw = RawData.upper_bound(Entry.CompressedOffset);
+
+                    // First copy must be inside of one block of raw data,
+                    // else the stream is copied from input as raw data
+                    if (Raw == RawData.begin()
+                        || Entry.CompressedOffset + Entry.CompressedSize > (--Raw)->first + Raw->second.second) {
+                        continue;
+                    }
+
+                    Kept.CompressedOffset = Raw->second.first + (Entry.CompressedOffset - Raw->first);
+                }
+
+                Reuse.push_back(Kept);
+                Boundary = OriginalOffset;
+            }
+
+            return Boundary;
+        }
+
+        /*
+         * Read stream and encode it. Returns false if input is shorter
+         * than stream (it was cut), then compress fails.
+         */
+        bool Compressor::CompressStream(CompressJob &Job) {
+            auto StartTime = std::chrono::high_resolution_clock::now();
+            Types::StreamInfo &Stream = Job.Stream;
+
+            // The only read of stream from input
+            std::unique_ptr<Utils::RangeReader> Reader = Utils::OpenRangeReader(Options.FileName, Stream.Offset, Stream.Size, BufferSize);
+            Job.Raw.resize(static_cast<size_t>(Stream.Size));
+            const size_t Read = Reader->Read(Job.Raw.data(), Job.Raw.size());
+
+            if (Read != Stream.Size) {
+                SetError("Unexpected end of input file!");
+                std::vector<char>().swap(Job.Raw);
+                return false;
+            }
+
+            Utils::AddStat(Utils::StatCompressBytesRead, Job.Raw.size());
+            Utils::AllocBufferStat(Job.Raw.size());
+
+            Job.EncodeTime = std::chrono::high_resolution_clock::now() - StartTime;
+            EncodeJob(Job);
+            return true;
+        }
+
+        /*
+         * Encode stream which is already in Job.Raw.
+         */
+        void Compressor::EncodeJob(CompressJob &Job) {
+            auto StartTime = std::chrono::high_resolution_clock::now();
+            Types::StreamInfo &Stream = Job.Stream;
+            Types::RzfIndexEntry &Entry = Job.Entry;
+            unsigned short PcmLevel = Options.PcmCompLevel;
             bool Result = false;
+            Entry.Compressor = 0;
+            Job.Payload.clear();
+            Job.CRC32 = Utils::UpdateCRC32(0, Job.Raw.data(), Job.Raw.size());
+
+            if (Options.Dedup && Stream.Type != Types::GapData && !ClaimStream(Job)) {
+                // Writer refers to the first copy, raw bytes are
+                // kept only in case it wasn't stored
+                Job.Duplicate = true;
+                Job.EncodeTime += std::chrono::high_resolution_clock::now() - StartTime;
+                return;
+            }
 
             // Select compressor
             switch (Stream.Type) {
             case Types::RiffWave:
-                // Fix size in header (RIFF WAVE)
-                /*Engine::Formats::RiffWave::FixRiffWaveHeaderInFile(
-                    TempFileName.string(),
-                    reinterpret_cast<Engine::Formats::RiffWave::RiffWaveHeader*>(Stream.Data)
-                );*/
-
                 if (Options.TakCompLevel > 0) {
-                    CompressedStream.Compressor = Types::TakCompressor;
-                    OutFileName = OutFileName.replace_extension(".tak");
+                    Entry.Compressor = Types::TakCompressor;
                 } else if (Options.WavPackCompLevel > 0) {
-                    CompressedStream.Compressor = Types::WavPackCompressor;
-                    OutFileName = OutFileName.replace_extension(".wv");
+                    Entry.Compressor = Types::WavPackCompressor;
+                } else if (Options.PcmCompLevel > 0) {
+                    Entry.Compressor = Types::PcmCompressor;
+                }
+
+                if (Entry.Compressor != 0 && !EstimateGain(Job.Raw, PcmLevel)) {
+                    Entry.Compressor = 0;
                 }
 
+                break;
+            case Types::GapData:
+                Entry.Compressor = Types::LzCompressor;
                 break;
             default:
                 break;
             }
 
-            ComressFileName = OutFileName;
-            if (CompressFileStream.is_open()) {
-                CompressFileStream.close();
-                fs::remove(OutFileName);
-            }
-
-            switch (CompressedStream.Compressor) {
+            // Result of any encoder goes to Payload
+            switch (Entry.Compressor) {
+            case Types::PcmCompressor:
+                Result = PcmCompress(Job.Raw, PcmLevel, Job.Payload);
+                break;
             case Types::TakCompressor:
-                Result = TakCompress(TempFileName, OutFileName, Options.TakCompLevel);
+                Result = Codecs::External::TakEncode(Job.Raw.data(), Job.Raw.size(), Options.TakCompLevel, Job.Payload);
                 break;
             case Types::WavPackCompressor:
-                Result = WavpackCompress(TempFileName, OutFileName, Options.WavPackCompLevel);
+                Result = Codecs::External::WavpackEncode(Job.Raw.data(), Job.Raw.size(), Options.WavPackCompLevel, Job.Payload);
+                break;
+            case Types::LzCompressor:
+                Result = Codecs::Lz::Encode(Job.Raw.data(), Job.Raw.size(), Job.Payload);
                 break;
             default:
                 break;
             }
 
-            if (Result) {
-                CompressFileStream.open(OutFileName.string(), std::fstream::binary);
-                CompressedStream.CompressedSize = fs::file_size(OutFileName);
+            Entry.CompressedSize = Result ? Job.Payload.size() : Stream.Size;
+            Utils::AllocBufferStat(Job.Payload.size());
+
+            if (Entry.CompressedSize < Stream.Size) {
+                Entry.Type = Stream.Type;
+                Entry.OriginalOffset = Stream.Offset;
+                Entry.OriginalSize = Stream.Size;
+                Entry.OriginalCRC32 = Job.CRC32;
+
+                // Raw bytes are needed only if stream is stored as is
+                Utils::FreeBufferStat(Job.Raw.size());
+                std::vector<char>().swap(Job.Raw);
+                Utils::AddStat(Stream.Type == Types::GapData ? Utils::StatGapBlocksEncoded : Utils::StatStreamsEncoded, 1);
             } else {
-                CompressedStream.CompressedSize = Stream.Size;
+                // Payload of block which doesn't compress isn't needed
+                Utils::FreeBufferStat(Job.Payload.size());
+                std::vector<char>().swap(Job.Payload);
+                Utils::AddStat(Stream.Type == Types::GapData ? Utils::StatGapBlocksStoredRaw : Utils::StatStreamsStoredRaw, 1);
+            }
+
+            Job.EncodeTime += std::chrono::high_resolution_clock::now() - StartTime;
+        }
+
+        /*
+         * Hash stream and claim it as the first copy. Jobs can be encoded
+         * in any order, so job with smaller number takes the hash over.
+         * Returns false if the same stream is in one of the previous jobs.
+         * Claim only saves encoder work: which copy is stored is decided
+         * by writer in job order, so archive doesn't depend on workers.
+         */
+        bool Compressor::ClaimStream(CompressJob &Job) {
+            Job.Hash = Utils::CalculateHash128(Job.Raw.data(), Job.Raw.size());
+            Job.Hashed = true;
+
+            std::lock_guard<std::mutex> Lock(Mutex);
+            auto Claim = Claimed.find(Job.Hash);
+
+            if (Claim != Claimed.end() && Claim->second < Job.Number) {
+                return false;
+            }
+
+            Claimed[Job.Hash] = Job.Number;
+            return true;
+        }
+
+        /*
+         * Predict gain of encoding by sampled blocks of integer PCM. Returns false
+         * if stream won't compress by MinGain percents, near-silent streams
+         * get the fastest PCM level: LPC can't do better on them.
+         */
+        bool Compressor::EstimateGain(const std::vector<char> &Buffer, unsigned short &PcmLevel) {
+            Engine::Formats::RiffWave::PcmDataInfo Info;
+
+            if (Options.MinGain == 0
+                || !Engine::Formats::RiffWave::LocatePcmData(Buffer.data(), Buffer.size(), Info)
+                || Info.AudioFormat != Engine::Formats::RiffWave::WaveFormatPcm) {
+                return true;
+            }
+
+            Codecs::Pcm::PcmFormat Format;
+            Format.Channels = Info.NumChannels;
+            Format.BitsPerSample = Info.BitsPerSample;
+            Format.BlockAlign = Info.BlockAlign;
+
+            const double Bits = Codecs::Pcm::EstimateBitsPerSample(Buffer.data() + Info.DataOffset, Info.DataSize, Format);
+
+            if (Bits < 0) {
+                return true;
             }
 
-            fs::remove(TempFileName);
+            const double Gain = 100 * (1 - Bits / (8 * (Format.BlockAlign / Format.Channels)));
+
+            if (Gain < Options.MinGain) {
+                Utils::AddStat(Utils::StatStreamsSkipped, 1);
+                return false;
+            }
+
+            if (Bits <= NearSilentBits && PcmLevel > 1) {
+                PcmLevel = 1;
+                Utils::AddStat(Utils::StatStreamsDowngraded, 1);
+            }
+
+            return true;
+        }
+
+        /*
+         * Encode RIFF WAVE stream with built-in PCM codec.
+         * Return false if stream has unsupported format or doesn't compress.
+         */
+        bool Compressor::PcmCompress(const std::vector<char> &Buffer, unsigned short Level, std::vector<char> &Payload) {
+            Engine::Formats::RiffWave::PcmDataInfo Info;
+
+            if (!Engine::Formats::RiffWave::LocatePcmData(Buffer.data(), Buffer.size(), Info)
+                || Info.AudioFormat != Engine::Formats::RiffWave::WaveFormatPcm) {
+                return false;
+            }
+
+            Codecs::Pcm::PcmFormat Format;
+            Format.Channels = Info.NumChannels;
+            Format.BitsPerSample = Info.BitsPerSample;
+            Format.BlockAlign = Info.BlockAlign;
+
+            return Codecs::Pcm::Encode(Buffer.data(), Buffer.size(), Info.DataOffset, Info.DataSize,
+                Format, Level, Payload);
+        }
+
+        void Compressor::SetError(const std::string &Message) {
+            std::lock_guard<std::mutex> Lock(Mutex);
+
+            // Keep first error only
+            if (!Failed) {
+                Error = Message;
+                Failed = true;
+            }
+        }
+
+        std::string Compressor::GetError() {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            return Error;
+        }
+
+        std::chrono::duration<double> Compressor::GetEncodeTime() {
+            return EncodeTime;
+        }
+
+        std::chrono::duration<double> Compressor::GetWriteTime() {
+            return WriteTime;
+        }
+
+        std::chrono::duration<double> Compressor::GetWaitTime() {
+            return WaitTime;
         }
 
-        bool Compressor::WavpackCompress(fs::path InputFile, fs::path OutputFile, unsigned short Level) {
-            bp::ipstream Pipe;
-#if _WIN64
-            bp::child process(bp::search_path("packers/wavpack_x64.exe"), "-h", InputFile, OutputFile);
-#else
-            bp::child process(bp::search_path("packers/wavpack_x32.exe"), "-h", InputFile, OutputFile);
-#endif
-            process.wait();
-            return process.exit_code() == 0;
+        unsigned long Compressor::GetCountOfStreams() {
+            return CountOfStreams;
         }
 
-        bool Compressor::TakCompress(fs::path InputFile, fs::path OutputFile, unsigned short Level) {
-            bp::ipstream Pipe;
-            bp::child process(bp::search_path("packers/tak.exe"), "-e", "-overwrite", "-wm0", "-tn4", "-p4m", InputFile, OutputFile);
-            process.wait();
-            return process.exit_code() == 0;
+        uintmax_t Compressor::GetSizeOfStreams() {
+            return SizeOfStreams;
         }
 
         void Compressor::Close() {
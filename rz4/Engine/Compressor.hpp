@@ -21,40 +21,137 @@
 #define RZ4_COMPRESSOR_HPP
 
 #include <iostream>
+#include <cstddef>
 #include <fstream>
+#include <string>
 #include <list>
+#include <map>
+#include <deque>
 #include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <condition_variable>
 #include <boost/filesystem.hpp>
-#include <boost/process.hpp>
-#include <boost/process/windows.hpp>
 
 #include "Engine/Formats/RiffWave.hpp"
+#include "Engine/Signatures.hpp"
+#include "Engine/StreamCatalog.hpp"
+#include "Engine/WorkerPool.hpp"
+#include "Engine/Codecs/Pcm.hpp"
+#include "Engine/Codecs/Lz.hpp"
+#include "Engine/Codecs/External.hpp"
 #include "Types/Types.hpp"
 #include "Utils/Utils.hpp"
 
 namespace rz4 {
     namespace Engine {
         namespace fs = boost::filesystem;
-        namespace bp = boost::process;
+
+        /*
+         * Stream encoded by worker and waiting for writer.
+         * Result of encoder is kept in Payload, original bytes
+         * are kept in Raw only if stream doesn't compress.
+         * Raw data between streams of stdin input is a job too.
+         * Duplicate is a copy of stream from earlier job, it isn't
+         * encoded and goes to archive as a reference (or as raw data,
+         * if the earlier copy wasn't stored). Reused is
+         * a stream which payload is copied from previous archive.
+         */
+        typedef struct CompressJob {
+            Types::StreamInfo Stream;
+            Types::RzfIndexEntry Entry;
+            std::vector<char> Raw;
+            std::vector<char> Payload;
+            uint32_t CRC32;
+            Utils::Hash128 Hash;
+            size_t Number;
+            std::chrono::duration<double> EncodeTime;
+            bool Hashed;
+            bool Duplicate;
+            bool Reused;
+            bool Done;
+        } CompressJob;
 
         class Compressor {
         private:
             std::ifstream File;
             std::ofstream OutFile;
             Types::CompressorOptions Options;
+            std::ostream Out;
+            uint64_t Position;
+            std::atomic<bool> Failed;
+            std::string Error;
+            std::vector<Types::RzfIndexEntry> Index;
+            std::map<Utils::Hash128, size_t> Claimed;
+            std::map<Utils::Hash128, Types::RzfIndexEntry> Stored;
+            std::map<uint64_t, uint64_t> Moved;
+            std::map<uint64_t, std::pair<uint64_t, uint64_t>> RawCopies;
             unsigned int BufferSize;
+            unsigned int Jobs;
             uint64_t FileSize;
+            bool Streaming;
+            SignatureRegistry Signatures;
+            std::deque<CompressJob> JobList;
+            size_t NextJob;
+            size_t WrittenJobs;
+            bool InputDone;
+            uint32_t OriginalCRC32;
+            unsigned long CountOfStreams;
+            uintmax_t SizeOfStreams;
+            std::mutex Mutex;
+            std::condition_variable Condition;
+            std::vector<std::thread> Workers;
+            std::vector<std::future<void>> PoolWorkers;
+            std::chrono::duration<double> EncodeTime;
+            std::chrono::duration<double> WriteTime;
+            std::chrono::duration<double> WaitTime;
 
         public:
             explicit Compressor(Types::CompressorOptions);
             ~Compressor();
 
-            void CompressStream(Types::StreamInfo&, Types::RzfCompressedStream&, std::ifstream&, fs::path&);
-            bool WavpackCompress(fs::path, fs::path, unsigned short);
-            bool TakCompress(fs::path, fs::path, unsigned short);
+            static uintmax_t SelectReusable(const std::vector<Types::RzfIndexEntry>&, uintmax_t,
+                std::vector<Types::RzfIndexEntry>&);
+
+            bool CompressStream(CompressJob&);
+            void EncodeJob(CompressJob&);
+            bool ClaimStream(CompressJob&);
+            bool EstimateGain(const std::vector<char>&, unsigned short&);
+            bool PcmCompress(const std::vector<char>&, unsigned short, std::vector<char>&);
 
-            void Start();
+            bool Start(Types::ScannerCallbackHandle& = nullptr);
             void Close();
+            bool CompressFile();
+            void CompressInput(std::istream&, Types::ScannerCallbackHandle&);
+            void PrepareJobs();
+            bool CopyRaw(uintmax_t, uintmax_t, uint32_t&);
+            void AddRawCopy(uintmax_t, uintmax_t);
+            void PushRaw(const char*, size_t);
+            void AddGapJobs(uintmax_t, uintmax_t);
+            void PushJob(CompressJob&&);
+            void FlushJobs(size_t);
+            uintmax_t WriteFront();
+            void StartWorkers(unsigned int);
+            void JoinWorkers();
+            void EncodeWorker();
+            void Write(const char*, size_t);
+            void WriteJob(CompressJob&);
+            void WriteReference(CompressJob&);
+            void WriteReused(CompressJob&);
+            bool CopyPayload(uintmax_t, uintmax_t);
+            void WriteIndex();
+
+            std::string GetError();
+            void SetError(const std::string&);
+
+            std::chrono::duration<double> GetEncodeTime();
+            std::chrono::duration<double> GetWriteTime();
+            std::chrono::duration<double> GetWaitTime();
+            unsigned long GetCountOfStreams();
+            uintmax_t GetSizeOfStreams();
         };
     }
 }
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Extractor.hpp"
+#include "stdafx.hpp"
+
+namespace rz4 {
+    namespace Engine {
+        namespace {
+            // How often progress is reported, workers don't print anything
+            const std::chrono::milliseconds ProgressInterval(100);
+        }
+
+        Extractor::Extractor(Types::ExtractorOptions Options) : Options(Options),
+            CountOfExtracted(0), SizeOfExtracted(0), Failed(false) {
+            Threads = Options.Threads;
+
+            if (Threads == 0) {
+                Threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+        }
+
+        bool Extractor::Start(Types::ExtractorCallbackHandle &Callback) {
+            const StreamCatalog &Streams = *Options.Streams;
+            const auto StartTime = std::chrono::high_resolution_clock::now();
+
+            if (!InFile.Open(Options.FileName)) {
+                SetError("Can't open input file!");
+                return false;
+            }
+
+            // Biggest streams first for better load balancing
+            std::vector<size_t> Order(Streams.Size());
+
+            for (size_t i = 0; i < Order.size(); i++) {
+                Order[i] = i;
+            }
+
+            std::stable_sort(Order.begin(), Order.end(), [&](size_t A, size_t B) {
+                return Streams.GetSize(A) > Streams.GetSize(B);
+            });
+
+            const unsigned int CountOfWorkers = static_cast<unsigned int>(std::min<uintmax_t>(Threads, Order.size()));
+            std::atomic<size_t> NextStream(0);
+            std::atomic<unsigned int> Running(CountOfWorkers);
+            std::vector<std::thread> Workers;
+
+            for (unsigned int i = 0; i < CountOfWorkers; i++) {
+                Workers.emplace_back([&]() {
+                    std::vector<char> Buffer;
+                    size_t Stream;
+
+                    while (!Failed && (Stream = NextStream++) < Order.size()) {
+                        if (!ExtractStream(Order[Stream], Buffer)) {
+                            break;
+                        }
+                    }
+
+                    std::lock_guard<std::mutex> Lock(Mutex);
+                    Running--;
+                    Finished.notify_all();
+                });
+            }
+
+            // Progress is reported from this thread only, not more often than
+            // ProgressInterval: with many small streams console output
+            // would take longer than extraction itself
+            {
+                std::unique_lock<std::mutex> Lock(Mutex);
+
+                while (Running > 0) {
+                    Finished.wait_for(Lock, ProgressInterval);
+
+                    if (Callback != nullptr && Running > 0) {
+                        Lock.unlock();
+                        Callback(CountOfExtracted, SizeOfExtracted);
+                        Lock.lock();
+                    }
+                }
+            }
+
+            for (auto &Worker : Workers) {
+                Worker.join();
+            }
+
+            InFile.Close();
+
+            if (Callback != nullptr && !Failed && !Order.empty()) {
+                Callback(CountOfExtracted, SizeOfExtracted);
+            }
+
+            Utils::AddStat(Utils::StatStreamsExtracted, CountOfExtracted);
+            Utils::AddStat(Utils::StatExtractBytes, SizeOfExtracted);
+            Utils::AddStatTime(Utils::StatExtractTime, std::chrono::high_resolution_clock::now() - StartTime);
+
+            return !Failed;
+        }
+
+        /*
+         * Output file is preallocated to final size, then filled
+         * by positional writes (or inside of kernel if possible).
+         */
+        bool Extractor::ExtractStream(size_t Index, std::vector<char> &Buffer) {
+            const StreamCatalog &Streams = *Options.Streams;
+            const uintmax_t Offset = Streams.GetOffset(Index);
+            const uintmax_t Size = Streams.GetSize(Index);
+            const fs::path Path = GetStreamPath(Index);
+            Utils::RandomAccessFile OutFile;
+
+            if (!OutFile.Create(Path)) {
+                SetError("Can't create file " + Path.string() + "!");
+                return false;
+            }
+
+            if (!OutFile.Preallocate(Size)) {
+                SetError("Not enough space for " + Path.string() + "!");
+                return false;
+            }
+
+            uintmax_t Copied = Utils::KernelCopy(InFile, Offset, OutFile, 0, Size);
+
+            if (Copied < Size && Buffer.size() < Options.BufferSize) {
+                Buffer.resize(Options.BufferSize);
+            }
+
+            while (Copied < Size) {
+                const size_t Length = static_cast<size_t>(std::min<uintmax_t>(Size - Copied, Buffer.size()));
+
+                if (InFile.ReadAt(Buffer.data(), Length, Offset + Copied) != Length) {
+                    SetError("Unexpected end of input file!");
+                    return false;
+                }
+
+                if (!OutFile.WriteAt(Buffer.data(), Length, Copied)) {
+                    SetError("Can't write to file " + Path.string() + "!");
+                    return false;
+                }
+
+                Copied += Length;
+            }
+
+            SizeOfExtracted += Size;
+            CountOfExtracted++;
+
+            return true;
+        }
+
+        /*
+         * Name of file contains position and size of stream in input.
+         */
+        fs::path Extractor::GetStreamPath(size_t Index) const {
+            return Options.OutDir / boost::str(boost::format("%016X-%016X.%s")
+                % Options.Streams->GetOffset(Index)
+                % Options.Streams->GetSize(Index)
+                % Options.Streams->GetExt(Index));
+        }
+
+        void Extractor::SetError(const std::string &Message) {
+            std::lock_guard<std::mutex> Lock(Mutex);
+
+            // Keep first error only
+            if (!Failed) {
+                Error = Message;
+                Failed = true;
+            }
+        }
+
+        std::string Extractor::GetError() {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            return Error;
+        }
+
+        uintmax_t Extractor::GetCountOfStreams() {
+            return CountOfExtracted;
+        }
+
+        uintmax_t Extractor::GetSizeOfStreams() {
+            return SizeOfExtracted;
+        }
+    }
+}
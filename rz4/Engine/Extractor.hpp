@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RZ4_EXTRACTOR_HPP
+#define RZ4_EXTRACTOR_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <boost/filesystem.hpp>
+
+#include "Engine/StreamCatalog.hpp"
+#include "Types/Types.hpp"
+#include "Utils/Utils.hpp"
+
+namespace rz4 {
+    namespace Engine {
+        namespace fs = boost::filesystem;
+
+        /*
+         * Write found streams to separate files by several workers.
+         */
+        class Extractor {
+        private:
+            Types::ExtractorOptions Options;
+            unsigned int Threads;
+            Utils::RandomAccessFile InFile;
+            std::atomic<uintmax_t> CountOfExtracted;
+            std::atomic<uintmax_t> SizeOfExtracted;
+            std::atomic<bool> Failed;
+            std::mutex Mutex;
+            std::condition_variable Finished;
+            std::string Error;
+
+        public:
+            explicit Extractor(Types::ExtractorOptions);
+
+            bool Start(Types::ExtractorCallbackHandle& = nullptr);
+            std::string GetError();
+            uintmax_t GetCountOfStreams();
+            uintmax_t GetSizeOfStreams();
+            fs::path GetStreamPath(size_t) const;
+
+            bool ExtractStream(size_t, std::vector<char>&);
+            void SetError(const std::string&);
+        };
+    }
+}
+
+
+#endif //RZ4_EXTRACTOR_HPP
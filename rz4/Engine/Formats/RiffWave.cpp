@@ -24,26 +24,221 @@ namespace rz4 {
     namespace Engine {
         namespace Formats {
             namespace RiffWave {
-                bool IsRiffWaveHeader(const char *Header) {
-                    return std::memcmp(Header, "RIFF", 4) == 0 && std::memcmp(Header + 8, "WAVE", 4) == 0;
+                namespace {
+                    inline uint16_t ReadUInt16(const char *Buffer) {
+                        const unsigned char *P = reinterpret_cast<const unsigned char*>(Buffer);
+                        return static_cast<uint16_t>(P[0] | (P[1] << 8));
+                    }
+
+                    inline uint32_t ReadUInt32(const char *Buffer) {
+                        const unsigned char *P = reinterpret_cast<const unsigned char*>(Buffer);
+                        return static_cast<uint32_t>(P[0]) | (static_cast<uint32_t>(P[1]) << 8)
+                            | (static_cast<uint32_t>(P[2]) << 16) | (static_cast<uint32_t>(P[3]) << 24);
+                    }
+
+                    inline uint64_t ReadUInt64(const char *Buffer) {
+                        return static_cast<uint64_t>(ReadUInt32(Buffer)) | (static_cast<uint64_t>(ReadUInt32(Buffer + 4)) << 32);
+                    }
+
+                    // Size field of RF64 / streamed RIFF, real size is elsewhere
+                    const uint32_t UnknownSize = 0xFFFFFFFF;
+
+                    // Chunk id is four printable ASCII chars
+                    inline bool IsFourCC(const char *Id) {
+                        for (int i = 0; i < 4; i++) {
+                            if (Id[i] < 0x20 || Id[i] > 0x7E) {
+                                return false;
+                            }
+                        }
+
+                        return true;
+                    }
+
+                    // Samples are plain integers or floats, so sizes can be checked
+                    inline bool IsLinear(const PcmDataInfo &Info) {
+                        return Info.AudioFormat == WaveFormatPcm || Info.AudioFormat == WaveFormatIeeeFloat;
+                    }
+
+                    bool CheckFormat(const PcmDataInfo &Info) {
+                        if (Info.NumChannels == 0 || Info.SampleRate == 0 || Info.BlockAlign == 0) {
+                            return false;
+                        }
+
+                        if (IsLinear(Info)) {
+                            return Info.BitsPerSample > 0 && Info.BitsPerSample <= 64
+                                && Info.BlockAlign == Info.NumChannels * ((Info.BitsPerSample + 7) / 8)
+                                && Info.ByteRate == static_cast<uint64_t>(Info.SampleRate) * Info.BlockAlign;
+                        }
+
+                        return true;
+                    }
+                }
+
+                /*
+                 * Walk chunks of RIFF WAVE (RF64 / BW64) stream in first Available bytes.
+                 * Returns WaveInvalid if anything doesn't fit the format, WaveIncomplete
+                 * if "data" chunk is out of Available bytes (all before it is valid).
+                 * StreamSize is taken from RIFF (ds64) size and extended to the end
+                 * of "data" chunk if RIFF size is too small; 0 - size is unknown.
+                 */
+                int WalkRiffWave(const char *Stream, uintmax_t Available, PcmDataInfo &Info) {
+                    if (Available < 12) {
+                        return WaveInvalid;
+                    }
+
+                    const bool Is64 = std::memcmp(Stream, "RIFF", 4) != 0;
+                    uintmax_t RiffSize = ReadUInt32(Stream + 4);
+                    uintmax_t DataSize64 = 0;
+                    uintmax_t Position = 12;
+                    bool HasFormat = false;
+
+                    std::memset(&Info, 0, sizeof(PcmDataInfo));
+
+                    if (Is64) {
+                        // "ds64" is always the first chunk
+                        const uintmax_t Ds64Size = Available >= 20 ? ReadUInt32(Stream + 16) : 0;
+
+                        if (Available < 20 + 16 || std::memcmp(Stream + 12, "ds64", 4) != 0 || Ds64Size < 24) {
+                            return WaveInvalid;
+                        }
+
+                        RiffSize = ReadUInt64(Stream + 20);
+                        DataSize64 = ReadUInt64(Stream + 28);
+                        Position = 20 + Ds64Size + (Ds64Size & 1);
+                    } else if (RiffSize == 0 || RiffSize == UnknownSize) {
+                        // Written to pipe, size of stream is known only from "data" chunk
+                        RiffSize = 0;
+                    }
+
+                    // "WAVE", "fmt " and "data" at least
+                    if (RiffSize != 0 && (RiffSize < 4 + 8 + 16 + 8 || RiffSize > UINTMAX_MAX - 8)) {
+                        return WaveInvalid;
+                    }
+
+                    Info.StreamSize = RiffSize != 0 ? RiffSize + 8 : 0;
+
+                    while (Position + 8 <= Available) {
+                        const char *Chunk = Stream + Position;
+                        uintmax_t ChunkSize = ReadUInt32(Chunk + 4);
+                        const uintmax_t Body = Position + 8;
+
+                        if (!IsFourCC(Chunk)) {
+                            return WaveInvalid;
+                        }
+
+                        if (std::memcmp(Chunk, "fmt ", 4) == 0) {
+                            if (ChunkSize < 16) {
+                                return WaveInvalid;
+                            }
+
+                            if (Body + 16 > Available) {
+                                return WaveIncomplete;
+                            }
+
+                            Info.AudioFormat = ReadUInt16(Chunk + 8);
+                            Info.NumChannels = ReadUInt16(Chunk + 10);
+                            Info.SampleRate = ReadUInt32(Chunk + 12);
+                            Info.ByteRate = ReadUInt32(Chunk + 16);
+                            Info.BlockAlign = ReadUInt16(Chunk + 20);
+                            Info.BitsPerSample = ReadUInt16(Chunk + 22);
+
+                            // WAVE_FORMAT_EXTENSIBLE: real format in first bytes of SubFormat GUID
+                            if (Info.AudioFormat == WaveFormatExtensible) {
+                                if (ChunkSize < 40) {
+                                    return WaveInvalid;
+                                }
+
+                                if (Body + 40 > Available) {
+                                    return WaveIncomplete;
+                                }
+
+                                Info.AudioFormat = ReadUInt16(Chunk + 8 + 24);
+                            }
+
+                            if (!CheckFormat(Info)) {
+                                return WaveInvalid;
+                            }
+
+                            HasFormat = true;
+                        } else if (std::memcmp(Chunk, "data", 4) == 0) {
+                            if (!HasFormat) {
+                                return WaveInvalid;
+                            }
+
+                            if (Is64 && ChunkSize == UnknownSize) {
+                                ChunkSize = DataSize64;
+                            }
+
+                            // Size of samples must be whole frames (unless it's unknown)
+                            if (ChunkSize == 0 || ChunkSize > UINTMAX_MAX - Body
+                                || (IsLinear(Info) && ChunkSize != UnknownSize && ChunkSize % Info.BlockAlign != 0)) {
+                                return WaveInvalid;
+                            }
+
+                            Info.DataOffset = Body;
+                            Info.DataSize = ChunkSize;
+
+                            if (Info.StreamSize < Body + ChunkSize) {
+                                Info.StreamSize = Body + ChunkSize;
+                            }
+
+                            return WaveComplete;
+                        }
+
+                        // Chunk before "data" can't be out of stream
+                        if (Info.StreamSize != 0 && (Body > Info.StreamSize || ChunkSize > Info.StreamSize - Body)) {
+                            return WaveInvalid;
+                        }
+
+                        // Chunks are word aligned
+                        Position = Body + ChunkSize + (ChunkSize & 1);
+                    }
+
+                    return HasFormat ? WaveIncomplete : WaveInvalid;
                 }
 
-                void FixRiffWaveHeader(RiffWaveHeader *RWHeader) {
-                    unsigned long ChunkSize = RWHeader->ChunkSize + 8;
-                    unsigned long SubChunkSize = RWHeader->Subchunk2Size + sizeof(RiffWaveHeader);
+                /*
+                 * Check chunks of stream found by scanner. If "data" chunk
+                 * is too far, stream is accepted by RIFF size.
+                 */
+                bool ParseRiffWaveHeader(const char *Buffer, uintmax_t Available, Types::StreamInfo &StreamInfo) {
+                    PcmDataInfo Info;
 
-                    if (ChunkSize < SubChunkSize) {
-                        RWHeader->ChunkSize = ChunkSize;
-                    } else {
-                        RWHeader->ChunkSize = SubChunkSize;
+                    switch (WalkRiffWave(Buffer, Available, Info)) {
+                    case WaveComplete:
+                        break;
+                    case WaveIncomplete:
+                        if (Info.StreamSize == 0) {
+                            return false;
+                        }
+
+                        break;
+                    default:
+                        return false;
+                    }
+
+                    StreamInfo.Size = Info.StreamSize;
+                    std::memcpy(StreamInfo.Header, Buffer, sizeof(RiffWaveHeader));
+                    return true;
+                }
+
+                /*
+                 * Find format and position of samples in whole stream.
+                 * Data size is clamped by the end of stream.
+                 */
+                bool LocatePcmData(const char *Stream, uintmax_t Size, PcmDataInfo &Info) {
+                    if (WalkRiffWave(Stream, Size, Info) != WaveComplete) {
+                        return false;
                     }
+
+                    Info.DataSize = std::min(Info.DataSize, Size - Info.DataOffset);
+                    return true;
                 }
 
-                void FixRiffWaveHeaderInFile(std::string FileName, RiffWaveHeader *RWHeader) {
-                    FixRiffWaveHeader(RWHeader);
-                    std::ofstream TempFile(FileName, std::fstream::binary | std::fstream::app);
-                    TempFile.write(reinterpret_cast<const char*>(RWHeader), sizeof(Engine::Formats::RiffWave::RiffWaveHeader));
-                    TempFile.close();
+                void RegisterSignatures(SignatureRegistry &Signatures) {
+                    Signatures.Add(RiffWaveSignature);
+                    Signatures.Add(Rf64Signature);
+                    Signatures.Add(Bw64Signature);
                 }
             }
         }
@@ -23,6 +23,10 @@
 #include <string>
 #include <cstring>
 #include <fstream>
+#include <algorithm>
+
+#include "Engine/Signatures.hpp"
+#include "Types/Types.hpp"
 
 namespace rz4 {
     namespace Engine {
@@ -31,24 +35,83 @@ namespace rz4 {
 #pragma pack(push, 1)
                 typedef struct RiffWaveHeader {
                     char ChunkId[4];
-                    unsigned long ChunkSize;
+                    uint32_t ChunkSize;
                     char Format[4];
                     char Subchunk1Id[4];
-                    unsigned long Subchunk1Size;
-                    unsigned short AudioFormat;
-                    unsigned short NumChannels;
-                    unsigned long SampleRate;
-                    unsigned long ByteRate;
-                    unsigned short BlockAlign;
-                    unsigned short BitsPerSample;
+                    uint32_t Subchunk1Size;
+                    uint16_t AudioFormat;
+                    uint16_t NumChannels;
+                    uint32_t SampleRate;
+                    uint32_t ByteRate;
+                    uint16_t BlockAlign;
+                    uint16_t BitsPerSample;
                     char Subchunk2Id[4];
-                    unsigned long Subchunk2Size;
+                    uint32_t Subchunk2Size;
                 } RiffWaveHeader;
 #pragma pack(pop)
 
-                bool IsRiffWaveHeader(const char *);
-                void FixRiffWaveHeader(RiffWaveHeader*);
-                void FixRiffWaveHeaderInFile(std::string, RiffWaveHeader*);
+                static_assert(sizeof(RiffWaveHeader) <= Types::StreamHeaderSize, "RIFF WAVE header doesn't fit into StreamInfo");
+
+                enum { WaveFormatPcm = 0x0001, WaveFormatIeeeFloat = 0x0003, WaveFormatExtensible = 0xFFFE };
+
+                // Result of walking chunks of stream
+                enum { WaveInvalid = 0, WaveComplete, WaveIncomplete };
+
+                // Parser looks at so many bytes (if they are available)
+                // to reach "data" chunk behind LIST / fact / bext etc.
+                const unsigned int LookAhead = 4096;
+
+                typedef struct PcmDataInfo {
+                    unsigned short AudioFormat;
+                    unsigned short NumChannels;
+                    unsigned short BitsPerSample;
+                    unsigned short BlockAlign;
+                    uint32_t SampleRate;
+                    uint32_t ByteRate;
+                    uintmax_t DataOffset;
+                    uintmax_t DataSize;
+                    uintmax_t StreamSize;
+                } PcmDataInfo;
+
+                int WalkRiffWave(const char *, uintmax_t, PcmDataInfo&);
+                bool ParseRiffWaveHeader(const char *, uintmax_t, Types::StreamInfo&);
+                bool LocatePcmData(const char *, uintmax_t, PcmDataInfo&);
+                void RegisterSignatures(SignatureRegistry&);
+
+                const Signature RiffWaveSignature = {
+                    Types::RiffWave,
+                    { 'R', 'I', 'F', 'F' },
+                    { 'W', 'A', 'V', 'E' },
+                    8,
+                    true,
+                    sizeof(RiffWaveHeader),
+                    LookAhead,
+                    ParseRiffWaveHeader
+                };
+
+                // RIFF WAVE over 4 Gb (EBU Tech 3306 / ITU-R BS.2088),
+                // real sizes are in "ds64" chunk
+                const Signature Rf64Signature = {
+                    Types::RiffWave,
+                    { 'R', 'F', '6', '4' },
+                    { 'W', 'A', 'V', 'E' },
+                    8,
+                    true,
+                    sizeof(RiffWaveHeader),
+                    LookAhead,
+                    ParseRiffWaveHeader
+                };
+
+                const Signature Bw64Signature = {
+                    Types::RiffWave,
+                    { 'B', 'W', '6', '4' },
+                    { 'W', 'A', 'V', 'E' },
+                    8,
+                    true,
+                    sizeof(RiffWaveHeader),
+                    LookAhead,
+                    ParseRiffWaveHeader
+                };
             }
         }
     }
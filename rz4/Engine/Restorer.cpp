@@ -0,0 +1,501 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Restorer.hpp"
+#include "stdafx.hpp"
+
+namespace rz4 {
+    namespace Engine {
+        namespace {
+            // Raw data is copied by pieces of this size,
+            // so large gaps are spread between workers too
+            const uintmax_t RawChunkSize = 8 * 1024 * 1024;
+            const uintmax_t EndOfChain = static_cast<uintmax_t>(-1);
+        }
+
+        Restorer::Restorer(Types::RestorerOptions Options) : Options(Options), Failed(false) {
+            FileSize = fs::file_size(Options.FileName);
+            File.open(Options.FileName.string(), std::fstream::binary);
+            BufferSize = Options.BufferSize;
+            Threads = Options.Threads;
+            CountOfStreams = 0;
+            DataEnd = FileSize;
+            std::memset(&Header, 0, sizeof(Types::RzfHeader));
+
+            if (Threads == 0) {
+                Threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+        }
+
+        Restorer::~Restorer() {
+            Close();
+        }
+
+        /*
+         * Read list of streams only, archive isn't restored.
+         */
+        bool Restorer::Open() {
+            if (!File.is_open()) {
+                SetError("Can't open input file!");
+                return false;
+            }
+
+            return ReadStreamList();
+        }
+
+        bool Restorer::Start() {
+            if (!Open()) {
+                return false;
+            }
+
+            // Preallocate output, so workers can write to any position
+            {
+                std::ofstream OutFile(Options.OutFile.string(), std::fstream::trunc | std::fstream::binary);
+
+                if (!OutFile.is_open()) {
+                    SetError("Can't create output file!");
+                    return false;
+                }
+            }
+
+            fs::resize_file(Options.OutFile, Header.OriginalSize);
+
+            // Biggest pieces first for better load balancing
+            std::stable_sort(Tasks.begin(), Tasks.end(), [](const RestoreTask &A, const RestoreTask &B) {
+                return A.OriginalSize > B.OriginalSize;
+            });
+
+            const unsigned int CountOfWorkers = static_cast<unsigned int>(std::min<uintmax_t>(Threads, Tasks.size()));
+            std::atomic<size_t> NextTask(0);
+            std::vector<std::thread> Workers;
+
+            for (unsigned int i = 0; i < CountOfWorkers; i++) {
+                Workers.emplace_back([&]() {
+                    std::ifstream WorkerFile(Options.FileName.string(), std::fstream::binary);
+                    std::fstream OutFile(Options.OutFile.string(), std::fstream::in | std::fstream::out | std::fstream::binary);
+                    std::vector<char> Buffer;
+                    size_t Task;
+
+                    if (!WorkerFile.is_open() || !OutFile.is_open()) {
+                        SetError("Can't open file for restore!");
+                        return;
+                    }
+
+                    while (!Failed && (Task = NextTask++) < Tasks.size()) {
+                        if (!RunTask(Tasks[Task], WorkerFile, OutFile, Buffer)) {
+                            return;
+                        }
+                    }
+                });
+            }
+
+            for (auto &Worker : Workers) {
+                Worker.join();
+            }
+
+            if (!Failed) {
+                if (Utils::CalculateCRC32InFile(Options.OutFile, 0, Header.OriginalSize, Threads) != Header.OriginalCRC32) {
+                    SetError("CRC32 of restored file mismatch!");
+                }
+            }
+
+            if (Failed) {
+                fs::remove(Options.OutFile);
+                return false;
+            }
+
+            return true;
+        }
+
+        /*
+         * Read list of compressed streams and split original file into
+         * tasks. Layout of archive: header, then raw data and compressed
+         * streams in original order (version 002, 003: then index and footer).
+         */
+        bool Restorer::ReadStreamList() {
+            if (FileSize < sizeof(Types::RzfHeader)) {
+                SetError("Input file is not rzf archive!");
+                return false;
+            }
+
+            File.read(reinterpret_cast<char*>(&Header), sizeof(Types::RzfHeader));
+
+            if (std::memcmp(Header.Signature, Types::RzfHeaderSignature, sizeof(Types::RzfHeaderSignature)) != 0) {
+                SetError("Input file is not rzf archive!");
+                return false;
+            }
+
+            uintmax_t Position = sizeof(Types::RzfHeader);
+            uintmax_t Original = 0;
+            bool Result;
+
+            if (std::memcmp(Header.Version, Types::RzfHeaderVersion, sizeof(Types::RzfHeaderVersion)) == 0
+                || std::memcmp(Header.Version, Types::RzfHeaderVersion002, sizeof(Types::RzfHeaderVersion002)) == 0) {
+                Result = ReadIndex(Position, Original);
+            } else if (std::memcmp(Header.Version, Types::RzfHeaderVersion001, sizeof(Types::RzfHeaderVersion001)) == 0) {
+                DataEnd = FileSize;
+                Result = ReadChain(Position, Original);
+            } else {
+                SetError("Unsupported version of rzf archive!");
+                return false;
+            }
+
+            if (!Result) {
+                return false;
+            }
+
+            if (Original > Header.OriginalSize || Header.OriginalSize - Original != DataEnd - Position) {
+                SetError("Archive is corrupted (bad size)!");
+                return false;
+            }
+
+            AddRawTasks(Position, Original, DataEnd - Position);
+            return true;
+        }
+
+        /*
+         * Version 001: walk the chain of compressed stream headers.
+         */
+        bool Restorer::ReadChain(uintmax_t &Position, uintmax_t &Original) {
+            Types::RzfCompressedStream CompressedStream;
+            uintmax_t Offset = Header.FirstCompressedStreamOffset;
+
+            while (Offset != EndOfChain) {
+                if (Offset < Position || sizeof(Types::RzfCompressedStream) > FileSize - Offset) {
+                    SetError("Archive is corrupted (bad stream offset)!");
+                    return false;
+                }
+
+                File.seekg(Offset, std::fstream::beg);
+                File.read(reinterpret_cast<char*>(&CompressedStream), sizeof(Types::RzfCompressedStream));
+
+                Types::RzfIndexEntry Entry;
+                Entry.Type = CompressedStream.Type;
+                Entry.Compressor = CompressedStream.Compressor;
+                Entry.CompressedOffset = Offset + sizeof(Types::RzfCompressedStream);
+                Entry.CompressedSize = CompressedStream.CompressedSize;
+                Entry.OriginalOffset = CompressedStream.OriginalOffset;
+                Entry.OriginalSize = CompressedStream.OriginalSize;
+                Entry.OriginalCRC32 = CompressedStream.OriginalCRC32;
+
+                if (!AddStream(Entry, Offset, Position, Original)) {
+                    return false;
+                }
+
+                Entries.push_back(Entry);
+                Offset = CompressedStream.NextCompressedStreamOffset;
+            }
+
+            return true;
+        }
+
+        /*
+         * Version 002, 003: read footer from the end of file, then index
+         * of streams right before it. Footer overrides header fields.
+         */
+        bool Restorer::ReadIndex(uintmax_t &Position, uintmax_t &Original) {
+            Types::RzfFooter Footer;
+
+            if (FileSize - Position < sizeof(Types::RzfFooter)) {
+                SetError("Archive is corrupted (no index)!");
+                return false;
+            }
+
+            File.seekg(FileSize - sizeof(Types::RzfFooter), std::fstream::beg);
+            File.read(reinterpret_cast<char*>(&Footer), sizeof(Types::RzfFooter));
+
+            const uintmax_t IndexEnd = FileSize - sizeof(Types::RzfFooter);
+
+            if (std::memcmp(Footer.Signature, Types::RzfFooterSignature, sizeof(Types::RzfFooterSignature)) != 0
+                || (Header.OriginalSize != 0 && Footer.OriginalSize != Header.OriginalSize)
+                || Footer.IndexOffset < Position
+                || Footer.IndexOffset > IndexEnd
+                || Footer.NumberOfStreams != (IndexEnd - Footer.IndexOffset) / sizeof(Types::RzfIndexEntry)
+                || (IndexEnd - Footer.IndexOffset) % sizeof(Types::RzfIndexEntry) != 0) {
+                SetError("Archive is corrupted (bad index)!");
+                return false;
+            }
+
+            std::vector<Types::RzfIndexEntry> Index(static_cast<size_t>(Footer.NumberOfStreams));
+            File.seekg(Footer.IndexOffset, std::fstream::beg);
+            File.read(reinterpret_cast<char*>(Index.data()), Index.size() * sizeof(Types::RzfIndexEntry));
+
+            if (Utils::UpdateCRC32(0, Index.data(), Index.size() * sizeof(Types::RzfIndexEntry)) != Footer.IndexCRC32) {
+                SetError("Archive is corrupted (bad index)!");
+                return false;
+            }
+
+            // Size in header is 0 if input was stdin
+            Header.OriginalSize = Footer.OriginalSize;
+            Header.NumberOfStreams = static_cast<uint32_t>(Footer.NumberOfStreams);
+            Header.OriginalCRC32 = Footer.OriginalCRC32;
+            DataEnd = Footer.IndexOffset;
+
+            const bool References = std::memcmp(Header.Version, Types::RzfHeaderVersion, sizeof(Types::RzfHeaderVersion)) == 0;
+
+            for (const auto &Entry : Index) {
+                if (References && (Entry.Compressor & Types::RzfReference) != 0) {
+                    if (!AddReference(Entry, Position, Original)) {
+                        return false;
+                    }
+                } else if (!AddStream(Entry, Entry.CompressedOffset, Position, Original)) {
+                    return false;
+                }
+            }
+
+            Entries.swap(Index);
+
+            return true;
+        }
+
+        /*
+         * Add task for compressed stream and tasks for raw data before it.
+         * Raw data ends at RawEnd in archive and must have the same size
+         * as gap between streams in original file.
+         */
+        bool Restorer::AddStream(const Types::RzfIndexEntry &Entry, uintmax_t RawEnd, uintmax_t &Position, uintmax_t &Original) {
+            if (RawEnd < Position
+                || Entry.CompressedOffset < RawEnd
+                || Entry.CompressedOffset > DataEnd
+                || Entry.OriginalOffset < Original
+                || Entry.OriginalOffset - Original != RawEnd - Position
+                || Entry.OriginalOffset > Header.OriginalSize
+                || Entry.OriginalSize > Header.OriginalSize - Entry.OriginalOffset
+                || Entry.CompressedSize > DataEnd - Entry.CompressedOffset) {
+                SetError("Archive is corrupted (bad stream header)!");
+                return false;
+            }
+
+            AddRawTasks(Position, Original, RawEnd - Position);
+
+            RestoreTask Task;
+            Task.Compressed = true;
+            Task.Compressor = Entry.Compressor;
+            Task.ArchiveOffset = Entry.CompressedOffset;
+            Task.ArchiveSize = Entry.CompressedSize;
+            Task.OriginalOffset = Entry.OriginalOffset;
+            Task.OriginalSize = Entry.OriginalSize;
+            Task.OriginalCRC32 = Entry.OriginalCRC32;
+            Tasks.push_back(Task);
+
+            // Blocks of data between streams aren't streams
+            if (Entry.Type != Types::GapData) {
+                CountOfStreams++;
+            }
+
+            Position = Entry.CompressedOffset + Entry.CompressedSize;
+            Original = Entry.OriginalOffset + Entry.OriginalSize;
+            return true;
+        }
+
+        /*
+         * Add task for copy of stream stored earlier in archive and tasks
+         * for raw data before it. Reference takes no place in archive,
+         * so raw data before it ends right where it started.
+         */
+        bool Restorer::AddReference(const Types::RzfIndexEntry &Entry, uintmax_t &Position, uintmax_t &Original) {
+            const unsigned short Compressor = Entry.Compressor & ~Types::RzfReference;
+
+            if (Entry.OriginalOffset < Original
+                || Entry.OriginalOffset > Header.OriginalSize
+                || Entry.OriginalSize > Header.OriginalSize - Entry.OriginalOffset
+                || Entry.OriginalOffset - Original > DataEnd - Position) {
+                SetError("Archive is corrupted (bad stream header)!");
+                return false;
+            }
+
+            const uintmax_t RawEnd = Position + (Entry.OriginalOffset - Original);
+
+            // Data of the first copy must be restored already by this point
+            if (Entry.CompressedOffset < sizeof(Types::RzfHeader)
+                || Entry.CompressedOffset > RawEnd
+                || Entry.CompressedSize > RawEnd - Entry.CompressedOffset
+                || (Compressor == 0 && Entry.CompressedSize != Entry.OriginalSize)) {
+                SetError("Archive is corrupted (bad stream reference)!");
+                return false;
+            }
+
+            AddRawTasks(Position, Original, RawEnd - Position);
+
+            if (Compressor == 0) {
+                AddRawTasks(Entry.CompressedOffset, Entry.OriginalOffset, Entry.OriginalSize);
+            } else {
+                RestoreTask Task;
+                Task.Compressed = true;
+                Task.Compressor = Compressor;
+                Task.ArchiveOffset = Entry.CompressedOffset;
+                Task.ArchiveSize = Entry.CompressedSize;
+                Task.OriginalOffset = Entry.OriginalOffset;
+                Task.OriginalSize = Entry.OriginalSize;
+                Task.OriginalCRC32 = Entry.OriginalCRC32;
+                Tasks.push_back(Task);
+            }
+
+            CountOfStreams++;
+            Position = RawEnd;
+            Original = Entry.OriginalOffset + Entry.OriginalSize;
+            return true;
+        }
+
+        void Restorer::AddRawTasks(uintmax_t ArchiveOffset, uintmax_t OriginalOffset, uintmax_t Size) {
+            for (uintmax_t Done = 0; Done < Size; Done += RawChunkSize) {
+                RestoreTask Task;
+                Task.Compressed = false;
+                Task.Compressor = 0;
+                Task.ArchiveOffset = ArchiveOffset + Done;
+                Task.ArchiveSize = std::min(RawChunkSize, Size - Done);
+                Task.OriginalOffset = OriginalOffset + Done;
+                Task.OriginalSize = Task.ArchiveSize;
+                Task.OriginalCRC32 = 0;
+                Tasks.push_back(Task);
+            }
+        }
+
+        bool Restorer::RunTask(const RestoreTask &Task, std::ifstream &Src, std::fstream &Dst, std::vector<char> &Buffer) {
+            uintmax_t Offset = Task.OriginalOffset;
+
+            if (Task.Compressed) {
+                if (!DecodeStream(Task, Src, Buffer)) {
+                    return false;
+                }
+
+                if (Buffer.size() != Task.OriginalSize
+                    || Utils::UpdateCRC32(0, Buffer.data(), Buffer.size()) != Task.OriginalCRC32) {
+                    SetError(boost::str(boost::format("CRC32 of stream @ 0x%016X mismatch!") % Task.OriginalOffset));
+                    return false;
+                }
+
+                Utils::AddStat(Utils::StatStreamsDecoded, 1);
+            } else {
+                // Raw data isn't looked at, so let kernel copy it
+                const uintmax_t Copied = Utils::KernelCopy(Options.FileName, Task.ArchiveOffset,
+                    Options.OutFile, Task.OriginalOffset, Task.ArchiveSize);
+
+                if (Copied == Task.ArchiveSize) {
+                    Utils::AddStat(Utils::StatRestoreBytesRead, Task.ArchiveSize);
+                    Utils::AddStat(Utils::StatRestoreBytesWritten, Task.ArchiveSize);
+                    return true;
+                }
+
+                Buffer.resize(static_cast<size_t>(Task.ArchiveSize - Copied));
+
+                if (Utils::OpenRangeReader(Options.FileName, Task.ArchiveOffset + Copied, Buffer.size(), BufferSize)
+                    ->Read(Buffer.data(), Buffer.size()) != Buffer.size()) {
+                    SetError("Unexpected end of archive!");
+                    return false;
+                }
+
+                Offset += Copied;
+            }
+
+            Dst.seekp(Offset, std::fstream::beg);
+            Dst.write(Buffer.data(), Buffer.size());
+
+            if (!Dst.good()) {
+                SetError("Can't write to output file!");
+                return false;
+            }
+
+            Utils::AddStat(Utils::StatRestoreBytesRead, Task.ArchiveSize);
+            Utils::AddStat(Utils::StatRestoreBytesWritten, Offset - Task.OriginalOffset + Buffer.size());
+            return true;
+        }
+
+        bool Restorer::DecodeStream(const RestoreTask &Task, std::ifstream &Src, std::vector<char> &Buffer) {
+            switch (Task.Compressor) {
+            case Types::PcmCompressor:
+            case Types::LzCompressor: {
+                std::vector<char> Payload(static_cast<size_t>(Task.ArchiveSize));
+                const size_t Read = Utils::OpenRangeReader(Options.FileName, Task.ArchiveOffset, Payload.size(), BufferSize)
+                    ->Read(Payload.data(), Payload.size());
+
+                const bool Decoded = Read == Payload.size()
+                    && (Task.Compressor == Types::PcmCompressor
+                        ? Codecs::Pcm::Decode(Payload.data(), Payload.size(), Buffer)
+                        : Codecs::Lz::Decode(Payload.data(), Payload.size(), Buffer));
+
+                if (!Decoded) {
+                    SetError(boost::str(boost::format("Can't decode stream @ 0x%016X!") % Task.OriginalOffset));
+                    return false;
+                }
+
+                return true;
+            }
+            case Types::TakCompressor:
+            case Types::WavPackCompressor:
+                return ExternalDecode(Task, Src, Buffer);
+            default:
+                SetError(boost::str(boost::format("Unknown compressor of stream @ 0x%016X!") % Task.OriginalOffset));
+                return false;
+            }
+        }
+
+        bool Restorer::ExternalDecode(const RestoreTask &Task, std::ifstream &Src, std::vector<char> &Buffer) {
+            bool Result = Task.Compressor == Types::TakCompressor
+                ? Codecs::External::TakDecode(Src, Task.ArchiveOffset, Task.ArchiveSize, Buffer)
+                : Codecs::External::WavpackDecode(Src, Task.ArchiveOffset, Task.ArchiveSize, Buffer);
+
+            if (!Result) {
+                SetError(boost::str(boost::format("Can't decode stream @ 0x%016X!") % Task.OriginalOffset));
+            }
+
+            return Result;
+        }
+
+        void Restorer::SetError(const std::string &Message) {
+            std::lock_guard<std::mutex> Lock(Mutex);
+
+            // Keep first error only
+            if (!Failed) {
+                Error = Message;
+                Failed = true;
+            }
+        }
+
+        std::string Restorer::GetError() {
+            std::lock_guard<std::mutex> Lock(Mutex);
+            return Error;
+        }
+
+        unsigned long Restorer::GetCountOfStreams() {
+            return CountOfStreams;
+        }
+
+        uintmax_t Restorer::GetOriginalSize() {
+            return Header.OriginalSize;
+        }
+
+        uint32_t Restorer::GetOriginalCRC32() {
+            return Header.OriginalCRC32;
+        }
+
+        /*
+         * Index entries of archive in original order (version 001 too).
+         */
+        const std::vector<Types::RzfIndexEntry> &Restorer::GetIndex() {
+            return Entries;
+        }
+
+        void Restorer::Close() {
+            if (File.is_open()) {
+                File.close();
+            }
+        }
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RZ4_RESTORER_HPP
+#define RZ4_RESTORER_HPP
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <boost/filesystem.hpp>
+
+#include "Engine/Codecs/Pcm.hpp"
+#include "Engine/Codecs/Lz.hpp"
+#include "Engine/Codecs/External.hpp"
+#include "Types/Types.hpp"
+#include "Utils/Utils.hpp"
+
+namespace rz4 {
+    namespace Engine {
+        namespace fs = boost::filesystem;
+
+        /*
+         * Piece of original file: compressed stream
+         * or part of raw data between streams.
+         */
+        typedef struct RestoreTask {
+            bool Compressed;
+            unsigned short Compressor;
+            uintmax_t ArchiveOffset;
+            uintmax_t ArchiveSize;
+            uintmax_t OriginalOffset;
+            uintmax_t OriginalSize;
+            uint32_t OriginalCRC32;
+        } RestoreTask;
+
+        class Restorer {
+        private:
+            std::ifstream File;
+            Types::RestorerOptions Options;
+            Types::RzfHeader Header;
+            unsigned int BufferSize;
+            unsigned int Threads;
+            uintmax_t FileSize;
+            uintmax_t DataEnd;
+            unsigned long CountOfStreams;
+            std::vector<RestoreTask> Tasks;
+            std::vector<Types::RzfIndexEntry> Entries;
+            std::atomic<bool> Failed;
+            std::mutex Mutex;
+            std::string Error;
+
+        public:
+            explicit Restorer(Types::RestorerOptions);
+            ~Restorer();
+
+            bool Open();
+            bool Start();
+            void Close();
+            std::string GetError();
+            unsigned long GetCountOfStreams();
+            uintmax_t GetOriginalSize();
+            uint32_t GetOriginalCRC32();
+            const std::vector<Types::RzfIndexEntry> &GetIndex();
+
+            bool ReadStreamList();
+            bool ReadChain(uintmax_t&, uintmax_t&);
+            bool ReadIndex(uintmax_t&, uintmax_t&);
+            bool AddStream(const Types::RzfIndexEntry&, uintmax_t, uintmax_t&, uintmax_t&);
+            bool AddReference(const Types::RzfIndexEntry&, uintmax_t&, uintmax_t&);
+            void AddRawTasks(uintmax_t, uintmax_t, uintmax_t);
+            bool RunTask(const RestoreTask&, std::ifstream&, std::fstream&, std::vector<char>&);
+            bool DecodeStream(const RestoreTask&, std::ifstream&, std::vector<char>&);
+            bool ExternalDecode(const RestoreTask&, std::ifstream&, std::vector<char>&);
+            void SetError(const std::string&);
+        };
+    }
+}
+
+
+#endif //RZ4_RESTORER_HPP
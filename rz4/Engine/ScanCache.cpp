@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ScanCache.hpp"
+#include "stdafx.hpp"
+
+#include <fstream>
+#include <vector>
+
+#include "Utils/Utils.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace rz4 {
+    namespace Engine {
+        namespace ScanCache {
+            namespace {
+                /*
+                 * Identity of input: everything which is cheap to get and
+                 * changes when file is replaced or rewritten in place.
+                 */
+                bool MakeHeader(const Types::ScannerOptions &Options, CacheHeader &Header) {
+                    const fs::path &FileName = Options.FileName;
+                    boost::system::error_code Error;
+
+                    std::memset(&Header, 0, sizeof(CacheHeader));
+                    std::memcpy(Header.Signature, Signature, sizeof(Signature));
+                    Header.Version = Version;
+                    Header.FileSize = fs::file_size(FileName, Error);
+                    Header.ModifyTime = static_cast<int64_t>(fs::last_write_time(FileName, Error));
+                    Header.DetectFlags = Options.EnableRiffWave ? 1 : 0;
+
+                    if (Error) {
+                        return false;
+                    }
+
+#if defined(_WIN32)
+                    HANDLE File = CreateFileW(FileName.wstring().c_str(), 0,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, 0, nullptr);
+                    BY_HANDLE_FILE_INFORMATION Info;
+
+                    if (File != INVALID_HANDLE_VALUE) {
+                        if (GetFileInformationByHandle(File, &Info)) {
+                            Header.Device = Info.dwVolumeSerialNumber;
+                            Header.Inode = (static_cast<uint64_t>(Info.nFileIndexHigh) << 32) | Info.nFileIndexLow;
+                        }
+
+                        CloseHandle(File);
+                    }
+#else
+                    struct stat Info;
+
+                    if (stat(FileName.string().c_str(), &Info) == 0) {
+                        Header.Device = static_cast<uint64_t>(Info.st_dev);
+                        Header.Inode = static_cast<uint64_t>(Info.st_ino);
+                    }
+#endif
+
+                    // First, last and evenly spaced blocks between them
+                    std::ifstream File(FileName.string(), std::fstream::binary);
+                    std::vector<char> Samples;
+
+                    if (!File.is_open()) {
+                        return false;
+                    }
+
+                    if (Header.FileSize <= static_cast<uint64_t>(CountOfSamples) * SampleSize) {
+                        Samples.resize(static_cast<size_t>(Header.FileSize));
+                        File.read(Samples.data(), Samples.size());
+                    } else {
+                        const uint64_t Step = (Header.FileSize - SampleSize) / (CountOfSamples - 1);
+                        Samples.resize(static_cast<size_t>(CountOfSamples) * SampleSize);
+
+                        for (unsigned int i = 0; i < CountOfSamples; i++) {
+                            File.seekg(i * Step, std::fstream::beg);
+                            File.read(Samples.data() + i * SampleSize, SampleSize);
+                        }
+                    }
+
+                    if (!File) {
+                        return false;
+                    }
+
+                    const Utils::Hash128 Hash = Utils::CalculateHash128(Samples.data(), Samples.size());
+                    Header.SampleHashLow = Hash.Low;
+                    Header.SampleHashHigh = Hash.High;
+                    return true;
+                }
+            }
+
+            fs::path GetPath(const fs::path &FileName) {
+                return FileName.string() + Ext;
+            }
+
+            /*
+             * Fill Catalog from cache of input. Returns false if there is
+             * no cache, it's broken or input was changed since it was made.
+             */
+            bool Load(const fs::path &CacheFile, const Types::ScannerOptions &Options, StreamCatalog &Catalog) {
+                std::ifstream File(CacheFile.string(), std::fstream::binary);
+                CacheHeader Expected, Header;
+
+                if (!File.is_open() || !MakeHeader(Options, Expected)) {
+                    return false;
+                }
+
+                File.read(reinterpret_cast<char*>(&Header), sizeof(CacheHeader));
+
+                if (!File || std::memcmp(&Header, &Expected, sizeof(CacheHeader) - sizeof(Header.NumberOfStreams)) != 0) {
+                    return false;
+                }
+
+                // Count of entries must match size of file: entries and CRC32 of all above
+                const uintmax_t Size = fs::file_size(CacheFile);
+
+                if (Size < sizeof(CacheHeader) + sizeof(uint32_t)
+                    || Header.NumberOfStreams != (Size - sizeof(CacheHeader) - sizeof(uint32_t)) / sizeof(CacheEntry)
+                    || (Size - sizeof(CacheHeader) - sizeof(uint32_t)) % sizeof(CacheEntry) != 0) {
+                    return false;
+                }
+
+                std::vector<CacheEntry> Entries(static_cast<size_t>(Header.NumberOfStreams));
+                uint32_t CRC32;
+                File.read(reinterpret_cast<char*>(Entries.data()), Entries.size() * sizeof(CacheEntry));
+                File.read(reinterpret_cast<char*>(&CRC32), sizeof(CRC32));
+
+                if (!File || Utils::UpdateCRC32(Utils::UpdateCRC32(0, &Header, sizeof(CacheHeader)),
+                    Entries.data(), Entries.size() * sizeof(CacheEntry)) != CRC32) {
+                    return false;
+                }
+
+                Catalog.Clear();
+                Catalog.Reserve(Entries.size());
+
+                for (const auto &Entry : Entries) {
+                    if (Entry.Offset > Header.FileSize || Entry.Size > Header.FileSize - Entry.Offset) {
+                        Catalog.Clear();
+                        return false;
+                    }
+
+                    Types::StreamInfo Stream;
+                    Stream.Offset = Entry.Offset;
+                    Stream.Size = Entry.Size;
+                    Stream.Type = Entry.Type;
+                    std::memcpy(Stream.Header, Entry.Header, Types::StreamHeaderSize);
+                    Catalog.Add(Stream);
+                }
+
+                return true;
+            }
+
+            /*
+             * Write cache next to input, it's replaced atomically by rename,
+             * so reader never sees half-written file.
+             */
+            bool Save(const fs::path &CacheFile, const Types::ScannerOptions &Options, const StreamCatalog &Catalog) {
+                CacheHeader Header;
+
+                if (!MakeHeader(Options, Header)) {
+                    return false;
+                }
+
+                std::vector<CacheEntry> Entries(Catalog.Size());
+                Header.NumberOfStreams = Entries.size();
+
+                for (size_t i = 0; i < Catalog.Size(); i++) {
+                    Entries[i].Offset = Catalog.GetOffset(i);
+                    Entries[i].Size = Catalog.GetSize(i);
+                    Entries[i].Type = Catalog.GetType(i);
+                    std::memcpy(Entries[i].Header, Catalog.GetHeader(i), Types::StreamHeaderSize);
+                }
+
+                uint32_t CRC32 = Utils::UpdateCRC32(0, &Header, sizeof(CacheHeader));
+                CRC32 = Utils::UpdateCRC32(CRC32, Entries.data(), Entries.size() * sizeof(CacheEntry));
+
+                const fs::path TmpFile = CacheFile.string() + ".tmp";
+                boost::system::error_code Error;
+
+                {
+                    std::ofstream File(TmpFile.string(), std::fstream::trunc | std::fstream::binary);
+                    File.write(reinterpret_cast<const char*>(&Header), sizeof(CacheHeader));
+                    File.write(reinterpret_cast<const char*>(Entries.data()), Entries.size() * sizeof(CacheEntry));
+                    File.write(reinterpret_cast<const char*>(&CRC32), sizeof(CRC32));
+
+                    if (!File) {
+                        File.close();
+                        fs::remove(TmpFile, Error);
+                        return false;
+                    }
+                }
+
+                fs::rename(TmpFile, CacheFile, Error);
+
+                if (Error) {
+                    fs::remove(TmpFile, Error);
+                    return false;
+                }
+
+                return true;
+            }
+        }
+    }
+}
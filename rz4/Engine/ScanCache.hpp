@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RZ4_SCAN_CACHE_HPP
+#define RZ4_SCAN_CACHE_HPP
+
+#include <cstdint>
+#include <boost/filesystem.hpp>
+
+#include "Engine/StreamCatalog.hpp"
+#include "Types/Types.hpp"
+
+namespace rz4 {
+    namespace Engine {
+        namespace fs = boost::filesystem;
+
+        /*
+         * Sidecar file with streams found in input, so next commands
+         * on the same file don't scan it again. Cache is valid while size,
+         * modification time, file id and hash of sampled blocks of input
+         * are the same and it was made with the same detect options.
+         */
+        namespace ScanCache {
+            const char Signature[4] = { 'R', 'Z', '4', 'S' };
+            const uint32_t Version = 3;
+            const char Ext[] = ".rz4scan";
+
+            // Blocks of input which are hashed for identity
+            const unsigned int CountOfSamples = 16;
+            const unsigned int SampleSize = 4096;
+
+#pragma pack(push, 1)
+            typedef struct CacheHeader {
+                char Signature[4];
+                uint32_t Version;
+                uint64_t FileSize;
+                int64_t ModifyTime;
+                uint64_t Device;
+                uint64_t Inode;
+                uint64_t SampleHashLow;
+                uint64_t SampleHashHigh;
+                uint32_t DetectFlags;
+                uint64_t NumberOfStreams;
+            } CacheHeader;
+
+            typedef struct CacheEntry {
+                uint64_t Offset;
+                uint64_t Size;
+                uint16_t Type;
+                char Header[Types::StreamHeaderSize];
+            } CacheEntry;
+#pragma pack(pop)
+
+            fs::path GetPath(const fs::path&);
+            bool Load(const fs::path&, const Types::ScannerOptions&, StreamCatalog&);
+            bool Save(const fs::path&, const Types::ScannerOptions&, const StreamCatalog&);
+        }
+    }
+}
+
+#endif //RZ4_SCAN_CACHE_HPP
@@ -20,133 +20,307 @@
 #include "Scanner.hpp"
 #include "stdafx.hpp"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
 namespace rz4 {
     namespace Engine {
         Scanner::Scanner(rz4::Types::ScannerOptions Options) : Options(Options) {
-            FileSize = fs::file_size(Options.FileName);
-            File.open(Options.FileName.string(), std::fstream::binary);
+            Streaming = Utils::IsStdStream(Options.FileName);
+            FileSize = 0;
             BufferSize = Options.BufferSize;
+            Threads = Options.Threads;
             TotalSize = 0;
 
-            if (FileSize < BufferSize) {
+            if (!Streaming) {
+                FileSize = fs::file_size(Options.FileName);
+                File.open(Options.FileName.string(), std::fstream::binary);
+                Signatures.SetInputSize(FileSize);
+            }
+
+            if (!Streaming && FileSize < BufferSize) {
                 BufferSize = static_cast<unsigned int>(FileSize);
             }
+
+            if (Threads == 0) {
+                Threads = std::max(std::thread::hardware_concurrency(), 1u);
+            }
+
+            if (Options.EnableRiffWave) {
+                Engine::Formats::RiffWave::RegisterSignatures(Signatures);
+            }
         }
 
         Scanner::~Scanner() {
-            StreamList.clear();
+            Streams.Clear();
             Close();
         }
 
         bool Scanner::Start(Types::ScannerCallbackHandle &Callback) {            
-            if (!File.is_open()) {
+            if (!Streaming && !File.is_open()) {
                 return false;
             }
 
-            uintmax_t ReadBytes = 0;
-            char *Buffer = new char[BufferSize];
+            if (Signatures.Empty()) {
+                return true;
+            }
 
-            while (ReadBytes < FileSize) {
-                if ((ReadBytes + BufferSize) > FileSize) {
-                    BufferSize = static_cast<unsigned int>(FileSize - ReadBytes);
-                    delete[] Buffer;
-                    Buffer = new char[BufferSize];
-                }
+            if (Streaming) {
+                ScanStream(std::cin, Streams, Callback);
+                TotalSize = Streams.GetTotalSize();
+                return true;
+            }
 
-                File.read(Buffer, BufferSize);
+            // Cache keeps streams of the whole file only
+            const uintmax_t Begin = std::min(Options.Begin, FileSize);
+            const bool UseCache = !Options.CacheFile.empty() && Begin == 0;
 
-                if (Options.EnableRiffWave) {
-                    RiffWaveMatch(Buffer, ReadBytes, Callback);
+            // Not worth to spawn threads for a single buffer
+            bool Parallel = Threads > 1 && FileSize - Begin > BufferSize;
+
+            // Input wasn't changed since the last scan
+            if (UseCache && ScanCache::Load(Options.CacheFile, Options, Streams)) {
+                TotalSize = Streams.GetTotalSize();
+                Utils::AddStat(Utils::StatScanCacheHits, 1);
+
+                for (size_t i = 0; Callback != nullptr && i < Streams.Size(); i++) {
+                    Types::StreamInfo Stream = Streams.Get(i);
+                    Callback(&Stream);
                 }
 
-                ReadBytes += BufferSize;
+                return true;
+            }
+
+            if (Options.MemoryMap) {
+                MapFile();
+            }
+
+            if (Parallel) {
+                ParallelScan();
+            } else if (Mapping.is_open()) {
+                ScanMappedRange(Begin, FileSize, Streams, Callback);
+            } else {
+                ScanRange(Begin, FileSize, Streams, Callback);
             }
 
             // Sort all found positions
             // For fast copy non-compressed data
-            StreamList.sort([](const Types::StreamInfo &F, const Types::StreamInfo &S) {
-                return F.Offset < S.Offset;
-            });
+            Streams.Sort();
+            TotalSize = Streams.GetTotalSize();
+
+            // Workers don't report streams, do it here in offset order
+            if (Parallel && Callback != nullptr) {
+                for (size_t i = 0; i < Streams.Size(); i++) {
+                    Types::StreamInfo Stream = Streams.Get(i);
+                    Callback(&Stream);
+                }
+            }
+
+            if (UseCache) {
+                ScanCache::Save(Options.CacheFile, Options, Streams);
+            }
 
-            delete[] Buffer;
             return true;
         }
 
-        void Scanner::Close() {
-            if (File.is_open()) {
-                File.close();
+        /*
+         * Scan [Begin, End) of the file by BufferSize blocks.
+         * Each block is read with a tail of (max header size - 1) bytes,
+         * so headers which cross the end of the block still can be checked
+         * without seeking back. Only candidates which start inside of the
+         * block are accepted, thus adjacent ranges never report the same stream.
+         */
+        void Scanner::ScanRange(
+            uintmax_t Begin,
+            uintmax_t End,
+            StreamCatalog &Catalog,
+            Types::ScannerCallbackHandle &Callback) {
+            const unsigned int Overlap = Signatures.GetLookAhead() - 1;
+            const uintmax_t ReadEnd = std::min<uintmax_t>(End + Overlap, FileSize);
+            std::unique_ptr<Utils::RangeReader> Reader = Utils::OpenRangeReader(Options.FileName, Begin, ReadEnd - Begin, BufferSize);
+            std::vector<char> Buffer(BufferSize + Overlap);
+            unsigned int Available = 0;
+            uintmax_t Position = Begin;
+            Utils::AllocBufferStat(Buffer.size());
+
+            // Input is read once, overlap with next block is kept in buffer
+            while (Position < End) {
+                unsigned int Length = static_cast<unsigned int>(std::min<uintmax_t>(BufferSize, End - Position));
+                const unsigned int Wanted = static_cast<unsigned int>(std::min<uintmax_t>(Length + Overlap, ReadEnd - Position));
+
+                if (Available < Wanted) {
+                    const size_t Read = Reader->Read(Buffer.data() + Available, Wanted - Available);
+                    Available += static_cast<unsigned int>(Read);
+                    Utils::AddStat(Utils::StatScanBytesRead, Read);
+                }
+
+                // File was cut while it's scanned
+                if (Available < Wanted) {
+                    Length = std::min(Length, Available);
+
+                    if (Length == 0) {
+                        break;
+                    }
+                }
+
+                Signatures.Match(Buffer.data(), Length, Available, Position, Catalog, Callback);
+
+                std::memmove(Buffer.data(), Buffer.data() + Length, Available - Length);
+                Available -= Length;
+                Position += Length;
             }
+
+            Utils::FreeBufferStat(Buffer.size());
         }
 
-        std::list<Types::StreamInfo> *Scanner::GetListOfFoundStreams() {
-            return &StreamList;
+        /*
+         * Same as ScanRange, but for input which can't be seeked (stdin).
+         * Tail of each block is moved to the start of buffer and scanned
+         * with next block, so memory doesn't depend on size of input.
+         */
+        void Scanner::ScanStream(
+            std::istream &Stream,
+            StreamCatalog &Catalog,
+            Types::ScannerCallbackHandle &Callback) {
+            const unsigned int Overlap = Signatures.GetLookAhead() - 1;
+            std::vector<char> Buffer(BufferSize + Overlap);
+            unsigned int Available = 0;
+            uintmax_t Position = 0;
+            bool Eof = false;
+            Utils::AllocBufferStat(Buffer.size());
+
+            while (!Eof) {
+                Stream.read(Buffer.data() + Available, Buffer.size() - Available);
+                Available += static_cast<unsigned int>(Stream.gcount());
+                Eof = Available < Buffer.size();
+                Utils::AddStat(Utils::StatScanBytesRead, static_cast<uintmax_t>(Stream.gcount()));
+
+                unsigned int Length = Eof ? Available : BufferSize;
+
+                // End of input is known only with the last block
+                if (Eof) {
+                    Signatures.SetInputSize(Position + Available);
+                }
+
+                Signatures.Match(Buffer.data(), Length, Available, Position, Catalog, Callback);
+
+                std::memmove(Buffer.data(), Buffer.data() + Length, Available - Length);
+                Available -= Length;
+                Position += Length;
+            }
+
+            FileSize = Position;
+
+            // Streams of previous blocks could be cut by the end of input too
+            Catalog.Clamp(FileSize);
+            Utils::FreeBufferStat(Buffer.size());
         }
 
-        uintmax_t Scanner::GetSizeOfFoundStreams() {
-            return TotalSize;
+        /*
+         * Map the whole input file into memory.
+         * If mapping is not possible (e.g. not enough address space
+         * on 32-bit builds) - scanner falls back to buffered reads.
+         */
+        bool Scanner::MapFile() {
+            try {
+                Mapping.open(Options.FileName.string());
+            } catch (const std::exception &) {
+                return false;
+            }
+
+#if defined(__unix__) || defined(__APPLE__)
+            posix_madvise(const_cast<char*>(Mapping.data()), Mapping.size(), POSIX_MADV_SEQUENTIAL);
+#endif
+
+            return Mapping.is_open();
         }
 
-        unsigned long Scanner::GetCountOfFoundStreams() {
-            return static_cast<unsigned long>(StreamList.size());
+        /*
+         * Same as ScanRange, but matchers read headers straight from the mapping,
+         * so there are no reads, copies or seeks at all.
+         */
+        void Scanner::ScanMappedRange(
+            uintmax_t Begin,
+            uintmax_t End,
+            StreamCatalog &Catalog,
+            Types::ScannerCallbackHandle &Callback) {
+            const unsigned int Overlap = Signatures.GetLookAhead() - 1;
+            const char *Data = Mapping.data();
+            uintmax_t Position = Begin;
+
+            while (Position < End) {
+                unsigned int Length = static_cast<unsigned int>(std::min<uintmax_t>(BufferSize, End - Position));
+                unsigned int Available = static_cast<unsigned int>(std::min<uintmax_t>(Length + Overlap, FileSize - Position));
+
+                Signatures.Match(Data + Position, Length, Available, Position, Catalog, Callback);
+                Utils::AddStat(Utils::StatScanBytesRead, Length);
+
+                Position += Length;
+            }
         }
 
-        // Scanners
-        void Scanner::RiffWaveMatch(const char *Buffer, uintmax_t CurrentOffset, Types::ScannerCallbackHandle &Callback) {
-            Engine::Formats::RiffWave::RiffWaveHeader *RiffWaveHeader;
-            const unsigned int HeaderBufferSize = sizeof(Engine::Formats::RiffWave::RiffWaveHeader);
-            char *HeaderBuffer = new char[HeaderBufferSize];
-            bool ChangedPosition = false;
-            Types::StreamInfo StreamInfo;
-
-            int Index = Utils::CharMatch(Buffer, BufferSize, 'R');
-            
-            while (Index != -1 && static_cast<unsigned int>(Index) <= BufferSize) {
-                if (Index + HeaderBufferSize <= BufferSize) {
-                    std::memcpy(HeaderBuffer, Buffer + Index, HeaderBufferSize);
-                } else {
-                    File.seekg(CurrentOffset + Index, std::fstream::beg);
-                    File.read(HeaderBuffer, HeaderBufferSize);
-                    ChangedPosition = true;
-                }     
-
-                if (Engine::Formats::RiffWave::IsRiffWaveHeader(HeaderBuffer)) {
-                    RiffWaveHeader = reinterpret_cast<Engine::Formats::RiffWave::RiffWaveHeader*>(HeaderBuffer);
-                    
-                    StreamInfo.FileType = Types::StreamTypes[Types::RiffWave];
-                    StreamInfo.Ext = Types::StreamExts[Types::RiffWave];
-                    StreamInfo.Type = Types::RiffWave;
-                    // Fixed: get valid size of RIFF WAVE stream
-                    /*unsigned long ChunkSize = RiffWaveHeader->ChunkSize + 8;
-                    unsigned long SubChunkSize = RiffWaveHeader->Subchunk2Size
-                        + sizeof(Engine::Formats::RiffWave::RiffWaveHeader);
-                    
-                    if (ChunkSize < SubChunkSize) {
-                        StreamInfo.Size = ChunkSize;
-                    } else {
-                        StreamInfo.Size = SubChunkSize;
-                    }*/
-
-                    StreamInfo.Size = RiffWaveHeader->ChunkSize + 8;
-                    StreamInfo.Offset = CurrentOffset + Index;
-                    StreamInfo.Data = new Engine::Formats::RiffWave::RiffWaveHeader;
-                    std::memcpy(StreamInfo.Data, RiffWaveHeader, sizeof(Engine::Formats::RiffWave::RiffWaveHeader));
-                    
-                    StreamList.push_back(StreamInfo);
-
-                    TotalSize += StreamInfo.Size;
-
-                    if (Callback != nullptr) {
-                        Callback(&StreamInfo);
+        /*
+         * Split the file into chunks and scan them on `Threads` workers.
+         * Every chunk is read by own reader, every worker has own catalog,
+         * catalogs are merged into Streams when all workers are done.
+         */
+        void Scanner::ParallelScan() {
+            // Several chunks per thread for better load balancing,
+            // but not less than one buffer per chunk
+            const uintmax_t Begin = std::min(Options.Begin, FileSize);
+            const uintmax_t ChunkSize = std::max<uintmax_t>(BufferSize, (FileSize - Begin + Threads * 4 - 1) / (Threads * 4));
+            const uintmax_t CountOfChunks = (FileSize - Begin + ChunkSize - 1) / ChunkSize;
+            const unsigned int CountOfWorkers = static_cast<unsigned int>(std::min<uintmax_t>(Threads, CountOfChunks));
+
+            std::atomic<uintmax_t> NextChunk(0);
+            std::vector<StreamCatalog> Catalogs(CountOfWorkers);
+            std::vector<std::thread> Workers;
+
+            for (unsigned int i = 0; i < CountOfWorkers; i++) {
+                Workers.emplace_back([&, i]() {
+                    uintmax_t Chunk;
+
+                    while ((Chunk = NextChunk++) < CountOfChunks) {
+                        uintmax_t First = Begin + Chunk * ChunkSize;
+                        uintmax_t End = std::min(First + ChunkSize, FileSize);
+
+                        if (Mapping.is_open()) {
+                            ScanMappedRange(First, End, Catalogs[i], nullptr);
+                        } else {
+                            ScanRange(First, End, Catalogs[i], nullptr);
+                        }
                     }
-                }
+                });
+            }
+
+            for (auto &Worker : Workers) {
+                Worker.join();
+            }
 
-                Index = Utils::CharMatch(Buffer, BufferSize, 'R', static_cast<unsigned int>(Index + 1));
+            Streams.Merge(Catalogs);
+        }
+
+        void Scanner::Close() {
+            if (File.is_open()) {
+                File.close();
             }
 
-            delete[] HeaderBuffer;
-            if (ChangedPosition) {
-                File.seekg(CurrentOffset + BufferSize, std::fstream::beg);
+            if (Mapping.is_open()) {
+                Mapping.close();
             }
         }
+
+        StreamCatalog *Scanner::GetFoundStreams() {
+            return &Streams;
+        }
+
+        uintmax_t Scanner::GetSizeOfFoundStreams() {
+            return TotalSize;
+        }
+
+        unsigned long Scanner::GetCountOfFoundStreams() {
+            return static_cast<unsigned long>(Streams.Size());
+        }
     }
 }
\ No newline at end of file
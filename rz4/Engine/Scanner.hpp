@@ -22,12 +22,18 @@
 
 #include <iostream>
 #include <string>
-#include <list>
 #include <fstream>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <vector>
 #include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 
 #include "Engine/Formats/RiffWave.hpp"
+#include "Engine/Signatures.hpp"
+#include "Engine/StreamCatalog.hpp"
+#include "Engine/ScanCache.hpp"
 #include "Types/Types.hpp"
 #include "Utils/Utils.hpp"
 
@@ -38,11 +44,15 @@ namespace rz4 {
         class Scanner {
         private:
             std::ifstream File;
+            boost::iostreams::mapped_file_source Mapping;
             unsigned int BufferSize;
+            unsigned int Threads;
             uintmax_t FileSize;
             uintmax_t TotalSize;
+            bool Streaming;
             Types::ScannerOptions Options;
-            std::list<Types::StreamInfo> StreamList;
+            StreamCatalog Streams;
+            SignatureRegistry Signatures;
 
         public:
             explicit Scanner(Types::ScannerOptions);
@@ -50,12 +60,15 @@ namespace rz4 {
 
             bool Start(Types::ScannerCallbackHandle& = nullptr);
             void Close();
-            std::list<Types::StreamInfo> *GetListOfFoundStreams();
+            StreamCatalog *GetFoundStreams();
             unsigned long GetCountOfFoundStreams();
             uintmax_t GetSizeOfFoundStreams();
 
-            // Scanners
-            void RiffWaveMatch(const char *, uintmax_t, Types::ScannerCallbackHandle&);
+            void ScanRange(uintmax_t, uintmax_t, StreamCatalog&, Types::ScannerCallbackHandle&);
+            void ScanStream(std::istream&, StreamCatalog&, Types::ScannerCallbackHandle&);
+            void ScanMappedRange(uintmax_t, uintmax_t, StreamCatalog&, Types::ScannerCallbackHandle&);
+            bool MapFile();
+            void ParallelScan();
         };
     }
 }
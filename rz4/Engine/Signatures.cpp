@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Signatures.hpp"
+#include "stdafx.hpp"
+
+namespace rz4 {
+    namespace Engine {
+        SignatureRegistry::SignatureRegistry() : Table(65536, 0), LookAhead(1), InputSize(UINTMAX_MAX), SharedSecond(true) {}
+
+        bool SignatureRegistry::Add(const Signature &Sig) {
+            // One bit per signature in the table
+            if (Signatures.size() >= 32) {
+                return false;
+            }
+
+            const unsigned char *Magic = reinterpret_cast<const unsigned char*>(Sig.First);
+            Table[Magic[0] | (Magic[1] << 8)] |= 1u << Signatures.size();
+
+            SharedSecond = SharedSecond && Sig.HasSecond && (Signatures.empty()
+                || (std::memcmp(Sig.Second, Signatures.front().Second, 4) == 0 && Sig.Distance == Signatures.front().Distance));
+
+            Signatures.push_back(Sig);
+            LookAhead = std::max(LookAhead, std::max(Sig.HeaderSize, Sig.LookAhead));
+            return true;
+        }
+
+        bool SignatureRegistry::Empty() const {
+            return Signatures.empty();
+        }
+
+        /*
+         * Scanner keeps (LookAhead - 1) bytes after each block,
+         * so parser of stream at the end of block sees enough of it.
+         */
+        unsigned int SignatureRegistry::GetLookAhead() const {
+            return LookAhead;
+        }
+
+        /*
+         * Streams are clamped by the end of input, so stream cut
+         * by EOF is reported with size which is really there.
+         */
+        void SignatureRegistry::SetInputSize(uintmax_t Size) {
+            InputSize = Size;
+        }
+
+        /*
+         * Find all streams which start in first `Length` bytes of buffer.
+         * Buffer has `Available` bytes, so headers after `Length` still can be parsed.
+         */
+        void SignatureRegistry::Match(
+            const char *Buffer,
+            unsigned int Length,
+            unsigned int Available,
+            uintmax_t CurrentOffset,
+            StreamCatalog &Catalog,
+            Types::ScannerCallbackHandle &Callback) const {
+            if (Signatures.size() == 1) {
+                MatchSingle(Buffer, Length, Available, CurrentOffset, Catalog, Callback);
+                return;
+            }
+
+            if (Signatures.empty() || Available < 2) {
+                return;
+            }
+
+            if (SharedSecond) {
+                MatchShared(Buffer, Length, Available, CurrentOffset, Catalog, Callback);
+                return;
+            }
+
+            const unsigned char *Data = reinterpret_cast<const unsigned char*>(Buffer);
+            const unsigned int End = std::min(Length, Available - 1);
+
+            for (unsigned int i = 0; i < End; i++) {
+                uint32_t Mask = Table[Data[i] | (Data[i + 1] << 8)];
+
+                for (unsigned int Bit = 0; Mask != 0; Bit++, Mask >>= 1) {
+                    if (Mask & 1) {
+                        Test(Signatures[Bit], Buffer, i, Available, CurrentOffset, Catalog, Callback);
+                    }
+                }
+            }
+        }
+
+        /*
+         * Only one format is enabled - use vectorized kernel for it.
+         */
+        void SignatureRegistry::MatchSingle(
+            const char *Buffer,
+            unsigned int Length,
+            unsigned int Available,
+            uintmax_t CurrentOffset,
+            StreamCatalog &Catalog,
+            Types::ScannerCallbackHandle &Callback) const {
+            const Signature &Sig = Signatures.front();
+            int Index;
+
+            if (Sig.HasSecond) {
+                Index = Utils::SignatureMatch(Buffer, Available, Sig.First, Sig.Second, Sig.Distance);
+            } else {
+                Index = Utils::CharMatch(Buffer, Length, Sig.First[0]);
+            }
+
+            while (Index != -1 && static_cast<unsigned int>(Index) < Length) {
+                Test(Sig, Buffer, static_cast<unsigned int>(Index), Available, CurrentOffset, Catalog, Callback);
+
+                if (Sig.HasSecond) {
+                    Index = Utils::SignatureMatch(Buffer, Available, Sig.First, Sig.Second, Sig.Distance,
+                        static_cast<unsigned int>(Index + 1));
+                } else {
+                    Index = Utils::CharMatch(Buffer, Length, Sig.First[0], static_cast<unsigned int>(Index + 1));
+                }
+            }
+        }
+
+        /*
+         * All formats have the same second magic (e.g. "WAVE" of RIFF / RF64 / BW64):
+         * search for it with vectorized kernel, first magic is checked by the table.
+         */
+        void SignatureRegistry::MatchShared(
+            const char *Buffer,
+            unsigned int Length,
+            unsigned int Available,
+            uintmax_t CurrentOffset,
+            StreamCatalog &Catalog,
+            Types::ScannerCallbackHandle &Callback) const {
+            const Signature &Sig = Signatures.front();
+            const unsigned char *Data = reinterpret_cast<const unsigned char*>(Buffer);
+
+            if (Available < Sig.Distance + 4) {
+                return;
+            }
+
+            const char *Shifted = Buffer + Sig.Distance;
+            const unsigned int ShiftedSize = Available - Sig.Distance;
+            int Index = Utils::SignatureMatch(Shifted, ShiftedSize, Sig.Second, Sig.Second, 0);
+
+            while (Index != -1 && static_cast<unsigned int>(Index) < Length) {
+                const unsigned int i = static_cast<unsigned int>(Index);
+                uint32_t Mask = Table[Data[i] | (Data[i + 1] << 8)];
+
+                for (unsigned int Bit = 0; Mask != 0; Bit++, Mask >>= 1) {
+                    if (Mask & 1) {
+                        Test(Signatures[Bit], Buffer, i, Available, CurrentOffset, Catalog, Callback);
+                    }
+                }
+
+                Index = Utils::SignatureMatch(Shifted, ShiftedSize, Sig.Second, Sig.Second, 0, i + 1);
+            }
+        }
+
+        bool SignatureRegistry::Test(
+            const Signature &Sig,
+            const char *Buffer,
+            unsigned int Index,
+            unsigned int Available,
+            uintmax_t CurrentOffset,
+            StreamCatalog &Catalog,
+            Types::ScannerCallbackHandle &Callback) const {
+            // Header is cut by the end of file
+            if (Index + Sig.HeaderSize > Available) {
+                return false;
+            }
+
+            if (std::memcmp(Buffer + Index, Sig.First, 4) != 0
+                || (Sig.HasSecond && std::memcmp(Buffer + Index + Sig.Distance, Sig.Second, 4) != 0)) {
+                return false;
+            }
+
+            Types::StreamInfo StreamInfo;
+            Utils::AddStat(Utils::StatScanCandidates, 1);
+
+            // Parser always sees the same window, wherever the candidate
+            // is in the block, so result doesn't depend on block size
+            const unsigned int Window = std::min(Available - Index, std::max(Sig.HeaderSize, Sig.LookAhead));
+
+            if (!Sig.Parse(Buffer + Index, Window, StreamInfo)) {
+                return false;
+            }
+
+            Utils::AddStat(Utils::StatScanAccepted, 1);
+
+            StreamInfo.Type = Sig.Type;
+            StreamInfo.Offset = CurrentOffset + Index;
+
+            if (StreamInfo.Size > InputSize - StreamInfo.Offset) {
+                StreamInfo.Size = InputSize - StreamInfo.Offset;
+            }
+
+            Catalog.Add(StreamInfo);
+
+            if (Callback != nullptr) {
+                Callback(&StreamInfo);
+            }
+
+            return true;
+        }
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RZ4_SIGNATURES_HPP
+#define RZ4_SIGNATURES_HPP
+
+#include <vector>
+#include <cstring>
+
+#include "Engine/StreamCatalog.hpp"
+#include "Types/Types.hpp"
+#include "Utils/Utils.hpp"
+
+namespace rz4 {
+    namespace Engine {
+        // Parse header of stream (buffer, available bytes, out stream info).
+        // Return false if it's not a valid stream.
+        typedef bool(*SignatureParser)(const char *, uintmax_t, Types::StreamInfo&);
+
+        typedef struct Signature {
+            unsigned short Type;
+            // Magic at the start of stream
+            char First[4];
+            // Optional second magic at `Distance` from the start
+            char Second[4];
+            unsigned int Distance;
+            bool HasSecond;
+            // How many bytes parser needs
+            unsigned int HeaderSize;
+            // How many bytes parser looks at if they are available
+            unsigned int LookAhead;
+            SignatureParser Parse;
+        } Signature;
+
+        /*
+         * All enabled formats are matched in one pass over the buffer:
+         * first two bytes of every position are looked up in a table
+         * of signature masks, only hits are checked and parsed.
+         */
+        class SignatureRegistry {
+        private:
+            std::vector<Signature> Signatures;
+            std::vector<uint32_t> Table;
+            unsigned int LookAhead;
+            uintmax_t InputSize;
+            bool SharedSecond;
+
+            bool Test(const Signature&, const char *, unsigned int, unsigned int, uintmax_t,
+                StreamCatalog&, Types::ScannerCallbackHandle&) const;
+            void MatchSingle(const char *, unsigned int, unsigned int, uintmax_t,
+                StreamCatalog&, Types::ScannerCallbackHandle&) const;
+            void MatchShared(const char *, unsigned int, unsigned int, uintmax_t,
+                StreamCatalog&, Types::ScannerCallbackHandle&) const;
+
+        public:
+            SignatureRegistry();
+
+            bool Add(const Signature&);
+            bool Empty() const;
+            unsigned int GetLookAhead() const;
+            void SetInputSize(uintmax_t);
+
+            void Match(const char *, unsigned int, unsigned int, uintmax_t,
+                StreamCatalog&, Types::ScannerCallbackHandle&) const;
+        };
+    }
+}
+
+#endif //RZ4_SIGNATURES_HPP
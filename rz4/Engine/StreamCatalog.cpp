@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "StreamCatalog.hpp"
+#include "stdafx.hpp"
+
+#include <cstring>
+#include <numeric>
+#include <queue>
+#include <functional>
+
+namespace rz4 {
+    namespace Engine {
+        void StreamCatalog::Add(const Types::StreamInfo &Stream) {
+            Offsets.push_back(Stream.Offset);
+            Sizes.push_back(Stream.Size);
+            TypeIds.push_back(Stream.Type);
+            Headers.emplace_back();
+            std::memcpy(Headers.back().data(), Stream.Header, Types::StreamHeaderSize);
+        }
+
+        void StreamCatalog::Take(const StreamCatalog &Other, size_t Index) {
+            Offsets.push_back(Other.Offsets[Index]);
+            Sizes.push_back(Other.Sizes[Index]);
+            TypeIds.push_back(Other.TypeIds[Index]);
+            Headers.push_back(Other.Headers[Index]);
+        }
+
+        void StreamCatalog::Append(const StreamCatalog &Other) {
+            Offsets.insert(Offsets.end(), Other.Offsets.begin(), Other.Offsets.end());
+            Sizes.insert(Sizes.end(), Other.Sizes.begin(), Other.Sizes.end());
+            TypeIds.insert(TypeIds.end(), Other.TypeIds.begin(), Other.TypeIds.end());
+            Headers.insert(Headers.end(), Other.Headers.begin(), Other.Headers.end());
+        }
+
+        /*
+         * Merge catalogs of scanner workers. Each of them is sorted already
+         * (worker takes chunks in order of offset), so it's k-way merge.
+         */
+        void StreamCatalog::Merge(std::vector<StreamCatalog> &Parts) {
+            typedef std::pair<uintmax_t, size_t> Head;
+            std::priority_queue<Head, std::vector<Head>, std::greater<Head>> Heads;
+            std::vector<size_t> Positions(Parts.size(), 0);
+            size_t Total = Size();
+
+            for (size_t i = 0; i < Parts.size(); i++) {
+                Parts[i].Sort();
+                Total += Parts[i].Size();
+
+                if (!Parts[i].Empty()) {
+                    Heads.push(Head(Parts[i].Offsets.front(), i));
+                }
+            }
+
+            Reserve(Total);
+
+            while (!Heads.empty()) {
+                const size_t Part = Heads.top().second;
+                Heads.pop();
+
+                Take(Parts[Part], Positions[Part]++);
+
+                if (Positions[Part] < Parts[Part].Size()) {
+                    Heads.push(Head(Parts[Part].Offsets[Positions[Part]], Part));
+                }
+            }
+
+            for (auto &Part : Parts) {
+                Part.Clear();
+            }
+
+            Sort();
+        }
+
+        /*
+         * Sort by offset. Usually streams are added in order already.
+         */
+        void StreamCatalog::Sort() {
+            if (std::is_sorted(Offsets.begin(), Offsets.end())) {
+                return;
+            }
+
+            std::vector<size_t> Order(Size());
+            std::iota(Order.begin(), Order.end(), 0);
+            std::stable_sort(Order.begin(), Order.end(), [&](size_t F, size_t S) {
+                return Offsets[F] < Offsets[S];
+            });
+
+            StreamCatalog Sorted;
+            Sorted.Reserve(Size());
+
+            for (size_t Index : Order) {
+                Sorted.Take(*this, Index);
+            }
+
+            *this = std::move(Sorted);
+        }
+
+        /*
+         * Cut streams by the end of input.
+         */
+        void StreamCatalog::Clamp(uintmax_t End) {
+            for (size_t i = 0; i < Size(); i++) {
+                if (Sizes[i] > End - Offsets[i]) {
+                    Sizes[i] = End - Offsets[i];
+                }
+            }
+        }
+
+        void StreamCatalog::Reserve(size_t Count) {
+            Offsets.reserve(Count);
+            Sizes.reserve(Count);
+            TypeIds.reserve(Count);
+            Headers.reserve(Count);
+        }
+
+        void StreamCatalog::Clear() {
+            std::vector<uintmax_t>().swap(Offsets);
+            std::vector<uintmax_t>().swap(Sizes);
+            std::vector<unsigned short>().swap(TypeIds);
+            std::vector<std::array<char, Types::StreamHeaderSize>>().swap(Headers);
+        }
+
+        size_t StreamCatalog::Size() const {
+            return Offsets.size();
+        }
+
+        bool StreamCatalog::Empty() const {
+            return Offsets.empty();
+        }
+
+        uintmax_t StreamCatalog::GetTotalSize() const {
+            return std::accumulate(Sizes.begin(), Sizes.end(), static_cast<uintmax_t>(0));
+        }
+
+        uintmax_t StreamCatalog::GetOffset(size_t Index) const {
+            return Offsets[Index];
+        }
+
+        uintmax_t StreamCatalog::GetSize(size_t Index) const {
+            return Sizes[Index];
+        }
+
+        unsigned short StreamCatalog::GetType(size_t Index) const {
+            return TypeIds[Index];
+        }
+
+        const char *StreamCatalog::GetFileType(size_t Index) const {
+            return Types::StreamTypes[TypeIds[Index]];
+        }
+
+        const char *StreamCatalog::GetExt(size_t Index) const {
+            return Types::StreamExts[TypeIds[Index]];
+        }
+
+        const char *StreamCatalog::GetHeader(size_t Index) const {
+            return Headers[Index].data();
+        }
+
+        Types::StreamInfo StreamCatalog::Get(size_t Index) const {
+            Types::StreamInfo Stream;
+            Stream.Offset = Offsets[Index];
+            Stream.Size = Sizes[Index];
+            Stream.Type = TypeIds[Index];
+            std::memcpy(Stream.Header, Headers[Index].data(), Types::StreamHeaderSize);
+            return Stream;
+        }
+    }
+}
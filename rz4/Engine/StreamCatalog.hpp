@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef RZ4_STREAM_CATALOG_HPP
+#define RZ4_STREAM_CATALOG_HPP
+
+#include <array>
+#include <vector>
+#include <algorithm>
+
+#include "Types/Types.hpp"
+
+namespace rz4 {
+    namespace Engine {
+        /*
+         * Found streams, one vector per field. Type of stream is kept
+         * as id (names are in Types::StreamTypes / StreamExts),
+         * parsed header is kept inline, so there are no allocations per stream.
+         */
+        class StreamCatalog {
+        private:
+            std::vector<uintmax_t> Offsets;
+            std::vector<uintmax_t> Sizes;
+            std::vector<unsigned short> TypeIds;
+            std::vector<std::array<char, Types::StreamHeaderSize>> Headers;
+
+            void Take(const StreamCatalog&, size_t);
+
+        public:
+            void Add(const Types::StreamInfo&);
+            void Append(const StreamCatalog&);
+            void Merge(std::vector<StreamCatalog>&);
+            void Sort();
+            void Clamp(uintmax_t);
+            void Reserve(size_t);
+            void Clear();
+
+            size_t Size() const;
+            bool Empty() const;
+            uintmax_t GetTotalSize() const;
+
+            uintmax_t GetOffset(size_t) const;
+            uintmax_t GetSize(size_t) const;
+            unsigned short GetType(size_t) const;
+            const char *GetFileType(size_t) const;
+            const char *GetExt(size_t) const;
+            const char *GetHeader(size_t) const;
+            Types::StreamInfo Get(size_t) const;
+        };
+    }
+}
+
+#endif //RZ4_STREAM_CATALOG_HPP
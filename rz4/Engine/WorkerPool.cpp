@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "WorkerPool.hpp"
+#include "stdafx.hpp"
+
+namespace rz4 {
+    namespace Engine {
+        WorkerPool::WorkerPool(unsigned int Size) : Stopped(false) {
+            if (Size == 0) {
+                Size = std::max(1u, std::thread::hardware_concurrency());
+            }
+
+            for (unsigned int i = 0; i < Size; i++) {
+                Threads.emplace_back(&WorkerPool::Worker, this);
+            }
+        }
+
+        /*
+         * Tasks which are already submitted are finished first.
+         */
+        WorkerPool::~WorkerPool() {
+            {
+                std::lock_guard<std::mutex> Lock(Mutex);
+                Stopped = true;
+            }
+            Condition.notify_all();
+
+            for (auto &Thread : Threads) {
+                Thread.join();
+            }
+        }
+
+        std::future<void> WorkerPool::Submit(std::function<void()> Function) {
+            std::packaged_task<void()> Task(std::move(Function));
+            std::future<void> Result = Task.get_future();
+
+            {
+                std::lock_guard<std::mutex> Lock(Mutex);
+                Tasks.push_back(std::move(Task));
+            }
+            Condition.notify_one();
+
+            return Result;
+        }
+
+        unsigned int WorkerPool::GetSize() const {
+            return static_cast<unsigned int>(Threads.size());
+        }
+
+        void WorkerPool::Worker() {
+            while (true) {
+                std::packaged_task<void()> Task;
+
+                {
+                    std::unique_lock<std::mutex> Lock(Mutex);
+                    Condition.wait(Lock, [&]() { return Stopped || !Tasks.empty(); });
+
+                    if (Tasks.empty()) {
+                        return;
+                    }
+
+                    Task = std::move(Tasks.front());
+                    Tasks.pop_front();
+                }
+
+                Task();
+            }
+        }
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RZ4_WORKER_POOL_HPP
+#define RZ4_WORKER_POOL_HPP
+
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <condition_variable>
+
+namespace rz4 {
+    namespace Engine {
+        /*
+         * Fixed set of threads which run tasks in order of submit.
+         * Shared by engines of several inputs, so that count of
+         * running encoders doesn't grow with count of files.
+         */
+        class WorkerPool {
+        private:
+            std::vector<std::thread> Threads;
+            std::deque<std::packaged_task<void()>> Tasks;
+            std::mutex Mutex;
+            std::condition_variable Condition;
+            bool Stopped;
+
+        public:
+            explicit WorkerPool(unsigned int);
+            ~WorkerPool();
+            WorkerPool(const WorkerPool&) = delete;
+            WorkerPool &operator=(const WorkerPool&) = delete;
+
+            std::future<void> Submit(std::function<void()>);
+            unsigned int GetSize() const;
+
+            void Worker();
+        };
+    }
+}
+
+
+#endif //RZ4_WORKER_POOL_HPP
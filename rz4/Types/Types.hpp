@@ -21,26 +21,37 @@
 #define RZ4M_TYPES_H
 
 #include <string>
-#include <list>
+#include <vector>
+#include <streambuf>
 #include <boost/filesystem.hpp>
 
 namespace rz4 {
+    namespace Engine {
+        class StreamCatalog;
+        class WorkerPool;
+    }
+
     namespace Types {
         namespace fs = boost::filesystem;
 
-        enum { TakCompressor = 0x1, WavPackCompressor };
+        struct RzfIndexEntry;
+
+        enum { TakCompressor = 0x1, WavPackCompressor, PcmCompressor, LzCompressor };
         enum { RiffWave = 0 };
+
+        // Type of block of data between streams
+        const unsigned short GapData = 0xFFFF;
         extern const char* StreamTypes[];
         extern const char* StreamExts[];
 
+        // Parsed header of stream is kept inline, enough for all formats
+        const unsigned int StreamHeaderSize = 64;
+
         typedef struct StreamInfo {
-            std::string FileType;
-            std::string Ext;
-            std::string ShortType;
             uintmax_t Size;
             uintmax_t Offset;
             unsigned short Type;
-            void *Data;
+            char Header[StreamHeaderSize];
         } StreamInfo;
 
         typedef struct CLIOptions {
@@ -48,17 +59,35 @@ namespace rz4 {
             std::string Command;
             fs::path InFile;
             fs::path OutFile;
+            fs::path StatsFile;
+            fs::path PrevFile;
+            std::vector<fs::path> InFiles;
+            std::string IoBackend;
             unsigned int BufferSize;
+            unsigned int Threads;
+            unsigned int Jobs;
+            bool MemoryMap;
             bool Verbose;
             bool EnableRiffWave;
             unsigned short WavPackCompLevel;
             unsigned short TakCompLevel;
+            unsigned short PcmCompLevel;
+            unsigned short MinGain;
+            bool Dedup;
+            bool CompressGaps;
+            bool ScanCache;
         } CLIOptions;
 
         typedef struct ScannerOptions {
             fs::path FileName;
             unsigned int BufferSize;
+            unsigned int Threads;
+            bool MemoryMap;
             bool EnableRiffWave;
+            // Sidecar with found streams, empty - don't use
+            fs::path CacheFile;
+            // Data before this offset isn't scanned (update of archive)
+            uintmax_t Begin;
         } ScannerOptions;
 
         typedef const std::function<void(StreamInfo*)> ScannerCallbackHandle;
@@ -67,23 +96,68 @@ namespace rz4 {
             fs::path FileName;
             fs::path OutFile;
             unsigned int BufferSize;
-            std::list<StreamInfo> *ListOfStreams;
+            const Engine::StreamCatalog *Streams;
+            unsigned int Jobs;
             bool EnableRiffWave;
             unsigned short WavPackCompLevel;
             unsigned short TakCompLevel;
+            unsigned short PcmCompLevel;
+            // Percents, streams which are predicted to compress worse aren't encoded
+            unsigned short MinGain;
+            // Store identical streams once, other copies as references
+            bool Dedup;
+            // Encode data between streams by blocks with built-in LZ codec
+            bool CompressGaps;
+            // Entries of previous archive of the same input (update), or nullptr
+            const std::vector<RzfIndexEntry> *Reuse;
+            fs::path ReuseFile;
+            std::streambuf *OutBuffer;
+            // Encoders run on this pool (shared by several inputs), nullptr - own threads
+            Engine::WorkerPool *Pool;
         } CompressorOptions;
+
+        typedef struct RestorerOptions {
+            fs::path FileName;
+            fs::path OutFile;
+            unsigned int BufferSize;
+            unsigned int Threads;
+        } RestorerOptions;
+
+        typedef struct ExtractorOptions {
+            fs::path FileName;
+            fs::path OutDir;
+            const Engine::StreamCatalog *Streams;
+            unsigned int BufferSize;
+            unsigned int Threads;
+        } ExtractorOptions;
+
+        // Count of extracted streams and their size
+        typedef const std::function<void(uintmax_t, uintmax_t)> ExtractorCallbackHandle;
  
         const char RzfHeaderSignature[4] = { 'R', 'Z', '4', 'F' };
-        const char RzfHeaderVersion[3] = { '0', '0', '1' };
+        const char RzfHeaderVersion[3] = { '0', '0', '3' };
+        const char RzfHeaderVersion002[3] = { '0', '0', '2' };
+        const char RzfHeaderVersion001[3] = { '0', '0', '1' };
+        const char RzfFooterSignature[4] = { 'R', 'Z', '4', 'I' };
 
+        /*
+         * Version 001: header is written last, compressed streams
+         * are linked by RzfCompressedStream headers inside data.
+         * Version 002: archive is written forward only, header keeps
+         * only signature, version and original size, other info
+         * is in the index of streams and footer at the end of file.
+         * Version 003: same as 002, but index entry with RzfReference
+         * flag in Compressor is a copy of data stored earlier in archive:
+         * compressed stream or raw bytes (Compressor without flag is 0).
+         */
 #pragma pack(push, 1)
         typedef struct RzfHeader {
             char Signature[4];
             char Version[3];
-            uintmax_t OriginalSize;
-            unsigned long NumberOfStreams;
+            uint64_t OriginalSize;
+            uint32_t NumberOfStreams;
             uint32_t OriginalCRC32;
-            uintmax_t FirstCompressedStreamOffset;
+            uint64_t FirstCompressedStreamOffset;
         } RzfHeader;
 #pragma pack(pop)
 
@@ -98,6 +172,31 @@ namespace rz4 {
             uint32_t OriginalCRC32;
         } RzfCompressedStream;
 #pragma pack(pop)
+
+        const uint16_t RzfReference = 0x8000;
+
+#pragma pack(push, 1)
+        typedef struct RzfIndexEntry {
+            uint16_t Type;
+            uint16_t Compressor;
+            uint64_t CompressedOffset;
+            uint64_t CompressedSize;
+            uint64_t OriginalOffset;
+            uint64_t OriginalSize;
+            uint32_t OriginalCRC32;
+        } RzfIndexEntry;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+        typedef struct RzfFooter {
+            uint64_t IndexOffset;
+            uint64_t NumberOfStreams;
+            uint64_t OriginalSize;
+            uint32_t OriginalCRC32;
+            uint32_t IndexCRC32;
+            char Signature[4];
+        } RzfFooter;
+#pragma pack(pop)
     }
 }
 
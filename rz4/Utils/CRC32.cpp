@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Utils.hpp"
+#include "stdafx.hpp"
+
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RZ4_PCLMUL 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#define RZ4_TARGET_PCLMUL
+#else
+#define RZ4_TARGET_PCLMUL __attribute__((target("sse2,pclmul")))
+#endif
+
+namespace rz4 {
+    namespace Utils {
+        namespace {
+            typedef uint32_t(*CRC32Kernel)(uint32_t, const uint8_t*, size_t);
+
+            // Chunk of file per thread in CalculateCRC32InFile
+            const uintmax_t MinParallelChunk = 16 * 1024 * 1024;
+
+            // Block of reader in CalculateCRC32InFile
+            const size_t CRC32BlockSize = 1024 * 1024;
+
+            inline uint32_t ReadUInt32(const uint8_t *P) {
+                return static_cast<uint32_t>(P[0])
+                    | (static_cast<uint32_t>(P[1]) << 8)
+                    | (static_cast<uint32_t>(P[2]) << 16)
+                    | (static_cast<uint32_t>(P[3]) << 24);
+            }
+
+            /*
+             * Tables for slicing-by-16: Table[k][i] is CRC32
+             * of byte i followed by k zero bytes.
+             */
+            struct SlicingTables {
+                uint32_t Table[16][256];
+
+                SlicingTables() {
+                    GenerateTableCRC32(Table[0]);
+
+                    for (int k = 1; k < 16; k++) {
+                        for (int i = 0; i < 256; i++) {
+                            uint32_t c = Table[k - 1][i];
+                            Table[k][i] = (c >> 8) ^ Table[0][c & 0xFF];
+                        }
+                    }
+                }
+            };
+
+            const SlicingTables &GetSlicingTables() {
+                static const SlicingTables Tables;
+                return Tables;
+            }
+
+            /*
+             * Portable kernel, 16 bytes per step.
+             * Works with inverted CRC (as all kernels here).
+             */
+            uint32_t CRC32Slicing16(uint32_t c, const uint8_t *P, size_t Length) {
+                const uint32_t (&T)[16][256] = GetSlicingTables().Table;
+
+                while (Length >= 16) {
+                    uint32_t A = ReadUInt32(P) ^ c;
+                    uint32_t B = ReadUInt32(P + 4);
+                    uint32_t C = ReadUInt32(P + 8);
+                    uint32_t D = ReadUInt32(P + 12);
+
+                    c = T[15][A & 0xFF] ^ T[14][(A >> 8) & 0xFF] ^ T[13][(A >> 16) & 0xFF] ^ T[12][A >> 24]
+                        ^ T[11][B & 0xFF] ^ T[10][(B >> 8) & 0xFF] ^ T[9][(B >> 16) & 0xFF] ^ T[8][B >> 24]
+                        ^ T[7][C & 0xFF] ^ T[6][(C >> 8) & 0xFF] ^ T[5][(C >> 16) & 0xFF] ^ T[4][C >> 24]
+                        ^ T[3][D & 0xFF] ^ T[2][(D >> 8) & 0xFF] ^ T[1][(D >> 16) & 0xFF] ^ T[0][D >> 24];
+
+                    P += 16;
+                    Length -= 16;
+                }
+
+                while (Length--) {
+                    c = T[0][(c ^ *P++) & 0xFF] ^ (c >> 8);
+                }
+
+                return c;
+            }
+
+#if defined(RZ4_PCLMUL)
+            /*
+             * Folding with carry-less multiplication, 64 bytes per step
+             * ("Fast CRC Computation for Generic Polynomials Using
+             * PCLMULQDQ Instruction", Intel). Constants are for
+             * bit-reflected CRC32 polynomial. Length must be multiple
+             * of 16 and not less than 64.
+             */
+            RZ4_TARGET_PCLMUL uint32_t CRC32FoldPCLMUL(uint32_t c, const uint8_t *P, size_t Length) {
+                const __m128i K1K2 = _mm_set_epi64x(0x01C6E41596LL, 0x0154442BD4LL);
+                const __m128i K3K4 = _mm_set_epi64x(0x00CCAA009ELL, 0x01751997D0LL);
+                const __m128i K5K0 = _mm_set_epi64x(0, 0x0163CD6124LL);
+                const __m128i Poly = _mm_set_epi64x(0x01F7011641LL, 0x01DB710641LL);
+                const __m128i Mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+                __m128i X0, X1, X2, X3, X4, X5, X6, X7, X8;
+
+                X1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(P));
+                X2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(P + 16));
+                X3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(P + 32));
+                X4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(P + 48));
+                X1 = _mm_xor_si128(X1, _mm_cvtsi32_si128(static_cast<int>(c)));
+                P += 64;
+                Length -= 64;
+
+                // Four independent folds per step
+                while (Length >= 64) {
+                    X5 = _mm_clmulepi64_si128(X1, K1K2, 0x00);
+                    X6 = _mm_clmulepi64_si128(X2, K1K2, 0x00);
+                    X7 = _mm_clmulepi64_si128(X3, K1K2, 0x00);
+                    X8 = _mm_clmulepi64_si128(X4, K1K2, 0x00);
+                    X1 = _mm_clmulepi64_si128(X1, K1K2, 0x11);
+                    X2 = _mm_clmulepi64_si128(X2, K1K2, 0x11);
+                    X3 = _mm_clmulepi64_si128(X3, K1K2, 0x11);
+                    X4 = _mm_clmulepi64_si128(X4, K1K2, 0x11);
+                    X1 = _mm_xor_si128(_mm_xor_si128(X1, X5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(P)));
+                    X2 = _mm_xor_si128(_mm_xor_si128(X2, X6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(P + 16)));
+                    X3 = _mm_xor_si128(_mm_xor_si128(X3, X7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(P + 32)));
+                    X4 = _mm_xor_si128(_mm_xor_si128(X4, X8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(P + 48)));
+                    P += 64;
+                    Length -= 64;
+                }
+
+                // Fold 512 bits into 128
+                X5 = _mm_clmulepi64_si128(X1, K3K4, 0x00);
+                X1 = _mm_clmulepi64_si128(X1, K3K4, 0x11);
+                X1 = _mm_xor_si128(_mm_xor_si128(X1, X2), X5);
+                X5 = _mm_clmulepi64_si128(X1, K3K4, 0x00);
+                X1 = _mm_clmulepi64_si128(X1, K3K4, 0x11);
+                X1 = _mm_xor_si128(_mm_xor_si128(X1, X3), X5);
+                X5 = _mm_clmulepi64_si128(X1, K3K4, 0x00);
+                X1 = _mm_clmulepi64_si128(X1, K3K4, 0x11);
+                X1 = _mm_xor_si128(_mm_xor_si128(X1, X4), X5);
+
+                while (Length >= 16) {
+                    X5 = _mm_clmulepi64_si128(X1, K3K4, 0x00);
+                    X1 = _mm_clmulepi64_si128(X1, K3K4, 0x11);
+                    X1 = _mm_xor_si128(_mm_xor_si128(X1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(P))), X5);
+                    P += 16;
+                    Length -= 16;
+                }
+
+                // Fold 128 bits into 64
+                X2 = _mm_clmulepi64_si128(X1, K3K4, 0x10);
+                X1 = _mm_xor_si128(_mm_srli_si128(X1, 8), X2);
+                X2 = _mm_srli_si128(X1, 4);
+                X1 = _mm_and_si128(X1, Mask32);
+                X1 = _mm_clmulepi64_si128(X1, K5K0, 0x00);
+                X1 = _mm_xor_si128(X1, X2);
+
+                // Barrett reduction to 32 bits
+                X0 = _mm_and_si128(X1, Mask32);
+                X0 = _mm_clmulepi64_si128(X0, Poly, 0x10);
+                X0 = _mm_and_si128(X0, Mask32);
+                X0 = _mm_clmulepi64_si128(X0, Poly, 0x00);
+                X1 = _mm_xor_si128(X1, X0);
+
+                return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(X1, 4)));
+            }
+
+            uint32_t CRC32PCLMUL(uint32_t c, const uint8_t *P, size_t Length) {
+                if (Length >= 64) {
+                    const size_t Folded = Length & ~static_cast<size_t>(15);
+                    c = CRC32FoldPCLMUL(c, P, Folded);
+                    P += Folded;
+                    Length -= Folded;
+                }
+
+                return CRC32Slicing16(c, P, Length);
+            }
+#endif
+
+            struct CRC32Dispatch {
+                const char *Name;
+                CRC32Kernel Kernel;
+
+                CRC32Dispatch() {
+#if defined(RZ4_PCLMUL)
+                    if (CpuSupportsPCLMUL()) {
+                        Name = "pclmul";
+                        Kernel = CRC32PCLMUL;
+                        return;
+                    }
+#endif
+                    Name = "slicing-by-16";
+                    Kernel = CRC32Slicing16;
+                }
+            };
+
+            const CRC32Dispatch &GetCRC32Dispatch() {
+                static const CRC32Dispatch Dispatch;
+                return Dispatch;
+            }
+
+            uint32_t Gf2MatrixTimes(const uint32_t *Matrix, uint32_t Vector) {
+                uint32_t Sum = 0;
+
+                while (Vector) {
+                    if (Vector & 1) {
+                        Sum ^= *Matrix;
+                    }
+
+                    Vector >>= 1;
+                    Matrix++;
+                }
+
+                return Sum;
+            }
+
+            void Gf2MatrixSquare(uint32_t *Square, const uint32_t *Matrix) {
+                for (int i = 0; i < 32; i++) {
+                    Square[i] = Gf2MatrixTimes(Matrix, Matrix[i]);
+                }
+            }
+        }
+
+        /*
+         * Check that CPU supports carry-less multiplication.
+         */
+        bool CpuSupportsPCLMUL() {
+#if defined(RZ4_PCLMUL) && defined(_MSC_VER)
+            int Info[4];
+            __cpuid(Info, 1);
+            return (Info[2] & (1 << 1)) != 0 && (Info[3] & (1 << 26)) != 0;
+#elif defined(RZ4_PCLMUL)
+            return __builtin_cpu_supports("pclmul") != 0 && __builtin_cpu_supports("sse2") != 0;
+#else
+            return false;
+#endif
+        }
+
+        /* CRC32 (From https://gist.github.com/timepp/1f678e200d9e0f2a043a9ec6b3690635) */
+        void GenerateTableCRC32(uint32_t(&Table)[256]) {
+            uint32_t polynomial = 0xEDB88320;
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (size_t j = 0; j < 8; j++) {
+                    if (c & 1) {
+                        c = polynomial ^ (c >> 1);
+                    }
+                    else {
+                        c >>= 1;
+                    }
+                }
+
+                Table[i] = c;
+            }
+        }
+
+        uint32_t UpdateCRC32(uint32_t Initial, const void *Buffer, size_t Length) {
+            auto StartTime = std::chrono::steady_clock::now();
+            const uint32_t Result = GetCRC32Dispatch().Kernel(Initial ^ 0xFFFFFFFF, static_cast<const uint8_t*>(Buffer), Length) ^ 0xFFFFFFFF;
+
+            AddStat(StatCRC32Bytes, Length);
+            AddStatTime(StatCRC32Time, std::chrono::steady_clock::now() - StartTime);
+            return Result;
+        }
+
+        /*
+         * Name of CRC32 implementation selected for current CPU.
+         */
+        const char *CRC32KernelName() {
+            return GetCRC32Dispatch().Name;
+        }
+
+        /*
+        * CRC32 of concatenation of two blocks by their CRC32
+        * and length of second block (same method as zlib crc32_combine).
+        */
+        uint32_t CombineCRC32(uint32_t First, uint32_t Second, uintmax_t SecondLength) {
+            uint32_t Even[32], Odd[32], Row = 1;
+
+            if (SecondLength == 0) {
+                return First;
+            }
+
+            // Operator for one zero bit
+            Odd[0] = 0xEDB88320;
+            for (int i = 1; i < 32; i++) {
+                Odd[i] = Row;
+                Row <<= 1;
+            }
+
+            // Operators for two and four zero bits
+            Gf2MatrixSquare(Even, Odd);
+            Gf2MatrixSquare(Odd, Even);
+
+            // Apply zero bytes to First
+            do {
+                Gf2MatrixSquare(Even, Odd);
+
+                if (SecondLength & 1) {
+                    First = Gf2MatrixTimes(Even, First);
+                }
+
+                SecondLength >>= 1;
+
+                if (SecondLength == 0) {
+                    break;
+                }
+
+                Gf2MatrixSquare(Odd, Even);
+
+                if (SecondLength & 1) {
+                    First = Gf2MatrixTimes(Odd, First);
+                }
+
+                SecondLength >>= 1;
+            } while (SecondLength != 0);
+
+            return First ^ Second;
+        }
+
+        uint32_t CalculateCRC32InStream(std::ifstream &File, uintmax_t Offset, uintmax_t Size) {
+            std::vector<char> Buffer(static_cast<size_t>(std::min<uintmax_t>(16 * 1024 * 1024, Size)));
+            uintmax_t ReadBytes = 0;
+            uint32_t CRC32 = 0;
+            std::streampos OldOffset = File.tellg();
+            File.seekg(Offset, std::fstream::beg);
+
+            while (ReadBytes < Size) {
+                const size_t Length = static_cast<size_t>(std::min<uintmax_t>(Buffer.size(), Size - ReadBytes));
+                File.read(Buffer.data(), Length);
+                CRC32 = UpdateCRC32(CRC32, Buffer.data(), Length);
+                ReadBytes += Length;
+            }
+
+            File.seekg(OldOffset, std::fstream::beg);
+            return CRC32;
+        }
+
+        /*
+         * CRC32 of part of file. Every thread reads and checksums
+         * own chunk with own handle, results are combined.
+         */
+        uint32_t CalculateCRC32InFile(const fs::path &FileName, uintmax_t Offset, uintmax_t Size, unsigned int Threads) {
+            if (Threads == 0) {
+                Threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+
+            const unsigned int CountOfChunks =
+                static_cast<unsigned int>(std::max<uintmax_t>(1, std::min<uintmax_t>(Threads, Size / MinParallelChunk)));
+            const uintmax_t ChunkSize = Size / CountOfChunks;
+            std::vector<uint32_t> Results(CountOfChunks);
+            std::vector<std::thread> Workers;
+
+            for (unsigned int i = 0; i < CountOfChunks; i++) {
+                auto Worker = [&, i]() {
+                    const uintmax_t Begin = i * ChunkSize;
+                    const uintmax_t Length = i + 1 == CountOfChunks ? Size - Begin : ChunkSize;
+                    std::unique_ptr<RangeReader> Reader = OpenRangeReader(FileName, Offset + Begin, Length, CRC32BlockSize);
+                    std::vector<char> Buffer(static_cast<size_t>(std::min<uintmax_t>(CRC32BlockSize, Length)));
+                    uint32_t CRC32 = 0;
+
+                    for (uintmax_t Done = 0; Done < Length;) {
+                        const size_t Read = Reader->Read(Buffer.data(), static_cast<size_t>(std::min<uintmax_t>(Buffer.size(), Length - Done)));
+
+                        if (Read == 0) {
+                            break;
+                        }
+
+                        CRC32 = UpdateCRC32(CRC32, Buffer.data(), Read);
+                        Done += Read;
+                    }
+
+                    Results[i] = CRC32;
+                };
+
+                if (CountOfChunks == 1) {
+                    Worker();
+                } else {
+                    Workers.emplace_back(Worker);
+                }
+            }
+
+            for (auto &Worker : Workers) {
+                Worker.join();
+            }
+
+            uint32_t CRC32 = Results[0];
+
+            for (unsigned int i = 1; i < CountOfChunks; i++) {
+                const uintmax_t Length = i + 1 == CountOfChunks ? Size - i * ChunkSize : ChunkSize;
+                CRC32 = CombineCRC32(CRC32, Results[i], Length);
+            }
+
+            return CRC32;
+        }
+    }
+}
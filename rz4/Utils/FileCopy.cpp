@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Utils.hpp"
+#include "stdafx.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+namespace rz4 {
+    namespace Utils {
+        namespace {
+            // Smaller pieces are cheaper to copy through buffer
+            // than to open both files for kernel copy
+            const uintmax_t KernelCopyMinSize = 1024 * 1024;
+
+            // Limit of one copy_file_range / sendfile call
+            const uintmax_t KernelCopyChunkSize = 1024 * 1024 * 1024;
+
+            // Block of copy through buffer
+            const size_t CopyBlockSize = 256 * 1024;
+
+            // Limit of one pread / pwrite call
+            const size_t PositionalChunkSize = 1024 * 1024 * 1024;
+
+#if defined(__linux__)
+            /*
+             * Copy range between open descriptors inside of kernel.
+             * copy_file_range shares extents (reflink) on filesystems which
+             * can do it, sendfile is used if files are on different filesystems
+             * or kernel is too old.
+             */
+            uintmax_t KernelCopyRange(int In, uintmax_t SrcOffset, int Out, uintmax_t DstOffset, uintmax_t Size) {
+                uintmax_t Copied = 0;
+                loff_t InOffset = static_cast<loff_t>(SrcOffset);
+                loff_t OutOffset = static_cast<loff_t>(DstOffset);
+#if defined(__NR_copy_file_range)
+                bool CopyRange = true;
+#else
+                bool CopyRange = false;
+#endif
+
+                while (In >= 0 && Out >= 0 && Copied < Size) {
+                    const size_t Length = static_cast<size_t>(std::min(Size - Copied, KernelCopyChunkSize));
+                    ssize_t Result = -1;
+
+                    if (CopyRange) {
+#if defined(__NR_copy_file_range)
+                        Result = syscall(__NR_copy_file_range, In, &InOffset, Out, &OutOffset, Length, 0u);
+#endif
+
+                        if (Result < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+                            CopyRange = false;
+                            continue;
+                        }
+                    } else {
+                        // sendfile writes at current position of output
+                        if (lseek(Out, OutOffset, SEEK_SET) < 0) {
+                            break;
+                        }
+
+                        Result = sendfile(Out, In, &InOffset, Length);
+
+                        if (Result > 0) {
+                            OutOffset += Result;
+                        }
+                    }
+
+                    if (Result < 0 && errno == EINTR) {
+                        continue;
+                    }
+
+                    // End of source or error, caller copies the rest
+                    if (Result <= 0) {
+                        break;
+                    }
+
+                    Copied += static_cast<uintmax_t>(Result);
+                }
+
+                AddStat(StatKernelCopyBytes, Copied);
+
+                return Copied;
+            }
+#endif
+        }
+
+        RandomAccessFile::RandomAccessFile() : Handle(-1) {
+        }
+
+        RandomAccessFile::~RandomAccessFile() {
+            Close();
+        }
+
+        /*
+         * Open existing file for reading.
+         */
+        bool RandomAccessFile::Open(const fs::path &Path) {
+            Close();
+
+#if defined(_WIN32)
+            const HANDLE File = CreateFileW(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            Handle = (File == INVALID_HANDLE_VALUE) ? -1 : reinterpret_cast<intptr_t>(File);
+#else
+            Handle = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+
+            return IsOpen();
+        }
+
+        /*
+         * Open existing file for reading past system cache. Offsets, sizes
+         * and buffers of reads must be aligned (see Io.cpp) then.
+         */
+        bool RandomAccessFile::OpenDirect(const fs::path &Path) {
+            Close();
+
+#if defined(_WIN32)
+            const HANDLE File = CreateFileW(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING, nullptr);
+            Handle = (File == INVALID_HANDLE_VALUE) ? -1 : reinterpret_cast<intptr_t>(File);
+#elif defined(O_DIRECT)
+            Handle = open(Path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+#elif defined(F_NOCACHE)
+            Handle = open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+
+            if (Handle != -1 && fcntl(static_cast<int>(Handle), F_NOCACHE, 1) != 0) {
+                Close();
+            }
+#endif
+
+            return IsOpen();
+        }
+
+        /*
+         * Create (or truncate) file for writing.
+         */
+        bool RandomAccessFile::Create(const fs::path &Path) {
+            Close();
+
+#if defined(_WIN32)
+            const HANDLE File = CreateFileW(Path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            Handle = (File == INVALID_HANDLE_VALUE) ? -1 : reinterpret_cast<intptr_t>(File);
+#else
+            Handle = open(Path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+
+            return IsOpen();
+        }
+
+        bool RandomAccessFile::IsOpen() const {
+            return Handle != -1;
+        }
+
+        void RandomAccessFile::Close() {
+            if (!IsOpen()) {
+                return;
+            }
+
+#if defined(_WIN32)
+            CloseHandle(reinterpret_cast<HANDLE>(Handle));
+#else
+            close(static_cast<int>(Handle));
+#endif
+
+            Handle = -1;
+        }
+
+        /*
+         * Read up to Size bytes at Offset, returns count of read bytes
+         * (less than Size only at end of file or on error).
+         */
+        size_t RandomAccessFile::ReadAt(void *Buffer, size_t Size, uintmax_t Offset) const {
+            size_t Done = 0;
+
+            while (IsOpen() && Done < Size) {
+                const size_t Length = std::min(Size - Done, PositionalChunkSize);
+                char *Dst = static_cast<char*>(Buffer) + Done;
+
+#if defined(_WIN32)
+                OVERLAPPED Position = {};
+                DWORD Result = 0;
+                Position.Offset = static_cast<DWORD>(Offset + Done);
+                Position.OffsetHigh = static_cast<DWORD>((Offset + Done) >> 32);
+
+                if (!ReadFile(reinterpret_cast<HANDLE>(Handle), Dst, static_cast<DWORD>(Length), &Result, &Position) || Result == 0) {
+                    break;
+                }
+#else
+                const ssize_t Result = pread(static_cast<int>(Handle), Dst, Length, static_cast<off_t>(Offset + Done));
+
+                if (Result < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                if (Result <= 0) {
+                    break;
+                }
+#endif
+
+                Done += static_cast<size_t>(Result);
+            }
+
+            return Done;
+        }
+
+        /*
+         * Write whole buffer at Offset.
+         */
+        bool RandomAccessFile::WriteAt(const void *Buffer, size_t Size, uintmax_t Offset) const {
+            size_t Done = 0;
+
+            while (IsOpen() && Done < Size) {
+                const size_t Length = std::min(Size - Done, PositionalChunkSize);
+                const char *Src = static_cast<const char*>(Buffer) + Done;
+
+#if defined(_WIN32)
+                OVERLAPPED Position = {};
+                DWORD Result = 0;
+                Position.Offset = static_cast<DWORD>(Offset + Done);
+                Position.OffsetHigh = static_cast<DWORD>((Offset + Done) >> 32);
+
+                if (!WriteFile(reinterpret_cast<HANDLE>(Handle), Src, static_cast<DWORD>(Length), &Result, &Position) || Result == 0) {
+                    break;
+                }
+#else
+                const ssize_t Result = pwrite(static_cast<int>(Handle), Src, Length, static_cast<off_t>(Offset + Done));
+
+                if (Result < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                if (Result <= 0) {
+                    break;
+                }
+#endif
+
+                Done += static_cast<size_t>(Result);
+            }
+
+            return Done == Size;
+        }
+
+        /*
+         * Reserve space for file of given size, so that filesystem
+         * can place it contiguously and writes can't fail half way
+         * for lack of space. Sets file size too.
+         */
+        bool RandomAccessFile::Preallocate(uintmax_t Size) const {
+            if (!IsOpen()) {
+                return false;
+            }
+
+#if defined(_WIN32)
+            FILE_ALLOCATION_INFO Allocation = {};
+            FILE_END_OF_FILE_INFO End = {};
+            Allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(Size);
+            End.EndOfFile.QuadPart = static_cast<LONGLONG>(Size);
+
+            // Allocation is only a hint, size is what matters
+            SetFileInformationByHandle(reinterpret_cast<HANDLE>(Handle), FileAllocationInfo, &Allocation, sizeof(Allocation));
+
+            return SetFileInformationByHandle(reinterpret_cast<HANDLE>(Handle), FileEndOfFileInfo, &End, sizeof(End)) != 0;
+#else
+            if (Size == 0) {
+                return true;
+            }
+
+#if defined(__linux__)
+            const int Result = posix_fallocate(static_cast<int>(Handle), 0, static_cast<off_t>(Size));
+
+            if (Result == 0) {
+                return true;
+            }
+
+            // Filesystem can't allocate (e.g. tmpfs without support), just set size
+            if (Result != EOPNOTSUPP && Result != EINVAL) {
+                return false;
+            }
+#endif
+
+            return ftruncate(static_cast<int>(Handle), static_cast<off_t>(Size)) == 0;
+#endif
+        }
+
+        intptr_t RandomAccessFile::GetHandle() const {
+            return Handle;
+        }
+
+        /*
+         * Copy range of file to other (existing) file inside of kernel.
+         * Returns count of copied bytes, the rest (or everything
+         * on other systems) must be copied through buffer.
+         */
+        uintmax_t KernelCopy(const fs::path &Src, uintmax_t SrcOffset, const fs::path &Dst, uintmax_t DstOffset, uintmax_t Size) {
+            uintmax_t Copied = 0;
+
+#if defined(__linux__)
+            if (Size < KernelCopyMinSize) {
+                return 0;
+            }
+
+            const int In = open(Src.c_str(), O_RDONLY | O_CLOEXEC);
+            const int Out = open(Dst.c_str(), O_WRONLY | O_CLOEXEC);
+
+            Copied = KernelCopyRange(In, SrcOffset, Out, DstOffset, Size);
+
+            if (In >= 0) {
+                close(In);
+            }
+
+            if (Out >= 0) {
+                close(Out);
+            }
+#endif
+
+            return Copied;
+        }
+
+        /*
+         * Same for already open files, used when one input is copied
+         * to many outputs and reopening it every time is waste.
+         */
+        uintmax_t KernelCopy(const RandomAccessFile &Src, uintmax_t SrcOffset, const RandomAccessFile &Dst, uintmax_t DstOffset, uintmax_t Size) {
+#if defined(__linux__)
+            if (Size < KernelCopyMinSize || !Src.IsOpen() || !Dst.IsOpen()) {
+                return 0;
+            }
+
+            return KernelCopyRange(static_cast<int>(Src.GetHandle()), SrcOffset, static_cast<int>(Dst.GetHandle()), DstOffset, Size);
+#else
+            return 0;
+#endif
+        }
+
+        /*
+         * Copy range of file to position in other existing file,
+         * by kernel if possible, otherwise through buffer.
+         */
+        bool CopyDataFromFileToFile(const fs::path &Src, uintmax_t SrcOffset, const fs::path &Dst, uintmax_t DstOffset, uintmax_t Size) {
+            const uintmax_t Copied = KernelCopy(Src, SrcOffset, Dst, DstOffset, Size);
+
+            if (Copied == Size) {
+                return true;
+            }
+
+            std::unique_ptr<RangeReader> Reader = OpenRangeReader(Src, SrcOffset + Copied, Size - Copied, CopyBlockSize);
+            std::ofstream DstFile(Dst.string(), std::fstream::in | std::fstream::out | std::fstream::binary);
+            std::vector<char> Buffer(static_cast<size_t>(std::min<uintmax_t>(CopyBlockSize, Size - Copied)));
+
+            if (!DstFile.is_open()) {
+                return false;
+            }
+
+            DstFile.seekp(DstOffset + Copied, std::fstream::beg);
+
+            for (uintmax_t Done = Copied; Done < Size;) {
+                const size_t Length = static_cast<size_t>(std::min<uintmax_t>(Buffer.size(), Size - Done));
+
+                if (Reader->Read(Buffer.data(), Length) != Length) {
+                    return false;
+                }
+
+                DstFile.write(Buffer.data(), Length);
+                Done += Length;
+            }
+
+            AddStat(StatCopyBytes, Size - Copied);
+            return DstFile.good();
+        }
+
+        /*
+         * Extract range of input file to new file.
+         */
+        bool ExtractDataFromFileToFile(const fs::path &Src, uintmax_t Offset, uintmax_t Size, const fs::path &Dst) {
+            {
+                std::ofstream OutFile(Dst.string(), std::fstream::trunc | std::fstream::binary);
+
+                if (!OutFile.is_open()) {
+                    return false;
+                }
+            }
+
+            return CopyDataFromFileToFile(Src, Offset, Dst, 0, Size);
+        }
+    }
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Utils.hpp"
+#include "stdafx.hpp"
+
+/*
+ * MurmurHash3 x64 128-bit by Austin Appleby (public domain).
+ * Used to find identical streams, not for integrity: CRC32
+ * of every stream is checked on restore anyway.
+ */
+namespace rz4 {
+    namespace Utils {
+        namespace {
+            inline uint64_t RotateLeft(uint64_t Value, int Count) {
+                return (Value << Count) | (Value >> (64 - Count));
+            }
+
+            inline uint64_t ReadUInt64(const uint8_t *P) {
+                uint64_t Value;
+                std::memcpy(&Value, P, sizeof(Value));
+                return Value;
+            }
+
+            inline uint64_t FinalMix(uint64_t K) {
+                K ^= K >> 33;
+                K *= 0xFF51AFD7ED558CCDULL;
+                K ^= K >> 33;
+                K *= 0xC4CEB9FE1A85EC53ULL;
+                K ^= K >> 33;
+                return K;
+            }
+
+            const uint64_t C1 = 0x87C37B91114253D5ULL;
+            const uint64_t C2 = 0x4CF5AD432745937FULL;
+        }
+
+        Hash128 CalculateHash128(const void *Data, size_t Size, uint64_t Seed) {
+            const uint8_t *P = static_cast<const uint8_t*>(Data);
+            const size_t CountOfBlocks = Size / 16;
+            uint64_t H1 = Seed, H2 = Seed;
+            uint64_t K1, K2;
+
+            for (size_t i = 0; i < CountOfBlocks; i++, P += 16) {
+                K1 = ReadUInt64(P);
+                K2 = ReadUInt64(P + 8);
+
+                K1 *= C1; K1 = RotateLeft(K1, 31); K1 *= C2; H1 ^= K1;
+                H1 = RotateLeft(H1, 27); H1 += H2; H1 = H1 * 5 + 0x52DCE729;
+
+                K2 *= C2; K2 = RotateLeft(K2, 33); K2 *= C1; H2 ^= K2;
+                H2 = RotateLeft(H2, 31); H2 += H1; H2 = H2 * 5 + 0x38495AB5;
+            }
+
+            // Tail: up to 15 bytes
+            const size_t Tail = Size & 15;
+            K1 = K2 = 0;
+
+            for (size_t i = Tail; i > 8; i--) {
+                K2 ^= static_cast<uint64_t>(P[i - 1]) << ((i - 9) * 8);
+            }
+
+            if (Tail > 8) {
+                K2 *= C2; K2 = RotateLeft(K2, 33); K2 *= C1; H2 ^= K2;
+            }
+
+            for (size_t i = std::min<size_t>(Tail, 8); i > 0; i--) {
+                K1 ^= static_cast<uint64_t>(P[i - 1]) << ((i - 1) * 8);
+            }
+
+            if (Tail > 0) {
+                K1 *= C1; K1 = RotateLeft(K1, 31); K1 *= C2; H1 ^= K1;
+            }
+
+            H1 ^= Size; H2 ^= Size;
+            H1 += H2; H2 += H1;
+            H1 = FinalMix(H1); H2 = FinalMix(H2);
+            H1 += H2; H2 += H1;
+
+            return Hash128{ H1, H2 };
+        }
+    }
+}
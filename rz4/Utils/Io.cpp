@@ -0,0 +1,603 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "Utils.hpp"
+#include "stdafx.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define RZ4_IO_URING
+#endif
+#endif
+#endif
+
+namespace rz4 {
+    namespace Utils {
+        namespace {
+            // Offsets, sizes and buffers of direct reads are multiple of it
+            // (the biggest logical sector size in use)
+            const size_t DirectAlignment = 4096;
+
+            // Blocks read ahead of consumer: one is read
+            // while the other one is processed
+            const size_t ReadAheadDepth = 2;
+
+            // Reads in flight of io_uring backend
+            const unsigned int UringDepth = 4;
+
+            // Shorter ranges are read at once, starting of
+            // prefetch would take longer than the read itself
+            const size_t MinPrefetchBlocks = 2;
+
+            std::atomic<int> Backend(IoReadAhead);
+
+            /*
+             * Buffer with start aligned for direct reads.
+             */
+            class AlignedBuffer {
+            private:
+                std::vector<char> Storage;
+                char *Data;
+
+            public:
+                explicit AlignedBuffer(size_t Size) : Storage(Size + DirectAlignment) {
+                    const uintptr_t Address = reinterpret_cast<uintptr_t>(Storage.data());
+                    Data = Storage.data() + (DirectAlignment - Address % DirectAlignment) % DirectAlignment;
+                }
+
+                char *Get() {
+                    return Data;
+                }
+            };
+
+            /*
+             * Plain positional reads into buffer of caller,
+             * system cache does read-ahead if it does.
+             */
+            class BufferedReader : public RangeReader {
+            private:
+                RandomAccessFile File;
+                uintmax_t Position;
+                uintmax_t End;
+
+            public:
+                BufferedReader(const fs::path &Path, uintmax_t Offset, uintmax_t Size)
+                    : Position(Offset), End(Offset + Size) {
+                    File.Open(Path);
+                }
+
+                size_t Read(char *Buffer, size_t Size) override {
+                    const size_t Length = static_cast<size_t>(std::min<uintmax_t>(Size, End - Position));
+                    const size_t Done = File.ReadAt(Buffer, Length, Position);
+                    Position += Done;
+                    return Done;
+                }
+            };
+
+            /*
+             * Blocks of range are read by own thread into ring of
+             * ReadAheadDepth buffers, so reads overlap with work of caller.
+             * Direct mode reads aligned blocks past system cache.
+             */
+            class PrefetchReader : public RangeReader {
+            private:
+                struct Slot {
+                    std::unique_ptr<AlignedBuffer> Buffer;
+                    size_t Begin;
+                    size_t End;
+                    bool Ready;
+                };
+
+                RandomAccessFile File;
+                bool Direct;
+                uintmax_t Offset;
+                uintmax_t Size;
+                size_t BlockSize;
+                std::vector<Slot> Slots;
+                size_t Current;
+                bool Eof;
+                bool Stopped;
+                std::mutex Mutex;
+                std::condition_variable Condition;
+                std::thread Thread;
+
+                /*
+                 * Fill slot with block [Begin, Begin + Length) of file.
+                 * Returns false if block is short (end of file or error).
+                 */
+                bool Fetch(Slot &Block, uintmax_t Begin, size_t Length) {
+                    if (!Direct) {
+                        Block.Begin = 0;
+                        Block.End = File.ReadAt(Block.Buffer->Get(), Length, Begin);
+                        return Block.End == Length;
+                    }
+
+                    const uintmax_t Aligned = Begin - Begin % DirectAlignment;
+                    const size_t Skip = static_cast<size_t>(Begin - Aligned);
+                    const size_t Whole = (Skip + Length + DirectAlignment - 1) / DirectAlignment * DirectAlignment;
+                    const size_t Done = File.ReadAt(Block.Buffer->Get(), Whole, Aligned);
+
+                    Block.Begin = Skip;
+                    Block.End = std::min(std::max(Done, Skip), Skip + Length);
+                    return Block.End - Block.Begin == Length;
+                }
+
+                void Worker() {
+                    uintmax_t Done = 0;
+
+                    for (size_t Index = 0; Done < Size; Index++) {
+                        Slot &Block = Slots[Index % Slots.size()];
+
+                        {
+                            std::unique_lock<std::mutex> Lock(Mutex);
+                            Condition.wait(Lock, [&]() { return Stopped || !Block.Ready; });
+
+                            if (Stopped) {
+                                return;
+                            }
+                        }
+
+                        const size_t Length = static_cast<size_t>(std::min<uintmax_t>(BlockSize, Size - Done));
+                        const bool Whole = Fetch(Block, Offset + Done, Length);
+                        AddStat(StatPrefetchBytes, Block.End - Block.Begin);
+                        Done += Length;
+
+                        {
+                            std::lock_guard<std::mutex> Lock(Mutex);
+                            Block.Ready = true;
+
+                            // Consumer stops at the short block
+                            if (!Whole || Done >= Size) {
+                                Eof = true;
+                            }
+                        }
+                        Condition.notify_all();
+
+                        if (!Whole) {
+                            return;
+                        }
+                    }
+
+                    std::lock_guard<std::mutex> Lock(Mutex);
+                    Eof = true;
+                    Condition.notify_all();
+                }
+
+            public:
+                PrefetchReader(const fs::path &Path, uintmax_t Offset, uintmax_t Size, size_t BlockSize, bool Direct)
+                    : Direct(Direct), Offset(Offset), Size(Size), BlockSize(BlockSize),
+                    Current(0), Eof(false), Stopped(false) {
+                    // Filesystem may not support direct reads (tmpfs)
+                    if (!Direct || !File.OpenDirect(Path)) {
+                        this->Direct = false;
+                        File.Open(Path);
+                    }
+
+                    const size_t Capacity = this->Direct ? BlockSize + 2 * DirectAlignment : BlockSize;
+                    Slots.resize(ReadAheadDepth);
+
+                    for (Slot &Block : Slots) {
+                        Block.Buffer.reset(new AlignedBuffer(Capacity));
+                        Block.Begin = Block.End = 0;
+                        Block.Ready = false;
+                    }
+
+                    AllocBufferStat(Capacity * Slots.size());
+                    Thread = std::thread(&PrefetchReader::Worker, this);
+                }
+
+                ~PrefetchReader() override {
+                    {
+                        std::lock_guard<std::mutex> Lock(Mutex);
+                        Stopped = true;
+                    }
+                    Condition.notify_all();
+                    Thread.join();
+
+                    FreeBufferStat((Direct ? BlockSize + 2 * DirectAlignment : BlockSize) * Slots.size());
+                }
+
+                size_t Read(char *Buffer, size_t Length) override {
+                    size_t Done = 0;
+
+                    while (Done < Length) {
+                        Slot &Block = Slots[Current % Slots.size()];
+
+                        {
+                            std::unique_lock<std::mutex> Lock(Mutex);
+
+                            if (!Block.Ready) {
+                                const auto StartTime = std::chrono::steady_clock::now();
+                                Condition.wait(Lock, [&]() { return Block.Ready || Eof; });
+                                AddStatTime(StatIoWaitTime, std::chrono::steady_clock::now() - StartTime);
+
+                                // Eof is set with the last block, so it's ready if it exists
+                                if (!Block.Ready) {
+                                    break;
+                                }
+                            }
+                        }
+
+                        // Slot isn't touched by worker until it's released
+                        const size_t Part = std::min(Length - Done, Block.End - Block.Begin);
+                        std::memcpy(Buffer + Done, Block.Buffer->Get() + Block.Begin, Part);
+                        Block.Begin += Part;
+                        Done += Part;
+
+                        if (Block.Begin == Block.End) {
+                            {
+                                std::lock_guard<std::mutex> Lock(Mutex);
+                                Block.Ready = false;
+                            }
+                            Condition.notify_all();
+                            Current++;
+
+                            // Short block is the last one
+                            if (Part == 0) {
+                                break;
+                            }
+                        }
+                    }
+
+                    return Done;
+                }
+            };
+
+#if defined(RZ4_IO_URING)
+            /*
+             * Minimal io_uring (without liburing): UringDepth reads of next
+             * blocks are always queued, so device queue isn't empty while
+             * caller processes current block. No thread is needed.
+             */
+            class UringReader : public RangeReader {
+            private:
+                struct Slot {
+                    std::vector<char> Buffer;
+                    size_t Begin;
+                    size_t End;
+                    size_t Expected;
+                    bool Queued;
+                    bool Done;
+                };
+
+                RandomAccessFile File;
+                int Ring;
+                void *SqRing;
+                void *CqRing;
+                io_uring_sqe *Sqes;
+                size_t SqRingSize;
+                size_t CqRingSize;
+                size_t SqesSize;
+                unsigned *SqTail;
+                unsigned *SqMask;
+                unsigned *SqArray;
+                unsigned *CqHead;
+                unsigned *CqTail;
+                unsigned *CqMask;
+                io_uring_cqe *Cqes;
+
+                uintmax_t Offset;
+                uintmax_t Size;
+                size_t BlockSize;
+                std::vector<Slot> Slots;
+                uintmax_t CountOfBlocks;
+                uintmax_t NextSubmit;
+                uintmax_t Current;
+                unsigned int InFlight;
+                bool Failed;
+
+                /*
+                 * Queue read of next block. If kernel doesn't take it,
+                 * block is read at once, so reader never gets stuck.
+                 */
+                void Submit() {
+                    Slot &Block = Slots[NextSubmit % Slots.size()];
+                    const uintmax_t Begin = NextSubmit * BlockSize;
+
+                    Block.Begin = Block.End = 0;
+                    Block.Expected = static_cast<size_t>(std::min<uintmax_t>(BlockSize, Size - Begin));
+                    Block.Done = false;
+
+                    const unsigned Tail = *SqTail;
+                    const unsigned Index = Tail & *SqMask;
+                    io_uring_sqe &Sqe = Sqes[Index];
+
+                    std::memset(&Sqe, 0, sizeof(io_uring_sqe));
+                    Sqe.opcode = IORING_OP_READ;
+                    Sqe.fd = static_cast<int>(File.GetHandle());
+                    Sqe.addr = reinterpret_cast<uint64_t>(Block.Buffer.data());
+                    Sqe.len = static_cast<uint32_t>(Block.Expected);
+                    Sqe.off = Offset + Begin;
+                    Sqe.user_data = NextSubmit;
+
+                    SqArray[Index] = Index;
+                    __atomic_store_n(SqTail, Tail + 1, __ATOMIC_RELEASE);
+
+                    NextSubmit++;
+
+                    if (syscall(__NR_io_uring_enter, Ring, 1, 0, 0, nullptr, 0) != 1) {
+                        // Entry wasn't consumed by kernel, take it back
+                        __atomic_store_n(SqTail, Tail, __ATOMIC_RELEASE);
+                        Block.End = File.ReadAt(Block.Buffer.data(), Block.Expected, Offset + Begin);
+                        Block.Done = true;
+                        return;
+                    }
+
+                    Block.Queued = true;
+                    InFlight++;
+                }
+
+                bool Complete() {
+                    unsigned Head = *CqHead;
+
+                    while (Head == __atomic_load_n(CqTail, __ATOMIC_ACQUIRE)) {
+                        if (syscall(__NR_io_uring_enter, Ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+                            && errno != EINTR) {
+                            return false;
+                        }
+                    }
+
+                    const io_uring_cqe &Cqe = Cqes[Head & *CqMask];
+                    const uintmax_t Number = Cqe.user_data;
+                    Slot &Block = Slots[Number % Slots.size()];
+
+                    Block.End = Cqe.res > 0 ? static_cast<size_t>(Cqe.res) : 0;
+                    Block.Queued = false;
+                    InFlight--;
+
+                    __atomic_store_n(CqHead, Head + 1, __ATOMIC_RELEASE);
+                    AddStat(StatPrefetchBytes, Block.End);
+
+                    // Short read in the middle of file (or old kernel
+                    // without IORING_OP_READ), the rest is read here
+                    if (Block.End < Block.Expected) {
+                        Block.End += File.ReadAt(Block.Buffer.data() + Block.End, Block.Expected - Block.End,
+                            Offset + Number * BlockSize + Block.End);
+                    }
+
+                    Block.Done = true;
+                    return true;
+                }
+
+            public:
+                UringReader(const fs::path &Path, uintmax_t Offset, uintmax_t Size, size_t BlockSize)
+                    : Ring(-1), SqRing(MAP_FAILED), CqRing(MAP_FAILED), Sqes(nullptr),
+                    Offset(Offset), Size(Size), BlockSize(BlockSize),
+                    NextSubmit(0), Current(0), InFlight(0), Failed(false) {
+                    io_uring_params Params;
+                    std::memset(&Params, 0, sizeof(Params));
+
+                    CountOfBlocks = (Size + BlockSize - 1) / BlockSize;
+                    File.Open(Path);
+                    Ring = static_cast<int>(syscall(__NR_io_uring_setup, UringDepth, &Params));
+
+                    if (Ring < 0 || !File.IsOpen()) {
+                        Failed = true;
+                        return;
+                    }
+
+                    SqRingSize = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+                    CqRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof(io_uring_cqe);
+                    SqesSize = Params.sq_entries * sizeof(io_uring_sqe);
+
+                    SqRing = mmap(nullptr, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Ring, IORING_OFF_SQ_RING);
+                    CqRing = mmap(nullptr, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Ring, IORING_OFF_CQ_RING);
+                    void *SqesMap = mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Ring, IORING_OFF_SQES);
+
+                    if (SqRing == MAP_FAILED || CqRing == MAP_FAILED || SqesMap == MAP_FAILED) {
+                        if (SqesMap != MAP_FAILED) {
+                            munmap(SqesMap, SqesSize);
+                        }
+
+                        Failed = true;
+                        return;
+                    }
+
+                    char *Sq = static_cast<char*>(SqRing);
+                    char *Cq = static_cast<char*>(CqRing);
+                    Sqes = static_cast<io_uring_sqe*>(SqesMap);
+                    SqTail = reinterpret_cast<unsigned*>(Sq + Params.sq_off.tail);
+                    SqMask = reinterpret_cast<unsigned*>(Sq + Params.sq_off.ring_mask);
+                    SqArray = reinterpret_cast<unsigned*>(Sq + Params.sq_off.array);
+                    CqHead = reinterpret_cast<unsigned*>(Cq + Params.cq_off.head);
+                    CqTail = reinterpret_cast<unsigned*>(Cq + Params.cq_off.tail);
+                    CqMask = reinterpret_cast<unsigned*>(Cq + Params.cq_off.ring_mask);
+                    Cqes = reinterpret_cast<io_uring_cqe*>(Cq + Params.cq_off.cqes);
+
+                    Slots.resize(UringDepth);
+
+                    for (Slot &Block : Slots) {
+                        Block.Buffer.resize(BlockSize);
+                        Block.Begin = Block.End = Block.Expected = 0;
+                        Block.Queued = Block.Done = false;
+                    }
+
+                    AllocBufferStat(BlockSize * Slots.size());
+
+                    while (NextSubmit < CountOfBlocks && NextSubmit < Slots.size()) {
+                        Submit();
+                    }
+                }
+
+                ~UringReader() override {
+                    // Kernel writes to buffers until reads are complete
+                    while (InFlight > 0 && Complete()) {
+                    }
+
+                    if (Sqes != nullptr) {
+                        munmap(Sqes, SqesSize);
+                        FreeBufferStat(BlockSize * Slots.size());
+                    }
+
+                    if (SqRing != MAP_FAILED) {
+                        munmap(SqRing, SqRingSize);
+                    }
+
+                    if (CqRing != MAP_FAILED) {
+                        munmap(CqRing, CqRingSize);
+                    }
+
+                    if (Ring >= 0) {
+                        close(Ring);
+                    }
+                }
+
+                bool IsReady() const {
+                    return !Failed;
+                }
+
+                size_t Read(char *Buffer, size_t Length) override {
+                    size_t Done = 0;
+
+                    while (Done < Length && Current < CountOfBlocks) {
+                        Slot &Block = Slots[Current % Slots.size()];
+
+                        if (!Block.Done) {
+                            const auto StartTime = std::chrono::steady_clock::now();
+
+                            while (!Block.Done && Complete()) {
+                            }
+
+                            AddStatTime(StatIoWaitTime, std::chrono::steady_clock::now() - StartTime);
+
+                            if (!Block.Done) {
+                                break;
+                            }
+                        }
+
+                        const size_t Part = std::min(Length - Done, Block.End - Block.Begin);
+                        std::memcpy(Buffer + Done, Block.Buffer.data() + Block.Begin, Part);
+                        Block.Begin += Part;
+                        Done += Part;
+
+                        if (Block.Begin < Block.End) {
+                            continue;
+                        }
+
+                        // End of file (or error) is in this block
+                        if (Block.End < Block.Expected) {
+                            break;
+                        }
+
+                        Block.Done = false;
+                        Current++;
+
+                        if (NextSubmit < CountOfBlocks) {
+                            Submit();
+                        }
+                    }
+
+                    return Done;
+                }
+            };
+#endif
+
+            bool UringSupported() {
+#if defined(RZ4_IO_URING)
+                io_uring_params Params;
+                std::memset(&Params, 0, sizeof(Params));
+                const int Ring = static_cast<int>(syscall(__NR_io_uring_setup, 1, &Params));
+
+                if (Ring < 0) {
+                    return false;
+                }
+
+                close(Ring);
+                return true;
+#else
+                return false;
+#endif
+            }
+        }
+
+        /*
+         * Select backend by name, io_uring falls back to read-ahead
+         * if kernel (or build) doesn't have it.
+         */
+        bool SetIoBackend(const std::string &Name) {
+            if (Name == "buffered") {
+                Backend = IoBuffered;
+            } else if (Name == "readahead") {
+                Backend = IoReadAhead;
+            } else if (Name == "direct") {
+                Backend = IoDirect;
+            } else if (Name == "uring") {
+                Backend = UringSupported() ? IoUring : IoReadAhead;
+            } else {
+                return false;
+            }
+
+            return true;
+        }
+
+        IoBackend GetIoBackend() {
+            return static_cast<IoBackend>(Backend.load());
+        }
+
+        const char *IoBackendName() {
+            switch (GetIoBackend()) {
+                case IoBuffered:
+                    return "buffered";
+                case IoDirect:
+                    return "direct";
+                case IoUring:
+                    return "uring";
+                default:
+                    return "readahead";
+            }
+        }
+
+        /*
+         * Reader of Size bytes of file from Offset by blocks of BlockSize.
+         * Short ranges are always read by plain positional reads.
+         */
+        std::unique_ptr<RangeReader> OpenRangeReader(const fs::path &Path, uintmax_t Offset, uintmax_t Size, size_t BlockSize) {
+            const IoBackend Selected = GetIoBackend();
+
+            BlockSize = std::max<size_t>(BlockSize, DirectAlignment);
+
+            if (Selected == IoBuffered || Size <= BlockSize * MinPrefetchBlocks) {
+                return std::unique_ptr<RangeReader>(new BufferedReader(Path, Offset, Size));
+            }
+
+#if defined(RZ4_IO_URING)
+            if (Selected == IoUring) {
+                std::unique_ptr<UringReader> Reader(new UringReader(Path, Offset, Size, BlockSize));
+
+                if (Reader->IsReady()) {
+                    return Reader;
+                }
+            }
+#endif
+
+            return std::unique_ptr<RangeReader>(new PrefetchReader(Path, Offset, Size, BlockSize, Selected == IoDirect));
+        }
+    }
+}
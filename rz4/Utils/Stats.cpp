@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Utils.hpp"
+#include "stdafx.hpp"
+
+#include <atomic>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <ctime>
+#include <sys/resource.h>
+#endif
+
+namespace rz4 {
+    namespace Utils {
+        namespace {
+            enum StatKind { StatBytes, StatCount, StatTime };
+
+            typedef struct StatName {
+                const char *Group;
+                const char *Name;
+                StatKind Kind;
+            } StatName;
+
+            // In order of Stat, grouped by stage
+            const StatName StatNames[CountOfStats] = {
+                { "scan", "bytes_read", StatBytes },
+                { "scan", "candidates", StatCount },
+                { "scan", "accepted", StatCount },
+                { "scan", "time", StatTime },
+                { "scan", "cache_hits", StatCount },
+                { "compress", "bytes_read", StatBytes },
+                { "compress", "bytes_written", StatBytes },
+                { "compress", "streams_encoded", StatCount },
+                { "compress", "streams_stored_raw", StatCount },
+                { "compress", "streams_skipped_by_estimate", StatCount },
+                { "compress", "streams_downgraded_by_estimate", StatCount },
+                { "compress", "streams_deduplicated", StatCount },
+                { "compress", "deduplicated_bytes", StatBytes },
+                { "compress", "gap_blocks_encoded", StatCount },
+                { "compress", "gap_blocks_stored_raw", StatCount },
+                { "compress", "streams_reused", StatCount },
+                { "compress", "encode_wall_time", StatTime },
+                { "compress", "encode_cpu_time", StatTime },
+                { "compress", "write_time", StatTime },
+                { "compress", "wait_time", StatTime },
+                { "restore", "bytes_read", StatBytes },
+                { "restore", "bytes_written", StatBytes },
+                { "restore", "streams_decoded", StatCount },
+                { "extract", "streams", StatCount },
+                { "extract", "bytes", StatBytes },
+                { "extract", "time", StatTime },
+                { "crc32", "bytes", StatBytes },
+                { "crc32", "time", StatTime },
+                { "copy", "bytes", StatBytes },
+                { "copy", "kernel_bytes", StatBytes },
+                { "io", "prefetch_bytes", StatBytes },
+                { "io", "wait_time", StatTime },
+                { "memory", "peak_buffer_bytes", StatBytes },
+                { "process", "wall_time", StatTime }
+            };
+
+            // Times are kept in nanoseconds
+            std::atomic<uintmax_t> Counters[CountOfStats];
+            std::atomic<uintmax_t> BufferMemory(0);
+
+            std::chrono::duration<double> ProcessCpuTime() {
+#if defined(_WIN32)
+                FILETIME Creation, Exit, Kernel, User;
+
+                if (!GetProcessTimes(GetCurrentProcess(), &Creation, &Exit, &Kernel, &User)) {
+                    return std::chrono::duration<double>::zero();
+                }
+
+                const uint64_t Ticks = (static_cast<uint64_t>(Kernel.dwHighDateTime) << 32 | Kernel.dwLowDateTime)
+                    + (static_cast<uint64_t>(User.dwHighDateTime) << 32 | User.dwLowDateTime);
+                return std::chrono::duration<double>(Ticks / 1e7);
+#else
+                struct rusage Usage;
+                getrusage(RUSAGE_SELF, &Usage);
+                return std::chrono::duration<double>(Usage.ru_utime.tv_sec + Usage.ru_stime.tv_sec
+                    + (Usage.ru_utime.tv_usec + Usage.ru_stime.tv_usec) / 1e6);
+#endif
+            }
+
+            // External packers run as child processes
+            std::chrono::duration<double> ChildrenCpuTime() {
+#if defined(_WIN32)
+                return std::chrono::duration<double>::zero();
+#else
+                struct rusage Usage;
+                getrusage(RUSAGE_CHILDREN, &Usage);
+                return std::chrono::duration<double>(Usage.ru_utime.tv_sec + Usage.ru_stime.tv_sec
+                    + (Usage.ru_utime.tv_usec + Usage.ru_stime.tv_usec) / 1e6);
+#endif
+            }
+
+            uintmax_t PeakResidentMemory() {
+#if defined(_WIN32)
+                PROCESS_MEMORY_COUNTERS Memory;
+
+                if (!GetProcessMemoryInfo(GetCurrentProcess(), &Memory, sizeof(Memory))) {
+                    return 0;
+                }
+
+                return Memory.PeakWorkingSetSize;
+#else
+                struct rusage Usage;
+                getrusage(RUSAGE_SELF, &Usage);
+#if defined(__APPLE__)
+                return static_cast<uintmax_t>(Usage.ru_maxrss);
+#else
+                return static_cast<uintmax_t>(Usage.ru_maxrss) * 1024;
+#endif
+#endif
+            }
+
+            void WriteValue(std::ostream &Out, StatKind Kind, uintmax_t Value) {
+                if (Kind == StatTime) {
+                    Out << boost::format("%.6f") % (Value / 1e9);
+                } else {
+                    Out << Value;
+                }
+            }
+        }
+
+        /*
+         * Counters are shared by all threads and may be updated
+         * from hot paths, so they are relaxed atomics only.
+         */
+        void AddStat(Stat Counter, uintmax_t Value) {
+            Counters[Counter].fetch_add(Value, std::memory_order_relaxed);
+        }
+
+        void AddStatTime(Stat Counter, std::chrono::duration<double> Time) {
+            AddStat(Counter, static_cast<uintmax_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Time).count()));
+        }
+
+        uintmax_t GetStat(Stat Counter) {
+            return Counters[Counter].load(std::memory_order_relaxed);
+        }
+
+        /*
+         * Buffers of engines (blocks, queued streams, payloads)
+         * are counted here, StatPeakBufferMemory keeps the maximum.
+         */
+        void AllocBufferStat(uintmax_t Size) {
+            const uintmax_t Now = BufferMemory.fetch_add(Size, std::memory_order_relaxed) + Size;
+            uintmax_t Peak = Counters[StatPeakBufferMemory].load(std::memory_order_relaxed);
+
+            while (Now > Peak && !Counters[StatPeakBufferMemory].compare_exchange_weak(Peak, Now, std::memory_order_relaxed));
+        }
+
+        void FreeBufferStat(uintmax_t Size) {
+            BufferMemory.fetch_sub(Size, std::memory_order_relaxed);
+        }
+
+        /*
+         * CPU time of calling thread.
+         */
+        std::chrono::duration<double> ThreadCpuTime() {
+#if defined(_WIN32)
+            FILETIME Creation, Exit, Kernel, User;
+
+            if (!GetThreadTimes(GetCurrentThread(), &Creation, &Exit, &Kernel, &User)) {
+                return std::chrono::duration<double>::zero();
+            }
+
+            const uint64_t Ticks = (static_cast<uint64_t>(Kernel.dwHighDateTime) << 32 | Kernel.dwLowDateTime)
+                + (static_cast<uint64_t>(User.dwHighDateTime) << 32 | User.dwLowDateTime);
+            return std::chrono::duration<double>(Ticks / 1e7);
+#else
+            struct timespec Time;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Time);
+            return std::chrono::duration<double>(Time.tv_sec + Time.tv_nsec / 1e9);
+#endif
+        }
+
+        /*
+         * Write all counters as JSON object, one object per stage.
+         * Bytes and counts are integers, times are seconds.
+         */
+        void WriteStats(std::ostream &Out) {
+            const char *Group = nullptr;
+
+            Out << "{";
+
+            for (int i = 0; i < CountOfStats; i++) {
+                const StatName &Name = StatNames[i];
+
+                if (Group == nullptr || std::strcmp(Group, Name.Group) != 0) {
+                    Out << (Group == nullptr ? "" : "},") << std::endl << "  \"" << Name.Group << "\": {";
+                    Group = Name.Group;
+                } else {
+                    Out << ", ";
+                }
+
+                Out << "\"" << Name.Name << "\": ";
+                WriteValue(Out, Name.Kind, GetStat(static_cast<Stat>(i)));
+            }
+
+            // "process" is the last group, counters of OS are added to it
+            Out << ", \"cpu_time\": ";
+            WriteValue(Out, StatTime, static_cast<uintmax_t>(ProcessCpuTime().count() * 1e9));
+            Out << ", \"children_cpu_time\": ";
+            WriteValue(Out, StatTime, static_cast<uintmax_t>(ChildrenCpuTime().count() * 1e9));
+            Out << ", \"peak_rss_bytes\": " << PeakResidentMemory();
+            Out << "}" << std::endl << "}" << std::endl;
+        }
+    }
+}
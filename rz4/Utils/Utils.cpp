@@ -20,8 +20,280 @@
 #include "Utils.hpp"
 #include "stdafx.hpp"
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RZ4_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RZ4_SSE2 1
+#endif
+
+#if defined(RZ4_X86) && (defined(_MSC_VER) || defined(__GNUC__))
+#define RZ4_AVX2 1
+#endif
+
+#if defined(_MSC_VER)
+#define RZ4_TARGET_AVX2
+#else
+#define RZ4_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
 namespace rz4 {
     namespace Utils {
+        namespace {
+            typedef int(*SignatureMatchKernel)(const char*, unsigned int, const char*, const char*, unsigned int, unsigned int);
+
+            inline unsigned int CountTrailingZeros(uint32_t Value) {
+#if defined(_MSC_VER)
+                unsigned long Index;
+                _BitScanForward(&Index, Value);
+                return static_cast<unsigned int>(Index);
+#else
+                return static_cast<unsigned int>(__builtin_ctz(Value));
+#endif
+            }
+
+            inline unsigned int CountTrailingZeros64(uint64_t Value) {
+                uint32_t Low = static_cast<uint32_t>(Value);
+                return Low ? CountTrailingZeros(Low) : 32 + CountTrailingZeros(static_cast<uint32_t>(Value >> 32));
+            }
+
+            int SignatureMatchScalar(
+                const char *Buffer,
+                unsigned int BufferSize,
+                const char *First,
+                const char *Second,
+                unsigned int Distance,
+                unsigned int Offset) {
+                if (BufferSize < Distance + 4) {
+                    return -1;
+                }
+
+                const unsigned int Last = BufferSize - Distance - 4;
+
+                while (Offset <= Last) {
+                    const char *Found = reinterpret_cast<const char*>(std::memchr(Buffer + Offset, First[0], Last - Offset + 1));
+
+                    if (!Found) {
+                        return -1;
+                    }
+
+                    Offset = static_cast<unsigned int>(Found - Buffer);
+
+                    if (std::memcmp(Buffer + Offset, First, 4) == 0
+                        && std::memcmp(Buffer + Offset + Distance, Second, 4) == 0) {
+                        return static_cast<int>(Offset);
+                    }
+
+                    Offset++;
+                }
+
+                return -1;
+            }
+
+            /*
+             * Vector kernels test first and last bytes of both needles
+             * for a whole register of positions at once, so only positions
+             * where all four bytes match are checked with memcmp.
+             */
+#if defined(RZ4_SSE2)
+            int SignatureMatchSSE2(
+                const char *Buffer,
+                unsigned int BufferSize,
+                const char *First,
+                const char *Second,
+                unsigned int Distance,
+                unsigned int Offset) {
+                if (BufferSize < Distance + 4) {
+                    return -1;
+                }
+
+                const unsigned int Last = BufferSize - Distance - 4;
+                const __m128i F0 = _mm_set1_epi8(First[0]);
+                const __m128i F3 = _mm_set1_epi8(First[3]);
+                const __m128i S0 = _mm_set1_epi8(Second[0]);
+                const __m128i S3 = _mm_set1_epi8(Second[3]);
+
+                for (; Offset + 16 <= Last + 1; Offset += 16) {
+                    const char *P = Buffer + Offset;
+                    __m128i A = _mm_and_si128(
+                        _mm_cmpeq_epi8(F0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(P))),
+                        _mm_cmpeq_epi8(F3, _mm_loadu_si128(reinterpret_cast<const __m128i*>(P + 3))));
+                    __m128i B = _mm_and_si128(
+                        _mm_cmpeq_epi8(S0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(P + Distance))),
+                        _mm_cmpeq_epi8(S3, _mm_loadu_si128(reinterpret_cast<const __m128i*>(P + Distance + 3))));
+                    uint32_t Mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(A, B)));
+
+                    while (Mask) {
+                        unsigned int Bit = CountTrailingZeros(Mask);
+
+                        if (std::memcmp(P + Bit + 1, First + 1, 2) == 0
+                            && std::memcmp(P + Bit + Distance + 1, Second + 1, 2) == 0) {
+                            return static_cast<int>(Offset + Bit);
+                        }
+
+                        Mask &= Mask - 1;
+                    }
+                }
+
+                return SignatureMatchScalar(Buffer, BufferSize, First, Second, Distance, Offset);
+            }
+#endif
+
+#if defined(RZ4_AVX2)
+            RZ4_TARGET_AVX2 int SignatureMatchAVX2(
+                const char *Buffer,
+                unsigned int BufferSize,
+                const char *First,
+                const char *Second,
+                unsigned int Distance,
+                unsigned int Offset) {
+                if (BufferSize < Distance + 4) {
+                    return -1;
+                }
+
+                const unsigned int Last = BufferSize - Distance - 4;
+                const __m256i F0 = _mm256_set1_epi8(First[0]);
+                const __m256i F3 = _mm256_set1_epi8(First[3]);
+                const __m256i S0 = _mm256_set1_epi8(Second[0]);
+                const __m256i S3 = _mm256_set1_epi8(Second[3]);
+
+                // Two registers per iteration, masks are checked only when something matched
+                for (; Offset + 64 <= Last + 1; Offset += 64) {
+                    const char *P = Buffer + Offset;
+                    __m256i Lo = _mm256_and_si256(
+                        _mm256_and_si256(
+                            _mm256_cmpeq_epi8(F0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(P))),
+                            _mm256_cmpeq_epi8(F3, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(P + 3)))),
+                        _mm256_and_si256(
+                            _mm256_cmpeq_epi8(S0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(P + Distance))),
+                            _mm256_cmpeq_epi8(S3, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(P + Distance + 3)))));
+                    __m256i Hi = _mm256_and_si256(
+                        _mm256_and_si256(
+                            _mm256_cmpeq_epi8(F0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(P + 32))),
+                            _mm256_cmpeq_epi8(F3, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(P + 35)))),
+                        _mm256_and_si256(
+                            _mm256_cmpeq_epi8(S0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(P + Distance + 32))),
+                            _mm256_cmpeq_epi8(S3, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(P + Distance + 35)))));
+
+                    if (_mm256_testz_si256(_mm256_or_si256(Lo, Hi), _mm256_or_si256(Lo, Hi))) {
+                        continue;
+                    }
+
+                    uint64_t Mask = static_cast<uint32_t>(_mm256_movemask_epi8(Lo))
+                        | (static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(Hi))) << 32);
+
+                    while (Mask) {
+                        unsigned int Bit = CountTrailingZeros64(Mask);
+
+                        if (std::memcmp(P + Bit + 1, First + 1, 2) == 0
+                            && std::memcmp(P + Bit + Distance + 1, Second + 1, 2) == 0) {
+                            return static_cast<int>(Offset + Bit);
+                        }
+
+                        Mask &= Mask - 1;
+                    }
+                }
+
+                return SignatureMatchScalar(Buffer, BufferSize, First, Second, Distance, Offset);
+            }
+#endif
+
+            SignatureMatchKernel SelectSignatureMatchKernel(const char *&Name) {
+#if defined(RZ4_AVX2)
+                if (CpuSupportsAVX2()) {
+                    Name = "avx2";
+                    return SignatureMatchAVX2;
+                }
+#endif
+#if defined(RZ4_SSE2)
+                Name = "sse2";
+                return SignatureMatchSSE2;
+#else
+                Name = "scalar";
+                return SignatureMatchScalar;
+#endif
+            }
+
+            struct SignatureMatchDispatch {
+                const char *Name;
+                SignatureMatchKernel Kernel;
+
+                SignatureMatchDispatch() : Name(nullptr) {
+                    Kernel = SelectSignatureMatchKernel(Name);
+                }
+            };
+
+            const SignatureMatchDispatch &GetSignatureMatchDispatch() {
+                static const SignatureMatchDispatch Dispatch;
+                return Dispatch;
+            }
+        }
+
+        /*
+         * Check that CPU and OS support AVX2 instructions.
+         */
+        bool CpuSupportsAVX2() {
+#if defined(RZ4_X86) && defined(_MSC_VER)
+            int Info[4];
+            __cpuid(Info, 0);
+
+            if (Info[0] < 7) {
+                return false;
+            }
+
+            __cpuid(Info, 1);
+
+            // OSXSAVE and AVX
+            if ((Info[2] & (1 << 27)) == 0 || (Info[2] & (1 << 28)) == 0) {
+                return false;
+            }
+
+            // OS saves XMM and YMM registers
+            if ((_xgetbv(0) & 0x6) != 0x6) {
+                return false;
+            }
+
+            __cpuidex(Info, 7, 0);
+            return (Info[1] & (1 << 5)) != 0;
+#elif defined(RZ4_X86)
+            return __builtin_cpu_supports("avx2") != 0;
+#else
+            return false;
+#endif
+        }
+
+        /*
+         * Find position of signature which consists of two 4-byte parts:
+         * `First` at the position and `Second` at the position + `Distance`
+         * (e.g. "RIFF" and "WAVE" with distance 8).
+         * Both parts must fit into buffer.
+         * If found - return index.
+         * If not - return -1.
+         */
+        int SignatureMatch(
+            const char *Buffer,
+            unsigned int BufferSize,
+            const char *First,
+            const char *Second,
+            unsigned int Distance,
+            unsigned int Offset) {
+            return GetSignatureMatchDispatch().Kernel(Buffer, BufferSize, First, Second, Distance, Offset);
+        }
+
+        /*
+         * Name of SignatureMatch implementation selected for current CPU.
+         */
+        const char *SignatureMatchKernelName() {
+            return GetSignatureMatchDispatch().Name;
+        }
+
         /*
          * Find char in array.
          * If found - return index.
@@ -112,8 +384,13 @@ namespace rz4 {
                 }
                 i++;
             }
+        }
 
-            
+        /*
+         * "-" as file name means stdin (input) or stdout (output).
+         */
+        bool IsStdStream(const fs::path &Path) {
+            return Path == "-";
         }
 
         /*
@@ -165,138 +442,5 @@ namespace rz4 {
         std::string PrettyTime(std::chrono::duration<double> Time) {
             return PrettyTime(static_cast<uintmax_t>(std::chrono::duration_cast<std::chrono::milliseconds>(Time).count()));
         }
-
-        /* CRC32 (From https://gist.github.com/timepp/1f678e200d9e0f2a043a9ec6b3690635) */
-
-        void GenerateTableCRC32(uint32_t(&Table)[256]) {
-            uint32_t polynomial = 0xEDB88320;
-            for (uint32_t i = 0; i < 256; i++) {
-                uint32_t c = i;
-                for (size_t j = 0; j < 8; j++) {
-                    if (c & 1) {
-                        c = polynomial ^ (c >> 1);
-                    }
-                    else {
-                        c >>= 1;
-                    }
-                }
-
-                Table[i] = c;
-            }
-        }
-
-        uint32_t UpdateCRC32(uint32_t(&Table)[256], uint32_t Initial, const void *Buffer, size_t Length) {
-            uint32_t c = Initial ^ 0xFFFFFFFF;
-            const uint8_t* u = static_cast<const uint8_t*>(Buffer);
-            for (size_t i = 0; i < Length; ++i) {
-                c = Table[(c ^ u[i]) & 0xFF] ^ (c >> 8);
-            }
-            return c ^ 0xFFFFFFFF;
-        }
-
-        uint32_t CalculateCRC32InStream(uint32_t(&TableCRC32)[256], std::ifstream &File, uintmax_t Offset, uintmax_t Size) {
-            unsigned int BufferSize = 16 * 1024 * 1024;
-            uintmax_t ReadBytes = 0;
-            std::streampos OldOffset = File.tellg();
-            File.seekg(Offset, std::fstream::beg);
-
-            if (Size < BufferSize) {
-                BufferSize = static_cast<unsigned int>(Size);
-            }
-
-            char *Buffer = new char[BufferSize];
-            uint32_t CRC32 = 0;
-
-            while (ReadBytes < Size) {
-                if ((ReadBytes + BufferSize) > Size) {
-                    BufferSize = static_cast<unsigned int>(Size - ReadBytes);
-                    delete[] Buffer;
-                    Buffer = new char[BufferSize];
-                }
-
-                File.read(Buffer, BufferSize);
-                CRC32 = UpdateCRC32(TableCRC32, CRC32, Buffer, BufferSize);
-
-                ReadBytes += BufferSize;
-            }
-
-            File.seekg(OldOffset, std::fstream::beg);
-            return CRC32;
-        }
-
-        /*
-        * Inject data from input stream to output.
-        * Inject by source offset and size to current position
-        * in dest stream.
-        */
-        void InjectDataFromStreamToStream(
-            std::ifstream& Src,
-            std::ofstream& Dst,
-            uintmax_t SrcOffset,
-            uintmax_t SrcSize) {
-            unsigned int BufferSize = 256 * 1024;
-            uintmax_t ReadBytes = 0;
-            Src.seekg(SrcOffset, std::fstream::beg);
-
-            if (SrcSize < BufferSize) {
-                BufferSize = static_cast<unsigned int>(SrcSize);
-            }
-
-            char *Buffer = new char[BufferSize];
-
-            while (ReadBytes < SrcSize) {
-                if ((ReadBytes + BufferSize) > SrcSize) {
-                    BufferSize = static_cast<unsigned int>(SrcSize - ReadBytes);
-                    delete[] Buffer;
-                    Buffer = new char[BufferSize];
-                }
-
-                Src.read(Buffer, BufferSize);
-                Dst.write(Buffer, BufferSize);
-
-                ReadBytes += BufferSize;
-            }
-        }
-
-        /*
-        * Extract data from input stream to file.
-        * By transmitted offset and size copy data from src-stream
-        * and write to out file.
-        */
-        void ExtactDataFromStreamToFile(
-            std::ifstream& Src,
-            uintmax_t Offset,
-            uintmax_t Size,
-            std::string OutFileName) {
-            unsigned int BufferSize = 256 * 1024;
-            Src.seekg(Offset, std::fstream::beg);
-
-            if (Size < BufferSize) {
-                BufferSize = static_cast<unsigned int>(Size);
-            }
-
-            uintmax_t ReadBytes = 0;
-            char *Buffer = new char[BufferSize];
-            std::ofstream OutFile(OutFileName);
-
-            if (!OutFile.is_open()) {
-                return;
-            }
-
-            while (ReadBytes < Size) {
-                if ((ReadBytes + BufferSize) > Size) {
-                    BufferSize = static_cast<unsigned int>(Size - ReadBytes);
-                    delete[] Buffer;
-                    Buffer = new char[BufferSize];
-                }
-
-                Src.read(Buffer, BufferSize);
-                OutFile.write(Buffer, BufferSize);
-                ReadBytes += BufferSize;
-            }
-
-            delete[] Buffer;
-            OutFile.close();
-        }
     }
 }
@@ -27,6 +27,7 @@
 #include <cmath>
 #include <chrono>
 #include <fstream>
+#include <memory>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 
@@ -35,19 +36,148 @@ namespace rz4 {
         namespace fs = boost::filesystem;
 
         int CharMatch(const char *Buffer, unsigned int BufferSize, char Needle, unsigned int Offset = 0);
+        int SignatureMatch(const char *Buffer, unsigned int BufferSize, const char *First, const char *Second,
+            unsigned int Distance, unsigned int Offset = 0);
+        const char *SignatureMatchKernelName();
+        bool CpuSupportsAVX2();
         long long MemToll(std::string str);
         std::string HumanizeSize(uintmax_t Bytes);
         std::string GenerateUniqueFolderName(std::string FirstPrefix, std::string SecondPrefix);
         std::string GenerateTmpFileName(const std::string&, std::string = ".dat");
+        bool IsStdStream(const fs::path&);
 
         std::string PrettyTime(uintmax_t);
         std::string PrettyTime(std::chrono::duration<double>);
 
+        // CRC32.cpp
+        bool CpuSupportsPCLMUL();
+        const char *CRC32KernelName();
         void GenerateTableCRC32(uint32_t(&)[256]);
-        uint32_t CalculateCRC32InStream(uint32_t(&)[256], std::ifstream&, uintmax_t, uintmax_t);
+        uint32_t UpdateCRC32(uint32_t, const void*, size_t);
+        uint32_t CombineCRC32(uint32_t, uint32_t, uintmax_t);
+        uint32_t CalculateCRC32InStream(std::ifstream&, uintmax_t, uintmax_t);
+        uint32_t CalculateCRC32InFile(const fs::path&, uintmax_t, uintmax_t, unsigned int = 1);
 
-        void InjectDataFromStreamToStream(std::ifstream&, std::ofstream&, uintmax_t, uintmax_t);
-        void ExtactDataFromStreamToFile(std::ifstream&, uintmax_t, uintmax_t, std::string);
+        // Hash.cpp
+        typedef struct Hash128 {
+            uint64_t Low;
+            uint64_t High;
+
+            bool operator<(const Hash128 &Other) const {
+                return Low != Other.Low ? Low < Other.Low : High < Other.High;
+            }
+
+            bool operator==(const Hash128 &Other) const {
+                return Low == Other.Low && High == Other.High;
+            }
+        } Hash128;
+
+        Hash128 CalculateHash128(const void*, size_t, uint64_t = 0);
+
+        // Stats.cpp
+        enum Stat {
+            StatScanBytesRead,
+            StatScanCandidates,
+            StatScanAccepted,
+            StatScanTime,
+            StatScanCacheHits,
+            StatCompressBytesRead,
+            StatCompressBytesWritten,
+            StatStreamsEncoded,
+            StatStreamsStoredRaw,
+            StatStreamsSkipped,
+            StatStreamsDowngraded,
+            StatStreamsDeduplicated,
+            StatDeduplicatedBytes,
+            StatGapBlocksEncoded,
+            StatGapBlocksStoredRaw,
+            StatStreamsReused,
+            StatEncodeWallTime,
+            StatEncodeCpuTime,
+            StatWriteTime,
+            StatWaitTime,
+            StatRestoreBytesRead,
+            StatRestoreBytesWritten,
+            StatStreamsDecoded,
+            StatStreamsExtracted,
+            StatExtractBytes,
+            StatExtractTime,
+            StatCRC32Bytes,
+            StatCRC32Time,
+            StatCopyBytes,
+            StatKernelCopyBytes,
+            StatPrefetchBytes,
+            StatIoWaitTime,
+            StatPeakBufferMemory,
+            StatProcessTime,
+            CountOfStats
+        };
+
+        void AddStat(Stat, uintmax_t);
+        void AddStatTime(Stat, std::chrono::duration<double>);
+        uintmax_t GetStat(Stat);
+        void AllocBufferStat(uintmax_t);
+        void FreeBufferStat(uintmax_t);
+        std::chrono::duration<double> ThreadCpuTime();
+        void WriteStats(std::ostream&);
+
+        // FileCopy.cpp
+
+        /*
+         * File for positional reads / writes, one handle can be used
+         * by many threads at once: there is no shared position.
+         */
+        class RandomAccessFile {
+        private:
+            intptr_t Handle;
+
+        public:
+            RandomAccessFile();
+            ~RandomAccessFile();
+            RandomAccessFile(const RandomAccessFile&) = delete;
+            RandomAccessFile &operator=(const RandomAccessFile&) = delete;
+
+            bool Open(const fs::path&);
+            bool OpenDirect(const fs::path&);
+            bool Create(const fs::path&);
+            bool IsOpen() const;
+            void Close();
+            size_t ReadAt(void*, size_t, uintmax_t) const;
+            bool WriteAt(const void*, size_t, uintmax_t) const;
+            bool Preallocate(uintmax_t) const;
+            intptr_t GetHandle() const;
+        };
+
+        uintmax_t KernelCopy(const fs::path&, uintmax_t, const fs::path&, uintmax_t, uintmax_t);
+        uintmax_t KernelCopy(const RandomAccessFile&, uintmax_t, const RandomAccessFile&, uintmax_t, uintmax_t);
+        bool CopyDataFromFileToFile(const fs::path&, uintmax_t, const fs::path&, uintmax_t, uintmax_t);
+        bool ExtractDataFromFileToFile(const fs::path&, uintmax_t, uintmax_t, const fs::path&);
+
+        // Io.cpp
+        enum IoBackend {
+            IoBuffered,
+            IoReadAhead,
+            IoDirect,
+            IoUring
+        };
+
+        bool SetIoBackend(const std::string&);
+        IoBackend GetIoBackend();
+        const char *IoBackendName();
+
+        /*
+         * Sequential reader of part of file, all engines read input
+         * through it. Backend is the same for whole process.
+         */
+        class RangeReader {
+        public:
+            virtual ~RangeReader() {}
+
+            // Count of read bytes, less than asked only at the end of range or on error
+            virtual size_t Read(char*, size_t) = 0;
+        };
+
+        std::unique_ptr<RangeReader> OpenRangeReader(const fs::path&, uintmax_t, uintmax_t, size_t);
     }
 }
 
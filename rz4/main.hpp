@@ -21,12 +21,23 @@
 #define RZ4M_RZ4M_H
 
 #include <chrono>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 #include <boost/format.hpp>
 
 #include "Engine/Scanner.hpp"
 #include "Engine/Compressor.hpp"
+#include "Engine/Restorer.hpp"
+#include "Engine/Extractor.hpp"
+#include "Engine/WorkerPool.hpp"
 #include "Utils/Utils.hpp"
 #include "Types/Types.hpp"
 
@@ -34,6 +45,8 @@
 #define COMMAND_SCAN      "s"
 #define COMMAND_COMPRESS  "c"
 #define COMMAND_EXTRACT   "e"
+#define COMMAND_RESTORE   "r"
+#define COMMAND_UPDATE    "u"
 
 namespace rz4 {
     static const std::string Logo =
@@ -51,20 +64,41 @@ namespace rz4 {
 
     static const std::string UsageMessage =
         "Usage:\n"
-        "    rz4 <command> [options] <input_file>\n\n"
+        "    rz4 <command> [options] <input_file>\n"
+        "    rz4 c [options] <input_file | folder> ...\n"
+        "    (\"-\" as input file - read stdin, for scan and compress only)\n"
+        "    (several inputs: every file to own .rzf, encoders of all files share --jobs)\n\n"
         "    Commands:\n"
         "      c - compress input file\n"
         "      s - scan only input file\n"
-        "      e - extract found streams from input file\n\n"
+        "      e - extract found streams from input file\n"
+        "      r - restore original file from .rzf archive\n"
+        "      u - update .rzf archive of input file which was appended to\n\n"
         "    Detect options:\n"
-        "      --wav=N          - enable RIFF WAVE detect (default: 1)\n\n"
+        "      --wav=N          - enable RIFF WAVE detect (default: 1)\n"
+        "      --cache=N        - keep found streams in <input_file>.rz4scan and reuse\n"
+        "                         them while input isn't changed (default: 0)\n\n"
         "    Compress options:\n"
+        "      --pcm=N          - built-in PCM codec level (0..8) (default: 5)\n"
         "      --wavpack=N      - WAVPACK compression level (0..2) (default: 0)\n"
-        "      --tak=N          - TAK compression level (0..9) (default: 9)\n\n"
+        "      --tak=N          - TAK compression level (0..9) (default: 0)\n"
+        "      (external TAK / WAVPACK encoders are used instead of built-in codec if set)\n"
+        "      --mingain=N      - don't encode streams with predicted gain below N% (0 - off) (default: 1)\n"
+        "      --dedup=N        - store identical streams once (default: 1)\n"
+        "      --gaps=N         - compress data between streams with built-in LZ codec (default: 0)\n"
+        "      --jobs=N         - number of parallel encoders, 0 - auto (default: 0)\n\n"
         "    Other options:\n"
-        "      --out=<filename> - path to output file name\n"
-        "      --outdir=<path>  - path to output folder (for extracted files)\n"
+        "      --out=<filename> - path to output file name (\"-\" - write archive to stdout)\n"
+        "      --outdir=<path>  - path to output folder (for extracted files, archives of several inputs)\n"
+        "      --prev=<filename> - archive to update (default: <input_file>.rzf, replaced if no --out)\n"
         "      --bufsize=N      - set buffer size (default: 256kb).\n"
+        "      --threads=N      - number of scan / extract / restore threads, 0 - auto (default: 1).\n"
+        "      --mmap=N         - memory-map input file while scanning (default: 0).\n"
+        "      --io=<name>      - how input is read (default: readahead):\n"
+        "                         buffered - plain reads, readahead - next block is read while\n"
+        "                         current one is processed, direct - same past system cache,\n"
+        "                         uring - several reads queued by io_uring (Linux, else readahead).\n"
+        "      --stats=<filename> - write performance counters as JSON (\"-\" - to console).\n"
         "      --verbose=N      - enable verbose mode (default: 1).\n\n";
 }
 
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Corpus.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace rz4 {
+    namespace Bench {
+        namespace {
+            // Stereo 16-bit PCM, 44 byte canonical header
+            const unsigned int WaveHeaderSize = 44;
+            const unsigned int WaveBlockAlign = 4;
+            const unsigned int WaveSampleRate = 44100;
+
+            inline void PutUInt16(char *Buffer, uint16_t Value) {
+                Buffer[0] = static_cast<char>(Value);
+                Buffer[1] = static_cast<char>(Value >> 8);
+            }
+
+            inline void PutUInt32(char *Buffer, uint32_t Value) {
+                PutUInt16(Buffer, static_cast<uint16_t>(Value));
+                PutUInt16(Buffer + 2, static_cast<uint16_t>(Value >> 16));
+            }
+
+            /*
+             * std::uniform_int_distribution differs between standard libraries,
+             * raw mt19937 output doesn't - corpus is the same on every platform.
+             */
+            inline uintmax_t Random(std::mt19937 &Rng, uintmax_t Range) {
+                const uintmax_t Value = (static_cast<uintmax_t>(Rng()) << 32) | Rng();
+                return Range == 0 ? 0 : Value % Range;
+            }
+
+            void Fill(CorpusFill Type, char *Buffer, uintmax_t Size, std::mt19937 &Rng) {
+                // Lots of 'R' and partial magics, worst case for candidate filters
+                static const char Alphabet[] = "RIFF WAVE Resource Interchange File Format RRRR abcdefghij\n";
+
+                switch (Type) {
+                case FillRandom:
+                    for (uintmax_t i = 0; i < Size; i++) {
+                        Buffer[i] = static_cast<char>(Rng());
+                    }
+                    break;
+                case FillText:
+                    for (uintmax_t i = 0; i < Size; i++) {
+                        Buffer[i] = Alphabet[Rng() % (sizeof(Alphabet) - 1)];
+                    }
+                    break;
+                default:
+                    std::memset(Buffer, 0, Size);
+                    break;
+                }
+            }
+
+            /*
+             * Two detuned tones with a bit of noise: compresses
+             * like real audio, not like silence or white noise.
+             */
+            void WriteWave(char *Buffer, unsigned int Size, std::mt19937 &Rng) {
+                const unsigned int DataSize = Size - WaveHeaderSize;
+                const double Pi = 3.14159265358979323846;
+                const double Step = 2 * Pi * (110 + Rng() % 880) / WaveSampleRate;
+                const double Coeff[2] = { 2 * std::cos(Step), 2 * std::cos(Step * 1.01) };
+                double Prev[2] = { 0, 0 };
+                double Curr[2] = { std::sin(Step), std::sin(Step * 1.01) };
+
+                std::memcpy(Buffer, "RIFF", 4);
+                PutUInt32(Buffer + 4, Size - 8);
+                std::memcpy(Buffer + 8, "WAVEfmt ", 8);
+                PutUInt32(Buffer + 16, 16);
+                PutUInt16(Buffer + 20, 1);
+                PutUInt16(Buffer + 22, 2);
+                PutUInt32(Buffer + 24, WaveSampleRate);
+                PutUInt32(Buffer + 28, WaveSampleRate * WaveBlockAlign);
+                PutUInt16(Buffer + 32, WaveBlockAlign);
+                PutUInt16(Buffer + 34, 16);
+                std::memcpy(Buffer + 36, "data", 4);
+                PutUInt32(Buffer + 40, DataSize);
+
+                char *Samples = Buffer + WaveHeaderSize;
+
+                for (unsigned int i = 0; i < DataSize; i += WaveBlockAlign) {
+                    for (int Channel = 0; Channel < 2; Channel++) {
+                        // sin(n + 1) = 2 cos(Step) sin(n) - sin(n - 1)
+                        const double Next = Coeff[Channel] * Curr[Channel] - Prev[Channel];
+                        Prev[Channel] = Curr[Channel];
+                        Curr[Channel] = Next;
+
+                        const int Noise = static_cast<int>(Rng() % 64) - 32;
+                        PutUInt16(Samples + i + Channel * 2, static_cast<uint16_t>(static_cast<int>(Next * 12000) + Noise));
+                    }
+                }
+            }
+        }
+
+        const char *CorpusFillName(CorpusFill Type) {
+            switch (Type) {
+            case FillRandom:
+                return "random";
+            case FillText:
+                return "text";
+            default:
+                return "zero";
+            }
+        }
+
+        /*
+         * Deterministic corpus: `CountOfStreams` RIFF WAVE streams
+         * of [MinStreamSize, MaxStreamSize] bytes at random positions,
+         * everything between them is filled by `Fill`. Streams which
+         * don't fit into `Size` are dropped. With `Duplicates` every
+         * second stream is the same bytes as the previous one.
+         */
+        CorpusInfo GenerateCorpus(const CorpusOptions &Options, std::vector<char> &Buffer) {
+            std::mt19937 Rng(Options.Seed);
+            std::vector<unsigned int> Sizes;
+            uintmax_t SizeOfStreams = 0;
+
+            Buffer.resize(Options.Size);
+
+            const unsigned int MinSize = std::max(Options.MinStreamSize, WaveHeaderSize + WaveBlockAlign);
+            const unsigned int MaxSize = std::max(Options.MaxStreamSize, MinSize);
+
+            for (unsigned int i = 0; i < Options.CountOfStreams; i++) {
+                unsigned int Size = MinSize + static_cast<unsigned int>(Random(Rng, MaxSize - MinSize + 1));
+                Size -= (Size - WaveHeaderSize) % WaveBlockAlign;
+
+                if (Options.Duplicates && i % 2 == 1) {
+                    Size = Sizes.back();
+                }
+
+                if (SizeOfStreams + Size > Options.Size) {
+                    break;
+                }
+
+                Sizes.push_back(Size);
+                SizeOfStreams += Size;
+            }
+
+            // Split the rest into gaps before, between and after streams
+            std::vector<uintmax_t> Cuts;
+
+            for (size_t i = 0; i < Sizes.size(); i++) {
+                Cuts.push_back(Random(Rng, Options.Size - SizeOfStreams + 1));
+            }
+
+            std::sort(Cuts.begin(), Cuts.end());
+
+            uintmax_t Position = 0;
+            uintmax_t Previous = 0;
+            uintmax_t LastStream = 0;
+
+            for (size_t i = 0; i < Sizes.size(); i++) {
+                Fill(Options.Fill, Buffer.data() + Position, Cuts[i] - Previous, Rng);
+                Position += Cuts[i] - Previous;
+                Previous = Cuts[i];
+
+                if (Options.Duplicates && i % 2 == 1) {
+                    std::memcpy(Buffer.data() + Position, Buffer.data() + LastStream, Sizes[i]);
+                } else {
+                    WriteWave(Buffer.data() + Position, Sizes[i], Rng);
+                }
+
+                LastStream = Position;
+                Position += Sizes[i];
+            }
+
+            Fill(Options.Fill, Buffer.data() + Position, Options.Size - Position, Rng);
+
+            CorpusInfo Info;
+            Info.CountOfStreams = static_cast<unsigned int>(Sizes.size());
+            Info.SizeOfStreams = SizeOfStreams;
+            return Info;
+        }
+    }
+}
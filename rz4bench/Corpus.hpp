@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RZ4BENCH_CORPUS_HPP
+#define RZ4BENCH_CORPUS_HPP
+
+#include <vector>
+#include <string>
+#include <random>
+#include <cstdint>
+
+namespace rz4 {
+    namespace Bench {
+        // Data between embedded streams
+        enum CorpusFill { FillRandom, FillText, FillZero };
+
+        typedef struct CorpusOptions {
+            CorpusFill Fill;
+            uintmax_t Size;
+            // Number of RIFF WAVE streams and range of their sizes
+            unsigned int CountOfStreams;
+            unsigned int MinStreamSize;
+            unsigned int MaxStreamSize;
+            uint32_t Seed;
+            // Every second stream is a copy of the previous one
+            bool Duplicates;
+        } CorpusOptions;
+
+        typedef struct CorpusInfo {
+            unsigned int CountOfStreams;
+            uintmax_t SizeOfStreams;
+        } CorpusInfo;
+
+        const char *CorpusFillName(CorpusFill);
+        CorpusInfo GenerateCorpus(const CorpusOptions&, std::vector<char>&);
+    }
+}
+
+#endif //RZ4BENCH_CORPUS_HPP
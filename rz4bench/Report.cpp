@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "Report.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <boost/format.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+namespace rz4 {
+    namespace Bench {
+        namespace {
+            std::string Escape(const std::string &Value) {
+                std::string Result;
+
+                for (char c : Value) {
+                    if (c == '"' || c == '\\') {
+                        Result += '\\';
+                        Result += c;
+                    } else if (static_cast<unsigned char>(c) < 0x20) {
+                        Result += boost::str(boost::format("\\u%04x") % static_cast<unsigned int>(c));
+                    } else {
+                        Result += c;
+                    }
+                }
+
+                return Result;
+            }
+        }
+
+        // MB/s
+        double Throughput(const BenchResult &Result) {
+            return Result.Seconds > 0 ? Result.Bytes / Result.Seconds / (1024.0 * 1024) : 0;
+        }
+
+        void Report::Set(const std::string &Key, const std::string &Value) {
+            Properties[Key] = Value;
+        }
+
+        void Report::Add(const BenchResult &Result) {
+            Results.push_back(Result);
+            Print(Result);
+        }
+
+        void Report::Print(const BenchResult &Result) const {
+            boost::format ResultFormat("%-30s %-8s %10.1f MB/s  (%u)");
+            std::cout << ResultFormat % Result.Name % Result.Corpus % Throughput(Result) % Result.Check << std::endl;
+        }
+
+        /*
+         * One result per line, so results of two runs can be diffed as text.
+         */
+        bool Report::WriteJson(const fs::path &Path) const {
+            std::ofstream Out(Path.string(), std::ofstream::trunc);
+
+            if (!Out.is_open()) {
+                return false;
+            }
+
+            Out << "{" << std::endl;
+
+            for (const auto &Property : Properties) {
+                Out << "  \"" << Escape(Property.first) << "\": \"" << Escape(Property.second) << "\"," << std::endl;
+            }
+
+            Out << "  \"results\": [" << std::endl;
+
+            for (size_t i = 0; i < Results.size(); i++) {
+                const BenchResult &Result = Results[i];
+
+                Out << boost::format("    {\"name\": \"%s\", \"corpus\": \"%s\", \"bytes\": %u, "
+                    "\"seconds\": %.6f, \"mb_per_s\": %.2f, \"check\": %u}%s")
+                    % Escape(Result.Name) % Escape(Result.Corpus) % Result.Bytes
+                    % Result.Seconds % Throughput(Result) % Result.Check
+                    % (i + 1 < Results.size() ? "," : "") << std::endl;
+            }
+
+            Out << "  ]" << std::endl << "}" << std::endl;
+            return Out.good();
+        }
+
+        /*
+         * Compare throughput with results of previous run.
+         * Result is a regression if it's slower by more than `Tolerance` percents.
+         */
+        bool Report::CompareWith(const fs::path &Path, double Tolerance, unsigned int &Regressions) const {
+            boost::property_tree::ptree Baseline;
+            std::map<std::string, double> Speeds;
+
+            Regressions = 0;
+
+            try {
+                boost::property_tree::read_json(Path.string(), Baseline);
+
+                for (const auto &Item : Baseline.get_child("results")) {
+                    Speeds[Item.second.get<std::string>("name") + "/" + Item.second.get<std::string>("corpus")]
+                        = Item.second.get<double>("mb_per_s");
+                }
+            } catch (const std::exception &) {
+                return false;
+            }
+
+            boost::format RegressionFormat("[!] %-30s %-8s %10.1f MB/s, was %.1f MB/s (%+.1f%%)");
+
+            for (const auto &Result : Results) {
+                auto Found = Speeds.find(Result.Name + "/" + Result.Corpus);
+
+                if (Found == Speeds.end() || Found->second <= 0) {
+                    continue;
+                }
+
+                const double Speed = Throughput(Result);
+
+                if (Speed < Found->second * (1 - Tolerance / 100)) {
+                    std::cout << RegressionFormat % Result.Name % Result.Corpus % Speed % Found->second
+                        % ((Speed / Found->second - 1) * 100) << std::endl;
+                    Regressions++;
+                }
+            }
+
+            return true;
+        }
+    }
+}
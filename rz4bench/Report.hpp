@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RZ4BENCH_REPORT_HPP
+#define RZ4BENCH_REPORT_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <boost/filesystem.hpp>
+
+namespace rz4 {
+    namespace Bench {
+        namespace fs = boost::filesystem;
+
+        typedef struct BenchResult {
+            std::string Name;
+            std::string Corpus;
+            uintmax_t Bytes;
+            // Best of all rounds
+            double Seconds;
+            // Number of hits, CRC etc. - must be the same on every run
+            uintmax_t Check;
+        } BenchResult;
+
+        class Report {
+        private:
+            std::vector<BenchResult> Results;
+            std::map<std::string, std::string> Properties;
+
+        public:
+            void Set(const std::string&, const std::string&);
+            void Add(const BenchResult&);
+            void Print(const BenchResult&) const;
+
+            bool WriteJson(const fs::path&) const;
+            bool CompareWith(const fs::path&, double, unsigned int&) const;
+        };
+
+        double Throughput(const BenchResult&);
+    }
+}
+
+#endif //RZ4BENCH_REPORT_HPP
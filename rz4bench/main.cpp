@@ -0,0 +1,740 @@
+/*
+ * Copyright (C) 2018 Yura Zhivaga <yzhivaga@gmail.com>
+ *
+ * This file is part of rz4.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <initializer_list>
+#include <boost/format.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "Corpus.hpp"
+#include "Report.hpp"
+#include "Engine/Scanner.hpp"
+#include "Engine/Compressor.hpp"
+#include "Engine/Restorer.hpp"
+#include "Engine/Extractor.hpp"
+#include "Engine/Codecs/Lz.hpp"
+#include "Utils/Utils.hpp"
+#include "Types/Types.hpp"
+
+#define BENCH_MEMORY_SIZE  256
+#define BENCH_FILE_SIZE    64
+#define BENCH_STREAMS      200
+#define BENCH_ROUNDS       5
+#define BENCH_SEED         42
+#define BENCH_TOLERANCE    10.0
+
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+namespace {
+    const std::string UsageMessage =
+        "Usage:\n"
+        "    rz4bench [options]\n\n"
+        "    Options:\n"
+        "      --memsize=N      - size of in-memory corpus for kernels, Mb (default: 256)\n"
+        "      --filesize=N     - size of corpus file for engine benchmarks, Mb (default: 64)\n"
+        "      --streams=N      - number of RIFF WAVE streams in corpus (default: 200)\n"
+        "      --seed=N         - seed of corpus generator (default: 42)\n"
+        "      --rounds=N       - runs of each benchmark, the best is taken (default: 5)\n"
+        "      --filter=<name>  - run only benchmarks which contain <name>\n"
+        "      --tmpdir=<path>  - folder for corpus and output files (default: system temp)\n"
+        "      --io=<name>      - I/O backend of engine benchmarks (default: readahead)\n"
+        "      --json=<path>    - write results to JSON file\n"
+        "      --baseline=<path> - compare with JSON results of previous run\n"
+        "      --tolerance=N    - allowed slowdown against baseline, % (default: 10)\n\n"
+        "    Exit code: 1 - results are wrong, 2 - slower than baseline.\n";
+
+    typedef struct BenchOptions {
+        uintmax_t MemorySize;
+        uintmax_t FileSize;
+        unsigned int CountOfStreams;
+        uint32_t Seed;
+        unsigned int Rounds;
+        std::string Filter;
+        fs::path TmpDir;
+        fs::path JsonFile;
+        fs::path BaselineFile;
+        double Tolerance;
+    } BenchOptions;
+
+    /*
+     * Old candidate loop of RiffWaveMatch: stop on every 'R'
+     * and compare both magics.
+     */
+    unsigned long CharMatchLoop(const char *Buffer, unsigned int Size) {
+        unsigned long Hits = 0;
+        int Index = rz4::Utils::CharMatch(Buffer, Size - 11, 'R');
+
+        while (Index != -1) {
+            if (std::memcmp(Buffer + Index, "RIFF", 4) == 0 && std::memcmp(Buffer + Index + 8, "WAVE", 4) == 0) {
+                Hits++;
+            }
+
+            Index = rz4::Utils::CharMatch(Buffer, Size - 11, 'R', static_cast<unsigned int>(Index + 1));
+        }
+
+        return Hits;
+    }
+
+    unsigned long SignatureMatchLoop(const char *Buffer, unsigned int Size) {
+        unsigned long Hits = 0;
+        int Index = rz4::Utils::SignatureMatch(Buffer, Size, "RIFF", "WAVE", 8);
+
+        while (Index != -1) {
+            Hits++;
+            Index = rz4::Utils::SignatureMatch(Buffer, Size, "RIFF", "WAVE", 8, static_cast<unsigned int>(Index + 1));
+        }
+
+        return Hits;
+    }
+
+    /*
+     * Old byte-at-a-time CRC32, reference for UpdateCRC32.
+     */
+    unsigned long TableCRC32(const char *Buffer, unsigned int Size) {
+        static uint32_t Table[256];
+        static bool Ready = false;
+
+        if (!Ready) {
+            rz4::Utils::GenerateTableCRC32(Table);
+            Ready = true;
+        }
+
+        uint32_t c = 0xFFFFFFFF;
+        for (unsigned int i = 0; i < Size; i++) {
+            c = Table[(c ^ static_cast<uint8_t>(Buffer[i])) & 0xFF] ^ (c >> 8);
+        }
+
+        return c ^ 0xFFFFFFFF;
+    }
+
+    /*
+     * Options of `rz4 c` with default switches.
+     */
+    rz4::Types::CompressorOptions DefaultCompressorOptions(const fs::path &InFile, const fs::path &OutFile,
+        const rz4::Engine::StreamCatalog *Streams, unsigned int BufferSize) {
+        rz4::Types::CompressorOptions CompressorOptions;
+        CompressorOptions.FileName = InFile;
+        CompressorOptions.OutFile = OutFile;
+        CompressorOptions.BufferSize = BufferSize;
+        CompressorOptions.Streams = Streams;
+        CompressorOptions.Jobs = 0;
+        CompressorOptions.EnableRiffWave = true;
+        CompressorOptions.WavPackCompLevel = 0;
+        CompressorOptions.TakCompLevel = 0;
+        CompressorOptions.PcmCompLevel = 5;
+        CompressorOptions.MinGain = 1;
+        CompressorOptions.Dedup = true;
+        CompressorOptions.CompressGaps = false;
+        CompressorOptions.Reuse = nullptr;
+        CompressorOptions.OutBuffer = nullptr;
+        CompressorOptions.Pool = nullptr;
+        return CompressorOptions;
+    }
+
+    /*
+     * Runs benchmarks and checks that every run gives the expected result.
+     * Engine benchmarks read the corpus from page cache, so they measure
+     * the code, not the disk.
+     */
+    class Suite {
+    private:
+        BenchOptions Options;
+        rz4::Bench::Report Report;
+        bool Failed;
+
+    public:
+        explicit Suite(const BenchOptions &Options) : Options(Options), Failed(false) {}
+
+        bool Enabled(const std::string &Name) const {
+            return Options.Filter.empty() || Name.find(Options.Filter) != std::string::npos;
+        }
+
+        bool Enabled(std::initializer_list<std::string> Names) const {
+            return std::any_of(Names.begin(), Names.end(), [this](const std::string &Name) { return Enabled(Name); });
+        }
+
+        /*
+         * Best time of `Rounds` runs. Fn returns a check value (hits, CRC etc.),
+         * every run must return the same one.
+         */
+        bool Run(const std::string &Name, const std::string &Corpus, uintmax_t Bytes,
+            const std::function<uintmax_t()> &Fn, uintmax_t &Check) {
+            if (!Enabled(Name)) {
+                return false;
+            }
+
+            rz4::Bench::BenchResult Result = { Name, Corpus, Bytes, 0, 0 };
+
+            for (unsigned int i = 0; i < Options.Rounds; i++) {
+                auto Start = std::chrono::high_resolution_clock::now();
+                uintmax_t Value = Fn();
+                std::chrono::duration<double> Time = std::chrono::high_resolution_clock::now() - Start;
+
+                if (i > 0 && Value != Result.Check) {
+                    Expect(Name + " (unstable)", Value, Result.Check);
+                }
+
+                Result.Check = Value;
+                Result.Seconds = i == 0 ? Time.count() : std::min(Result.Seconds, Time.count());
+            }
+
+            Report.Add(Result);
+            Check = Result.Check;
+            return true;
+        }
+
+        void Expect(const std::string &What, uintmax_t Value, uintmax_t Expected) {
+            if (Value != Expected) {
+                std::cout << boost::format("[!] %s: %u, expected %u") % What % Value % Expected << std::endl;
+                Failed = true;
+            }
+        }
+
+        void Kernels(rz4::Bench::CorpusFill Fill);
+        void CRC32();
+        void Lz(rz4::Bench::CorpusFill Fill);
+        void Engine(rz4::Bench::CorpusFill Fill);
+        void Jobs();
+        int Finish();
+    };
+
+    /*
+     * Candidate search kernels on the in-memory corpus.
+     */
+    void Suite::Kernels(rz4::Bench::CorpusFill Fill) {
+        rz4::Bench::CorpusOptions CorpusOptions = {
+            Fill, Options.MemorySize, Options.CountOfStreams, 4096, 1024 * 1024, Options.Seed, false };
+        std::vector<char> Buffer;
+        rz4::Bench::CorpusInfo Info = rz4::Bench::GenerateCorpus(CorpusOptions, Buffer);
+        const char *Corpus = rz4::Bench::CorpusFillName(Fill);
+        const unsigned int Size = static_cast<unsigned int>(Buffer.size());
+        uintmax_t Hits;
+
+        if (Run("CharMatch", Corpus, Size, [&]() { return CharMatchLoop(Buffer.data(), Size); }, Hits)) {
+            Expect("CharMatch hits", Hits, Info.CountOfStreams);
+        }
+
+        if (Run("SignatureMatch", Corpus, Size, [&]() { return SignatureMatchLoop(Buffer.data(), Size); }, Hits)) {
+            Expect("SignatureMatch hits", Hits, Info.CountOfStreams);
+        }
+    }
+
+    void Suite::CRC32() {
+        rz4::Bench::CorpusOptions CorpusOptions = {
+            rz4::Bench::FillRandom, Options.MemorySize, 0, 0, 0, Options.Seed, false };
+        std::vector<char> Buffer;
+        rz4::Bench::GenerateCorpus(CorpusOptions, Buffer);
+        const unsigned int Size = static_cast<unsigned int>(Buffer.size());
+        uintmax_t TableResult = 0, FastResult = 0;
+
+        Run("CRC32.table", "random", Size, [&]() { return TableCRC32(Buffer.data(), Size); }, TableResult);
+
+        if (Run("UpdateCRC32", "random", Size, [&]() { return rz4::Utils::UpdateCRC32(0, Buffer.data(), Size); }, FastResult)
+            && Enabled("CRC32.table")) {
+            Expect("UpdateCRC32", FastResult, TableResult);
+        }
+
+        uintmax_t Hash;
+        Run("Hash128", "random", Size, [&]() { return rz4::Utils::CalculateHash128(Buffer.data(), Size).Low; }, Hash);
+    }
+
+    /*
+     * Gap codec on blocks of the size used by compressor.
+     * Check of encode is size of output, 0 if data doesn't compress.
+     */
+    void Suite::Lz(rz4::Bench::CorpusFill Fill) {
+        rz4::Bench::CorpusOptions CorpusOptions = {
+            Fill, Options.MemorySize, 0, 0, 0, Options.Seed, false };
+        std::vector<char> Buffer;
+        rz4::Bench::GenerateCorpus(CorpusOptions, Buffer);
+        const char *Corpus = rz4::Bench::CorpusFillName(Fill);
+        const size_t BlockSize = 1024 * 1024;
+        std::vector<std::vector<char>> Payloads((Buffer.size() + BlockSize - 1) / BlockSize);
+        uintmax_t Check;
+
+        auto Encode = [&]() {
+            uintmax_t Size = 0;
+
+            for (size_t i = 0; i < Payloads.size(); i++) {
+                const size_t Length = std::min(BlockSize, Buffer.size() - i * BlockSize);
+
+                if (rz4::Engine::Codecs::Lz::Encode(Buffer.data() + i * BlockSize, Length, Payloads[i])) {
+                    Size += Payloads[i].size();
+                } else {
+                    Payloads[i].clear();
+                }
+            }
+
+            return Size;
+        };
+
+        // Decode needs payloads even if encode is filtered out
+        if (!Run("Lz.encode", Corpus, Buffer.size(), Encode, Check)) {
+            Encode();
+        }
+
+        const uintmax_t CorpusCRC = rz4::Utils::UpdateCRC32(0, Buffer.data(), Buffer.size());
+
+        if (Run("Lz.decode", Corpus, Buffer.size(), [&]() {
+            std::vector<char> Block;
+            uint32_t CRC = 0;
+
+            for (size_t i = 0; i < Payloads.size(); i++) {
+                const size_t Length = std::min(BlockSize, Buffer.size() - i * BlockSize);
+
+                // Blocks which don't compress are stored as is
+                if (Payloads[i].empty()) {
+                    CRC = rz4::Utils::UpdateCRC32(CRC, Buffer.data() + i * BlockSize, Length);
+                } else if (rz4::Engine::Codecs::Lz::Decode(Payloads[i].data(), Payloads[i].size(), Block)) {
+                    CRC = rz4::Utils::UpdateCRC32(CRC, Block.data(), Block.size());
+                }
+            }
+
+            return CRC; }, Check)) {
+            Expect("Lz.decode CRC", Check, CorpusCRC);
+        }
+    }
+
+    /*
+     * Scanner, file helpers and compress / restore on the corpus file.
+     */
+    void Suite::Engine(rz4::Bench::CorpusFill Fill) {
+        const char *Corpus = rz4::Bench::CorpusFillName(Fill);
+        const fs::path InFile = Options.TmpDir / (std::string("rz4bench-") + Corpus + ".bin");
+        const fs::path CopyFile = Options.TmpDir / (std::string("rz4bench-") + Corpus + ".copy");
+        const fs::path RzfFile = Options.TmpDir / (std::string("rz4bench-") + Corpus + ".rzf");
+        const fs::path RestoredFile = Options.TmpDir / (std::string("rz4bench-") + Corpus + ".restored");
+        const fs::path ExtractDir = Options.TmpDir / (std::string("rz4bench-") + Corpus + ".extract");
+
+        uint32_t CorpusCRC;
+        uintmax_t FileSize;
+        rz4::Bench::CorpusInfo Info;
+
+        if (!Enabled({ "Scanner", "Scanner.threads", "Scanner.mmap", "Scanner.cache",
+            "CalculateCRC32InFile", "CalculateCRC32InFile.threads", "CalculateCRC32InStream",
+            "CopyDataFromFileToFile", "ExtractDataFromFileToFile",
+            "Extract", "Compress", "Restore" })) {
+            return;
+        }
+
+        {
+            rz4::Bench::CorpusOptions CorpusOptions = {
+                Fill, Options.FileSize, Options.CountOfStreams, 4096, 1024 * 1024, Options.Seed, false };
+            std::vector<char> Buffer;
+            Info = rz4::Bench::GenerateCorpus(CorpusOptions, Buffer);
+            CorpusCRC = rz4::Utils::UpdateCRC32(0, Buffer.data(), Buffer.size());
+            FileSize = Buffer.size();
+
+            std::ofstream Out(InFile.string(), std::ofstream::binary | std::ofstream::trunc);
+            Out.write(Buffer.data(), Buffer.size());
+        }
+
+        rz4::Types::ScannerOptions ScannerOptions;
+        ScannerOptions.FileName = InFile;
+        ScannerOptions.BufferSize = 262144;
+        ScannerOptions.Threads = 1;
+        ScannerOptions.MemoryMap = false;
+        ScannerOptions.EnableRiffWave = true;
+        ScannerOptions.Begin = 0;
+
+        rz4::Types::ScannerOptions ThreadsOptions = ScannerOptions;
+        ThreadsOptions.Threads = 0;
+
+        rz4::Types::ScannerOptions MemoryMapOptions = ScannerOptions;
+        MemoryMapOptions.MemoryMap = true;
+
+        // Cache is made by the first scan, other runs only load it
+        const fs::path CacheFile = rz4::Engine::ScanCache::GetPath(InFile);
+        rz4::Types::ScannerOptions CacheOptions = ScannerOptions;
+        CacheOptions.CacheFile = CacheFile;
+
+        if (Enabled("Scanner.cache")) {
+            rz4::Engine::Scanner Scanner(CacheOptions);
+            Scanner.Start(nullptr);
+        }
+
+        const std::vector<std::pair<std::string, rz4::Types::ScannerOptions>> Scans = {
+            { "Scanner", ScannerOptions },
+            { "Scanner.threads", ThreadsOptions },
+            { "Scanner.mmap", MemoryMapOptions },
+            { "Scanner.cache", CacheOptions }
+        };
+
+        for (const auto &Item : Scans) {
+            uintmax_t Found;
+
+            if (Run(Item.first, Corpus, FileSize, [&]() {
+                rz4::Engine::Scanner Scanner(Item.second);
+                Scanner.Start(nullptr);
+                return Scanner.GetCountOfFoundStreams(); }, Found)) {
+                Expect(Item.first + " streams", Found, Info.CountOfStreams);
+            }
+        }
+
+        uintmax_t CRC;
+
+        if (Run("CalculateCRC32InFile", Corpus, FileSize, [&]() {
+            return rz4::Utils::CalculateCRC32InFile(InFile, 0, FileSize, 1); }, CRC)) {
+            Expect("CalculateCRC32InFile", CRC, CorpusCRC);
+        }
+
+        if (Run("CalculateCRC32InFile.threads", Corpus, FileSize, [&]() {
+            return rz4::Utils::CalculateCRC32InFile(InFile, 0, FileSize, std::max(std::thread::hardware_concurrency(), 1u)); }, CRC)) {
+            Expect("CalculateCRC32InFile.threads", CRC, CorpusCRC);
+        }
+
+        if (Run("CalculateCRC32InStream", Corpus, FileSize, [&]() {
+            std::ifstream In(InFile.string(), std::ifstream::binary);
+            return rz4::Utils::CalculateCRC32InStream(In, 0, FileSize); }, CRC)) {
+            Expect("CalculateCRC32InStream", CRC, CorpusCRC);
+        }
+
+        // Copy helpers, output is checked after the last round
+        const std::vector<std::pair<std::string, std::function<void()>>> Copies = {
+            { "CopyDataFromFileToFile", [&]() {
+                std::ofstream(CopyFile.string(), std::ofstream::binary | std::ofstream::trunc).close();
+                rz4::Utils::CopyDataFromFileToFile(InFile, 0, CopyFile, 0, FileSize); } },
+            { "ExtractDataFromFileToFile", [&]() {
+                rz4::Utils::ExtractDataFromFileToFile(InFile, 0, FileSize, CopyFile); } }
+        };
+
+        for (const auto &Item : Copies) {
+            uintmax_t Unused;
+
+            if (Run(Item.first, Corpus, FileSize, [&]() { Item.second(); return 0; }, Unused)) {
+                Expect(Item.first + " CRC", rz4::Utils::CalculateCRC32InFile(CopyFile, 0, fs::file_size(CopyFile)), CorpusCRC);
+            }
+        }
+
+        // As `rz4 e`, every found stream to its own file
+        if (Enabled("Extract")) {
+            rz4::Engine::Scanner Scanner(ScannerOptions);
+            Scanner.Start(nullptr);
+            Scanner.Close();
+
+            uintmax_t Extracted;
+
+            if (Run("Extract", Corpus, Scanner.GetSizeOfFoundStreams(), [&]() {
+                fs::remove_all(ExtractDir);
+                fs::create_directory(ExtractDir);
+
+                rz4::Types::ExtractorOptions ExtractorOptions;
+                ExtractorOptions.FileName = InFile;
+                ExtractorOptions.OutDir = ExtractDir;
+                ExtractorOptions.Streams = Scanner.GetFoundStreams();
+                ExtractorOptions.BufferSize = ScannerOptions.BufferSize;
+                ExtractorOptions.Threads = 0;
+
+                rz4::Engine::Extractor Extractor(ExtractorOptions);
+                return Extractor.Start(nullptr) ? Extractor.GetCountOfStreams() : 0; }, Extracted)) {
+                Expect("Extract streams", Extracted, Info.CountOfStreams);
+            }
+        }
+
+        // End-to-end, as `rz4 c` and `rz4 r` with default options
+        auto Compress = [&]() {
+            rz4::Engine::Scanner Scanner(ScannerOptions);
+            Scanner.Start(nullptr);
+            Scanner.Close();
+
+            fs::remove(RzfFile);
+
+            rz4::Engine::Compressor Compressor(DefaultCompressorOptions(
+                InFile, RzfFile, Scanner.GetFoundStreams(), ScannerOptions.BufferSize));
+            Compressor.Start(nullptr);
+            Compressor.Close();
+            return fs::file_size(RzfFile);
+        };
+
+        uintmax_t ArchiveSize;
+
+        // Restore needs an archive even if compress is filtered out
+        if (!Run("Compress", Corpus, FileSize, Compress, ArchiveSize) && Enabled("Restore")) {
+            Compress();
+        }
+
+        if (fs::exists(RzfFile) && Enabled("Restore")) {
+            uintmax_t Restored;
+
+            Run("Restore", Corpus, FileSize, [&]() {
+                fs::remove(RestoredFile);
+
+                rz4::Types::RestorerOptions RestorerOptions;
+                RestorerOptions.FileName = RzfFile;
+                RestorerOptions.OutFile = RestoredFile;
+                RestorerOptions.BufferSize = ScannerOptions.BufferSize;
+                RestorerOptions.Threads = 0;
+
+                rz4::Engine::Restorer Restorer(RestorerOptions);
+                bool Result = Restorer.Start();
+                Restorer.Close();
+                return Result ? Restorer.GetOriginalSize() : 0; }, Restored);
+
+            Expect("Restore size", Restored, FileSize);
+
+            if (Restored == FileSize) {
+                Expect("Restore CRC", rz4::Utils::CalculateCRC32InFile(RestoredFile, 0, FileSize), CorpusCRC);
+            }
+        }
+
+        for (const fs::path &Path : { InFile, CopyFile, RzfFile, RestoredFile, CacheFile }) {
+            boost::system::error_code Error;
+            fs::remove(Path, Error);
+        }
+
+        boost::system::error_code Error;
+        fs::remove_all(ExtractDir, Error);
+    }
+
+    /*
+     * Archive must not depend on count of encoder threads: copies
+     * of streams and gap blocks are written in the same way whichever
+     * worker encodes them first. Every second stream of corpus is a copy.
+     */
+    void Suite::Jobs() {
+        const fs::path InFile = Options.TmpDir / "rz4bench-jobs.bin";
+        const fs::path RzfFile = Options.TmpDir / "rz4bench-jobs.rzf";
+        const fs::path OtherFile = Options.TmpDir / "rz4bench-jobs.other.rzf";
+        uintmax_t FileSize;
+
+        {
+            rz4::Bench::CorpusOptions CorpusOptions = {
+                rz4::Bench::FillText, Options.FileSize, Options.CountOfStreams, 4096, 1024 * 1024, Options.Seed, true };
+            std::vector<char> Buffer;
+            rz4::Bench::GenerateCorpus(CorpusOptions, Buffer);
+            FileSize = Buffer.size();
+
+            std::ofstream Out(InFile.string(), std::ofstream::binary | std::ofstream::trunc);
+            Out.write(Buffer.data(), Buffer.size());
+        }
+
+        rz4::Types::ScannerOptions ScannerOptions;
+        ScannerOptions.FileName = InFile;
+        ScannerOptions.BufferSize = 262144;
+        ScannerOptions.Threads = 0;
+        ScannerOptions.MemoryMap = false;
+        ScannerOptions.EnableRiffWave = true;
+        ScannerOptions.Begin = 0;
+
+        rz4::Engine::Scanner Scanner(ScannerOptions);
+        Scanner.Start(nullptr);
+        Scanner.Close();
+
+        // As `rz4 c --gaps=1 --jobs=N`
+        auto Compress = [&](unsigned int Jobs, const fs::path &OutFile) {
+            fs::remove(OutFile);
+
+            rz4::Types::CompressorOptions CompressorOptions = DefaultCompressorOptions(
+                InFile, OutFile, Scanner.GetFoundStreams(), ScannerOptions.BufferSize);
+            CompressorOptions.Jobs = Jobs;
+            CompressorOptions.CompressGaps = true;
+
+            rz4::Engine::Compressor Compressor(CompressorOptions);
+            Compressor.Start(nullptr);
+            Compressor.Close();
+            return fs::file_size(OutFile);
+        };
+
+        uintmax_t ArchiveSize;
+
+        if (Run("Compress.jobs", "text", FileSize, [&]() { return Compress(0, RzfFile); }, ArchiveSize)) {
+            const uintmax_t ArchiveCRC = rz4::Utils::CalculateCRC32InFile(RzfFile, 0, ArchiveSize);
+
+            for (unsigned int Jobs : { 1u, 2u, 8u }) {
+                const std::string What = "Compress.jobs, jobs=" + std::to_string(Jobs);
+                const uintmax_t Size = Compress(Jobs, OtherFile);
+                Expect(What + " size", Size, ArchiveSize);
+
+                if (Size == ArchiveSize) {
+                    Expect(What + " CRC", rz4::Utils::CalculateCRC32InFile(OtherFile, 0, Size), ArchiveCRC);
+                }
+            }
+        }
+
+        for (const fs::path &Path : { InFile, RzfFile, OtherFile }) {
+            boost::system::error_code Error;
+            fs::remove(Path, Error);
+        }
+    }
+
+    int Suite::Finish() {
+        Report.Set("signature_match_kernel", rz4::Utils::SignatureMatchKernelName());
+        Report.Set("crc32_kernel", rz4::Utils::CRC32KernelName());
+        Report.Set("hardware_threads", std::to_string(std::thread::hardware_concurrency()));
+        Report.Set("memory_size", std::to_string(Options.MemorySize));
+        Report.Set("file_size", std::to_string(Options.FileSize));
+        Report.Set("streams", std::to_string(Options.CountOfStreams));
+        Report.Set("seed", std::to_string(Options.Seed));
+        Report.Set("rounds", std::to_string(Options.Rounds));
+
+        if (!Options.JsonFile.empty() && !Report.WriteJson(Options.JsonFile)) {
+            std::cout << "[!] Can't write " << Options.JsonFile.string() << std::endl;
+            Failed = true;
+        }
+
+        if (Failed) {
+            return 1;
+        }
+
+        if (!Options.BaselineFile.empty()) {
+            unsigned int Regressions;
+
+            if (!Report.CompareWith(Options.BaselineFile, Options.Tolerance, Regressions)) {
+                std::cout << "[!] Can't read baseline " << Options.BaselineFile.string() << std::endl;
+                return 1;
+            }
+
+            if (Regressions > 0) {
+                std::cout << "[!] Regressions: " << Regressions << std::endl;
+                return 2;
+            }
+        }
+
+        return 0;
+    }
+
+    bool ParseArgs(BenchOptions &Options, int argc, char *argv[]) {
+        po::options_description desc("");
+        desc.add_options()
+            ("help,h", "Show help")
+            ("memsize", po::value<unsigned int>())
+            ("filesize", po::value<unsigned int>())
+            ("streams", po::value<unsigned int>())
+            ("seed", po::value<uint32_t>())
+            ("rounds", po::value<unsigned int>())
+            ("filter", po::value<std::string>())
+            ("tmpdir", po::value<std::string>())
+            ("io", po::value<std::string>())
+            ("json", po::value<std::string>())
+            ("baseline", po::value<std::string>())
+            ("tolerance", po::value<double>());
+
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+        if (vm.find("memsize") != vm.end()) {
+            Options.MemorySize = static_cast<uintmax_t>(vm["memsize"].as<unsigned int>()) * 1024 * 1024;
+        }
+
+        if (vm.find("filesize") != vm.end()) {
+            Options.FileSize = static_cast<uintmax_t>(vm["filesize"].as<unsigned int>()) * 1024 * 1024;
+        }
+
+        if (vm.find("streams") != vm.end()) {
+            Options.CountOfStreams = vm["streams"].as<unsigned int>();
+        }
+
+        if (vm.find("seed") != vm.end()) {
+            Options.Seed = vm["seed"].as<uint32_t>();
+        }
+
+        if (vm.find("rounds") != vm.end()) {
+            Options.Rounds = std::max(vm["rounds"].as<unsigned int>(), 1u);
+        }
+
+        if (vm.find("filter") != vm.end()) {
+            Options.Filter = vm["filter"].as<std::string>();
+        }
+
+        if (vm.find("tmpdir") != vm.end()) {
+            Options.TmpDir = vm["tmpdir"].as<std::string>();
+        }
+
+        if (vm.find("io") != vm.end() && !rz4::Utils::SetIoBackend(vm["io"].as<std::string>())) {
+            throw std::invalid_argument("unknown I/O backend");
+        }
+
+        if (vm.find("json") != vm.end()) {
+            Options.JsonFile = vm["json"].as<std::string>();
+        }
+
+        if (vm.find("baseline") != vm.end()) {
+            Options.BaselineFile = vm["baseline"].as<std::string>();
+        }
+
+        if (vm.find("tolerance") != vm.end()) {
+            Options.Tolerance = vm["tolerance"].as<double>();
+        }
+
+        return vm.find("help") == vm.end();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions Options;
+    Options.MemorySize = static_cast<uintmax_t>(BENCH_MEMORY_SIZE) * 1024 * 1024;
+    Options.FileSize = static_cast<uintmax_t>(BENCH_FILE_SIZE) * 1024 * 1024;
+    Options.CountOfStreams = BENCH_STREAMS;
+    Options.Seed = BENCH_SEED;
+    Options.Rounds = BENCH_ROUNDS;
+    Options.TmpDir = fs::temp_directory_path();
+    Options.Tolerance = BENCH_TOLERANCE;
+
+    try {
+        if (!ParseArgs(Options, argc, argv)) {
+            std::cout << UsageMessage << std::endl;
+            return 0;
+        }
+    } catch (const std::exception &Error) {
+        std::cout << "[!] " << Error.what() << std::endl << UsageMessage << std::endl;
+        return 1;
+    }
+
+    std::cout << "SignatureMatch kernel: " << rz4::Utils::SignatureMatchKernelName() << std::endl;
+    std::cout << "CRC32 kernel: " << rz4::Utils::CRC32KernelName() << std::endl;
+    std::cout << "I/O backend: " << rz4::Utils::IoBackendName() << std::endl << std::endl;
+
+    const rz4::Bench::CorpusFill Fills[] = { rz4::Bench::FillRandom, rz4::Bench::FillText, rz4::Bench::FillZero };
+    Suite Suite(Options);
+
+    for (auto Fill : Fills) {
+        if (Suite.Enabled({ "CharMatch", "SignatureMatch" })) {
+            Suite.Kernels(Fill);
+        }
+    }
+
+    if (Suite.Enabled({ "CRC32.table", "UpdateCRC32", "Hash128" })) {
+        Suite.CRC32();
+    }
+
+    for (auto Fill : Fills) {
+        if (Suite.Enabled({ "Lz.encode", "Lz.decode" })) {
+            Suite.Lz(Fill);
+        }
+    }
+
+    for (auto Fill : Fills) {
+        Suite.Engine(Fill);
+    }
+
+    if (Suite.Enabled("Compress.jobs")) {
+        Suite.Jobs();
+    }
+
+    return Suite.Finish();
+}